@@ -0,0 +1,77 @@
+/**
+ * finger_table_bench.cc
+ *
+ * Microbenchmark comparing FingerTable::Lookup, which computes the index of
+ * the relevant finger directly, with FingerTable::LinearLookup, which scans
+ * the table calling Key::InBetween on each finger.
+ */
+
+#include "../src/finger_table.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+/**
+ * Time num_iters lookups of the given keys using the given lookup method.
+ *
+ * @param table Table to query.
+ * @param keys Keys to look up (cycled through).
+ * @param num_iters Number of lookups to perform.
+ * @param lookup Member function of FingerTable to time.
+ * @return Mean nanoseconds per lookup.
+ */
+static double TimeLookups(const FingerTable &table,
+                          const std::vector<Key> &keys, int num_iters,
+                          PeerRepr (FingerTable::*lookup)(const Key &) const)
+{
+	int checksum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < num_iters; i++)
+		checksum += (table.*lookup)(keys[i % keys.size()]).port_;
+	auto end = std::chrono::steady_clock::now();
+
+	// Print the checksum so the compiler can't discard the lookups.
+	std::cout << "  (checksum " << checksum << ")" << std::endl;
+	return std::chrono::duration<double, std::nano>(end - start).count()
+	       / num_iters;
+}
+
+int main()
+{
+	const int num_peers = 64, num_keys = 4096, num_iters = 200000;
+	Key id("127.0.0.1:5000", false);
+
+	std::vector<PeerRepr> peers;
+	for(int i = 0; i < num_peers; i++) {
+		Key peer_id("127.0.0.1:" + std::to_string(5001 + i), false);
+		peers.emplace_back(peer_id, peer_id, peer_id, "127.0.0.1", 5001 + i);
+	}
+	std::sort(peers.begin(), peers.end());
+
+	FingerTable table(id);
+	for(int i = 0; i < table.num_entries_; i++) {
+		FingerRange range = table.GetNthRange(i);
+		PeerRepr succ = peers.front();
+		for(const PeerRepr &peer : peers) {
+			if(peer.id_ >= range.first) {
+				succ = peer;
+				break;
+			}
+		}
+		table.AddFinger(Finger { range.first, range.second, succ });
+	}
+
+	std::vector<Key> keys;
+	for(int i = 0; i < num_keys; i++)
+		keys.emplace_back(std::to_string(i), false);
+
+	double linear_ns = TimeLookups(table, keys, num_iters,
+	                               &FingerTable::LinearLookup);
+	double direct_ns = TimeLookups(table, keys, num_iters,
+	                               &FingerTable::Lookup);
+
+	std::cout << "LinearLookup: " << linear_ns << " ns/lookup" << std::endl;
+	std::cout << "Lookup:       " << direct_ns << " ns/lookup" << std::endl;
+	std::cout << "Speedup:      " << linear_ns / direct_ns << "x" << std::endl;
+	return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * gf_ida_bench.cc
+ *
+ * Measures dispersal over GF(2^8) with the 14/10 scheme DataBlock uses:
+ *      - Prewarm     : Time to invert the matrix of every set of 10 indices,
+ *                      which Decode would otherwise do on first meeting each
+ *                      set.
+ *      - Throughput  : Bytes of block per second encoded into 14 fragments,
+ *                      and recovered from 10 (the last 10, so that no
+ *                      fragment is a plain stripe of the block), once for
+ *                      each multiplication kernel this CPU supports.
+ *                      Fragments and blocks are written into buffers
+ *                      allocated up front, so this is the arithmetic alone.
+ *      - Allocations : Heap allocations per block, and bytes allocated, for
+ *                      EncodeInto/DecodeInto, Encode/Decode, and a DataBlock
+ *                      encoded from a value and then decoded from fragments,
+ *                      as a peer does on a write and a read.
+ *
+ * Runs on a single thread, so figures are per core.
+ *
+ * Usage: gf_ida_bench [block_bytes [iterations]]
+ */
+
+#include "../src/data_block.h"
+#include "../src/gf256.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+
+/// Heap allocations made so far, and their total size.
+static size_t allocations = 0, allocated_bytes = 0;
+
+void *operator new(size_t size)
+{
+	allocations++;
+	allocated_bytes += size;
+	if(void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+/**
+ * Time a function over a number of iterations.
+ *
+ * @return Seconds per iteration.
+ */
+template<typename Fn>
+static double TimePerIteration(int iterations, Fn &&fn)
+{
+	fn();
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < iterations; i++)
+		fn();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+	                                     start).count() / iterations;
+}
+
+/**
+ * Count the heap allocations a function makes.
+ *
+ * @param name What the function does.
+ * @param fn Function.
+ */
+template<typename Fn>
+static void CountAllocations(const std::string &name, Fn &&fn)
+{
+	fn();
+	size_t count = allocations, bytes = allocated_bytes;
+	fn();
+	std::cout << "  " << name << ": " << allocations - count
+	          << " allocations, " << allocated_bytes - bytes << " bytes"
+	          << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t block_size = argc > 1 ? std::atol(argv[1]) : 1 << 20;
+	const int iterations = argc > 2 ? std::atoi(argv[2]) : 200;
+
+	GaloisIDA ida(14, 10);
+	std::mt19937 gen(1);
+	ByteArr block(block_size);
+	for(uint8_t &byte : block)
+		byte = uint8_t(gen());
+
+	const size_t frag_size = ida.FragmentSize(block_size);
+	GFMatrix encoded = ida.Encode(block.data(), block.size());
+	ByteArr decoded(block_size);
+	const uint8_t *frags[10];
+	int fid[10];
+	for(int i = 0; i < 10; i++) {
+		fid[i] = i + 5;
+		frags[i] = encoded.Row(i + 4);
+	}
+
+	std::cout << "14/10, " << block_size << " byte blocks, " << iterations
+	          << " iterations" << std::endl;
+
+	auto prewarm_start = std::chrono::steady_clock::now();
+	ida.PrewarmDecodeCache();
+	std::cout << "Prewarm: " << ida.DecodeCacheSize() << " matrices in "
+	          << std::chrono::duration<double, std::milli>(
+	                     std::chrono::steady_clock::now() -
+	                     prewarm_start).count()
+	          << "ms" << std::endl;
+
+	for(GFKernel kernel : GFSupportedKernels()) {
+		GFUseKernel(kernel);
+		double encode = TimePerIteration(iterations, [&] {
+			ida.EncodeInto(block.data(), block.size(), encoded.Row(0),
+			               frag_size);
+		});
+		double decode = TimePerIteration(iterations, [&] {
+			ida.DecodeInto(frags, fid, block_size, decoded.data());
+		});
+		if(decoded != block)
+			std::abort();
+		std::cout << GFKernelName(kernel) << ": encode "
+		          << block_size / encode / 1e9 << " GB/s, decode "
+		          << block_size / decode / 1e9 << " GB/s" << std::endl;
+	}
+
+	std::cout << "Allocations per block:" << std::endl;
+	CountAllocations("EncodeInto", [&] {
+		ida.EncodeInto(block.data(), block.size(), encoded.Row(0), frag_size);
+	});
+	CountAllocations("DecodeInto", [&] {
+		ida.DecodeInto(frags, fid, block_size, decoded.data());
+	});
+	ByteMatrix frag_rows;
+	for(const uint8_t *frag : frags)
+		frag_rows.emplace_back(frag, frag + frag_size);
+	std::vector<int> fid_list(fid, fid + 10);
+	CountAllocations("Encode", [&] {
+		encoded = ida.Encode(block.data(), block.size());
+	});
+	CountAllocations("Decode", [&] {
+		decoded = ida.Decode(frag_rows, fid_list, block_size);
+	});
+
+	std::string value(block.begin(), block.end());
+	CountAllocations("DataBlock write and read", [&] {
+		DataBlock written(value, false);
+		std::vector<DataFragment> received(written.fragments_.begin() + 4,
+		                                   written.fragments_.end());
+		DataBlock read(received);
+		if(read.Decode() != value)
+			std::abort();
+	});
+}
@@ -0,0 +1,171 @@
+/**
+ * ring_sim_bench.cc
+ *
+ * Stands up a ring of peers on a SimulatedTransport, at a scale for which no
+ * test could bind ports, and measures:
+ *      - Join convergence : Time from the last join until every peer's
+ *                           successor and predecessor are the true ones.
+ *      - Lookup hops      : Next-hop requests per iterative lookup, once the
+ *                           ring has converged.
+ *      - Maintenance      : Bytes per peer per second the converged ring
+ *                           spends on stabilization, by command.
+ *
+ * Peers join one at a time through the first, as in peer_test.cc.
+ *
+ * Usage: ring_sim_bench [num_peers [latency_us [loss]]]
+ */
+
+#include "../src/peer.h"
+#include "../src/simulated_transport.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+/// Threads on which each peer's server runs.
+static const int kServerThreads = 2;
+
+/**
+ * Does every peer have the true successor and predecessor?
+ *
+ * @param peers Peers in the ring.
+ * @param ids IDs of every peer, sorted.
+ * @return Number of peers whose pointers are both correct.
+ */
+static size_t CountConverged(const std::vector<std::unique_ptr<Peer>> &peers,
+                             const std::vector<Key> &ids)
+{
+	size_t converged = 0;
+	for(const auto &peer : peers) {
+		auto routing = peer->GetRoutingState();
+		auto it = std::lower_bound(ids.begin(), ids.end(), routing->self_.id_);
+		const Key &succ = (it + 1 == ids.end()) ? ids.front() : *(it + 1);
+		const Key &pred = (it == ids.begin()) ? ids.back() : *(it - 1);
+		if(routing->successors_.Size() > 0 &&
+		   routing->successors_.GetNthEntry(0).id_ == succ &&
+		   routing->predecessor_.has_value() &&
+		   routing->predecessor_->id_ == pred)
+			converged++;
+	}
+	return converged;
+}
+
+int main(int argc, char *argv[])
+{
+	const int num_peers = argc > 1 ? std::atoi(argv[1]) : 1000;
+	const auto latency = std::chrono::microseconds(
+			argc > 2 ? std::atoi(argv[2]) : 1000);
+	const double loss = argc > 3 ? std::atof(argv[3]) : 0;
+	const int num_lookups = 2000;
+
+	// Peers log every step they take; keep only the results.
+	std::ostream out(std::cout.rdbuf());
+	std::cout.setstate(std::ios::failbit);
+
+	SimulatedTransport transport({ latency, latency / 4, loss, 0 });
+	std::vector<std::unique_ptr<Peer>> peers;
+	for(int i = 0; i < num_peers; i++)
+		peers.push_back(std::make_unique<Peer>(
+				("10." + std::to_string(i / 65536) + "." +
+				 std::to_string(i / 256 % 256) + "." +
+				 std::to_string(i % 256)).c_str(), 5000, kServerThreads,
+				&transport));
+	// Hops are only counted for iterative lookups.
+	for(const auto &peer : peers)
+		peer->SetLookupMode(LookupMode::ITERATIVE);
+
+	out << num_peers << " peers, " << latency.count() << "us latency, "
+	    << loss << " loss" << std::endl;
+
+	peers.front()->StartChord();
+	int failed_joins = 0;
+	auto join_start = std::chrono::steady_clock::now();
+	for(int i = 1; i < num_peers; i++) {
+		try {
+			peers[i]->Join("10.0.0.0", 5000);
+		} catch(...) {
+			failed_joins++;
+		}
+	}
+	auto join_end = std::chrono::steady_clock::now();
+	out << "Joins: "
+	    << std::chrono::duration<double, std::milli>(join_end -
+	                                                 join_start).count() /
+	       std::max(num_peers - 1, 1)
+	    << "ms each (" << failed_joins << " failed)" << std::endl;
+
+	std::vector<Key> ids;
+	for(const auto &peer : peers)
+		ids.push_back(peer->GetRoutingState()->self_.id_);
+	std::sort(ids.begin(), ids.end());
+
+	// Poll until every peer points at its true neighbours, or give up.
+	size_t converged = 0;
+	auto deadline = join_end + 300s;
+	while((converged = CountConverged(peers, ids)) < size_t(num_peers) &&
+	      std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(100ms);
+	out << "Convergence: "
+	    << std::chrono::duration<double>(std::chrono::steady_clock::now() -
+	                                     join_end).count()
+	    << "s (" << converged << "/" << num_peers << " peers)" << std::endl;
+
+	// Measure stabilization traffic of the settled ring.
+	transport.ResetStats();
+	const auto window = 10s;
+	std::this_thread::sleep_for(window);
+	TransportStats stats = transport.GetStats();
+	double per_peer_sec = double(num_peers) *
+	                      std::chrono::duration<double>(window).count();
+	out << "Maintenance: " << stats.bytes_ / per_peer_sec
+	    << " bytes/peer/s, " << stats.messages_ / per_peer_sec
+	    << " messages/peer/s" << std::endl;
+	for(const auto &[command, bytes] : stats.bytes_by_command_)
+		out << "  " << command << ": " << bytes / per_peer_sec
+		    << " bytes/peer/s" << std::endl;
+
+	// Lookups of random keys from random peers.
+	uint64_t hops_before = 0, hops_after = 0;
+	for(const auto &peer : peers)
+		hops_before += peer->GetLookupStats().hops_;
+
+	std::mt19937 gen(42);
+	std::uniform_int_distribution<int> pick(0, num_peers - 1);
+	int wrong = 0;
+	auto lookup_start = std::chrono::steady_clock::now();
+	for(int i = 0; i < num_lookups; i++) {
+		Key key("key" + std::to_string(i), false);
+		auto it = std::lower_bound(ids.begin(), ids.end(), key);
+		const Key &truth = it == ids.end() ? ids.front() : *it;
+		try {
+			if(peers[pick(gen)]->FindSuccessor(key).id_ != truth)
+				wrong++;
+		} catch(...) {
+			wrong++;
+		}
+	}
+	auto lookup_end = std::chrono::steady_clock::now();
+
+	for(const auto &peer : peers)
+		hops_after += peer->GetLookupStats().hops_;
+	out << "Lookups: " << double(hops_after - hops_before) / num_lookups
+	    << " hops on average (0.5 * log2(N) = "
+	    << 0.5 * std::log2(num_peers) << "), "
+	    << std::chrono::duration<double, std::milli>(lookup_end -
+	                                                 lookup_start).count() /
+	       num_lookups
+	    << "ms each, " << wrong << "/" << num_lookups << " wrong" << std::endl;
+
+	// Quiet the whole ring before tearing it down, so that the peers left
+	// standing do not spend the teardown probing those already gone.
+	for(const auto &peer : peers)
+		peer->StopStabilizer();
+	peers.clear();
+}
@@ -1,96 +1,145 @@
 #include "client.h"
+#include "local_transport.h"
+#include "message_frame.h"
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+Client::Client(WireFormat format, Transport *transport)
+    : format_(format)
+    , transport_(transport ? transport : &LocalTransport::Default())
+    , pool_(SharedIoContext(), POOL_CONNECTIONS_PER_PEER,
+            std::chrono::milliseconds(POOL_IDLE_TIMEOUT_MS))
+    , in_flight_(0)
+{}
 
-/**
- * Split a string into a vector of substrings based on delimiter.
- *
- * @param s String to split.
- * @param delimiter The substring which delimits the substrings in the result.
- * @return A vector of substrings.
- */
-static std::vector<std::string> Split(const std::string &s,
-                                      const std::string &delimiter)
+Client::~Client()
 {
-    size_t pos_start = 0, pos_end, delim_len = delimiter.length();
-    std::string token;
-    std::vector<std::string> res;
-
-    while ((pos_end = s.find (delimiter, pos_start)) != std::string::npos) {
-        token = s.substr (pos_start, pos_end - pos_start);
-        pos_start = pos_end + delim_len;
-        res.push_back (token);
-    }
-
-    res.push_back (s.substr (pos_start));
-    return res;
+    std::unique_lock<std::mutex> lock(in_flight_mutex_);
+    in_flight_cv_.wait(lock, [this] { return in_flight_ == 0; });
 }
 
-/**
- * A poor connection can result in extraneous characters being appended to
- * the end of messages. Remove those characters if they exist.
- *
- * @param serializedJson Serialized JSON message received over a network
- *                       connection.
- * @return Serialized JSON without extraneous characters after final bracket.
- */
-static std::string SanitizeJson(const std::string &serializedJson)
+boost::asio::io_context &Client::SharedIoContext()
 {
-	std::vector<std::string> split_by_bracket = Split(serializedJson, "}");
-	if(!split_by_bracket.back().empty())
-		split_by_bracket.pop_back();
-
-    std::string res_str;
-	for(const auto &sub_str : split_by_bracket)
-        res_str += sub_str + "}";
-
-	return res_str;
+    // Constructed once, on first use, and stopped at exit.
+    static struct IoThreads {
+        boost::asio::io_context io_context_;
+        boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+                work_;
+        std::vector<std::thread> threads_;
+
+        IoThreads()
+            : work_(boost::asio::make_work_guard(io_context_))
+        {
+            for(int i = 0; i < CLIENT_IO_THREADS; i++)
+                threads_.emplace_back([this] { io_context_.run(); });
+        }
+
+        ~IoThreads()
+        {
+            io_context_.stop();
+            for(std::thread &t : threads_)
+                t.join();
+        }
+    } io_threads;
+
+    return io_threads.io_context_;
 }
 
-Client::Client()
-    : reader_((new Json::CharReaderBuilder)->newCharReader())
-{}
-
 Json::Value Client::MakeRequest(const std::string &ip_addr, unsigned short port,
                                 const Json::Value &request)
 {
-    boost::asio::io_context io_context;
+    return MakeRequestAsync(ip_addr, port, request).get();
+}
 
-    std::string serialized_req = Json::writeString(writer_, request);
-    tcp::socket s(io_context);
+std::future<Json::Value> Client::MakeRequestAsync(const std::string &ip_addr,
+                                                  unsigned short port,
+                                                  const Json::Value &request)
+{
+    auto promise = std::make_shared<std::promise<Json::Value>>();
+    std::future<Json::Value> response = promise->get_future();
+    MakeRequestAsync(ip_addr, port, request,
+                     [promise](std::exception_ptr err, Json::Value resp) {
+        if(err)
+            promise->set_exception(err);
+        else
+            promise->set_value(std::move(resp));
+    });
+    return response;
+}
 
-    tcp::resolver resolver(io_context);
-	try {
-		s.connect({boost::asio::ip::address::from_string(ip_addr), port});
-	} catch(const std::exception &err) {
-		throw std::exception();
-	}
-    boost::asio::write(s, boost::asio::buffer(serialized_req));
-    s.shutdown(tcp::socket::shutdown_send);
-
-    error_code ec;
-    char reply[2048];
-
-    size_t reply_length = boost::asio::read(s, boost::asio::buffer(reply),
-                                            ec);
-
-    Json::Value json_resp;
-    JSONCPP_STRING parse_err;
-    std::string resp_str(reply);
-	std::string sanitized_resp = SanitizeJson(resp_str);
-
-    Json::CharReader *reader = Json::CharReaderBuilder().newCharReader();
-	bool success = reader->parse(sanitized_resp.c_str(),
-                                 sanitized_resp.c_str() + sanitized_resp.length(),
-                                 &json_resp, &parse_err);
-	delete reader;
-    if (success)
-        return json_resp;
-
-    throw std::runtime_error("Error parsing response.");
+void Client::MakeRequestAsync(const std::string &ip_addr, unsigned short port,
+                              const Json::Value &request,
+                              ResponseHandler handler)
+{
+    // Count the request until its handler has returned; see ~Client.
+    {
+        std::lock_guard<std::mutex> lock(in_flight_mutex_);
+        in_flight_++;
+    }
+    handler = [this, handler = std::move(handler)](std::exception_ptr err,
+                                                   Json::Value resp) {
+        handler(err, std::move(resp));
+        std::lock_guard<std::mutex> lock(in_flight_mutex_);
+        if(--in_flight_ == 0)
+            in_flight_cv_.notify_all();
+    };
+
+    // A server in this process (or on a simulated network) is handed the
+    // request directly.
+    if(transport_->Send(ip_addr, port, request, handler))
+        return;
+
+    std::shared_ptr<const std::string> serialized_req;
+    try {
+        serialized_req = std::make_shared<const std::string>(
+                Serialize(request, format_));
+    } catch(...) {
+        handler(std::current_exception(), Json::Value());
+        return;
+    }
+
+    Send(ip_addr, port, std::move(serialized_req), std::move(handler), true);
+}
+
+void Client::Send(const std::string &ip_addr, unsigned short port,
+                  std::shared_ptr<const std::string> serialized_req,
+                  ResponseHandler handler, bool may_retry)
+{
+    std::shared_ptr<Connection> conn = pool_.Get(ip_addr, port);
+    conn->Send(serialized_req, format_,
+               [this, ip_addr, port, serialized_req, may_retry,
+                handler = std::move(handler)]
+               (std::exception_ptr err, WireFormat format,
+                std::string resp_body, bool retryable) mutable {
+        if(err) {
+            // A pooled connection may have been closed by the server before
+            // it received our request, so try once more on another.
+            if(retryable && may_retry)
+                return Send(ip_addr, port, std::move(serialized_req),
+                            std::move(handler), false);
+            return handler(err, Json::Value());
+        }
+
+        Json::Value resp;
+        try {
+            resp = Deserialize(resp_body.data(),
+                               resp_body.data() + resp_body.size(), format);
+        } catch(const std::exception &parse_err) {
+            return handler(std::make_exception_ptr(
+                    std::runtime_error("Error parsing response.")),
+                           Json::Value());
+        }
+        handler(nullptr, std::move(resp));
+    });
 }
 
 bool Client::IsAlive(const std::string &ip_addr, unsigned short port)
 {
+    if(std::optional<bool> alive = transport_->IsAlive(ip_addr, port))
+        return *alive;
+
     boost::asio::io_context io_context;
     tcp::socket s(io_context);
     tcp::resolver resolver(io_context);
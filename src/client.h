@@ -1,5 +1,6 @@
 #ifndef CLIENT_H_CHORD_FINAL
 #define CLIENT_H_CHORD_FINAL
+#define CLIENT_IO_THREADS 4
 
 /**
  * client.h
@@ -9,11 +10,33 @@
  * to:
  *      - Send JSON requests to a given IP/port combo and return JSON responses.
  *      - Determine whether or not a server is running on a given IP/port combo.
+ *
+ * Connections are kept open between requests in a ConnectionPool, so that
+ * repeated requests to the same server skip the TCP handshake, and requests
+ * to the same server share a few connections rather than each opening one.
+ *
+ * Requests may also be made asynchronously, so that a caller can have many
+ * in flight at once. All requests run on a single io_context shared by every
+ * Client in the process and driven by CLIENT_IO_THREADS threads, rather than
+ * on a thread per request.
+ *
+ * Requests are first offered to a Transport (see transport.h). By default
+ * this is the process-wide LocalTransport, so requests to a server running in
+ * this same process bypass the network entirely; a SimulatedTransport instead
+ * carries every request over an in-memory network.
  */
 
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <json/json.h>
 #include <boost/asio.hpp>
 #include <boost/system/error_code.hpp>
+#include "connection_pool.h"
+#include "transport.h"
+#include "wire_format.h"
 
 using boost::asio::ip::tcp;
 using boost::system::error_code;
@@ -22,13 +45,32 @@ typedef boost::asio::detail::socket_option::integer<SOL_SOCKET, SO_RCVTIMEO>
 
 class Client {
 public:
+    /// Called once an asynchronous request completes, with either an error
+    /// or the response.
+    typedef std::function<void(std::exception_ptr, Json::Value)>
+            ResponseHandler;
+
+    /**
+     * Constructor.
+     *
+     * @param format Encoding in which to send requests. Servers answer in the
+     *               same encoding. JSON is only worth choosing for debugging.
+     * @param transport Transport offered each request before TCP, or null
+     *                  for the process-wide LocalTransport. It must outlive
+     *                  the Client.
+     */
+    explicit Client(WireFormat format = WireFormat::BINARY,
+                    Transport *transport = nullptr);
+
     /**
-     * Constructor, initializes JSON parser and serializer.
+     * Destructor. Waits for the requests still in flight, so that no handler
+     * runs once the Client (or whatever the handlers refer to) is gone.
      */
-    Client();
+    ~Client();
 
 	/**
-	 * Send JSON request to server, return JSON response from server.
+	 * Send JSON request to server, return JSON response from server. Must not
+	 * be called from a ResponseHandler, which would wait on itself.
 	 *
 	 * @param ip_addr IP addr of server.
 	 * @param port Port of server.
@@ -38,6 +80,32 @@ public:
     Json::Value MakeRequest(const std::string &ip_addr, unsigned short port,
                             const Json::Value &request);
 
+	/**
+	 * Send request to server without waiting for the response. The Client
+	 * must outlive the request.
+	 *
+	 * @param ip_addr IP addr of server.
+	 * @param port Port of server.
+	 * @param request Request to send to server.
+	 * @return Future holding the response, or the error which prevented one.
+	 */
+    std::future<Json::Value> MakeRequestAsync(const std::string &ip_addr,
+                                              unsigned short port,
+                                              const Json::Value &request);
+
+	/**
+	 * Send request to server without waiting for the response. The Client
+	 * must outlive the request.
+	 *
+	 * @param ip_addr IP addr of server.
+	 * @param port Port of server.
+	 * @param request Request to send to server.
+	 * @param handler Called with the response (or an error) on one of the
+	 *                shared io threads. It should not block.
+	 */
+    void MakeRequestAsync(const std::string &ip_addr, unsigned short port,
+                          const Json::Value &request, ResponseHandler handler);
+
 	/**
 	 * Is a server running and accepting connections on ip_addr:port?
 	 *
@@ -45,13 +113,42 @@ public:
 	 * @param port Port to message.
 	 * @return Whether or not this IP/port combo accepts our requests.
 	 */
-    static bool IsAlive(const std::string &ip_addr, unsigned short port);
+    bool IsAlive(const std::string &ip_addr, unsigned short port);
 
 private:
-    /// Reads JSON.
-    const std::unique_ptr<Json::CharReader> reader_;
-    /// Writes JSON.
-    Json::StreamWriterBuilder writer_;
+    /**
+     * Get the io_context shared by all clients, starting the threads which
+     * run it on first use.
+     *
+     * @return Shared io_context.
+     */
+    static boost::asio::io_context &SharedIoContext();
+
+    /**
+     * Send a serialized request over a pooled connection.
+     *
+     * @param ip_addr IP addr of server.
+     * @param port Port of server.
+     * @param serialized_req Request to send to server.
+     * @param handler Called with the response (or an error).
+     * @param may_retry Whether to resend the request if its connection turns
+     *                  out to have been closed before it was received.
+     */
+    void Send(const std::string &ip_addr, unsigned short port,
+              std::shared_ptr<const std::string> serialized_req,
+              ResponseHandler handler, bool may_retry);
+
+    /// Encoding in which requests are sent and responses received.
+    WireFormat format_;
+    /// Transport offered each request before TCP.
+    Transport *transport_;
+    /// Open connections to servers, reused across requests.
+    ConnectionPool pool_;
+    /// Asynchronous requests whose handlers have yet to return, and the
+    /// means to wait for them to do so.
+    size_t in_flight_;
+    std::mutex in_flight_mutex_;
+    std::condition_variable in_flight_cv_;
 };
 
 #endif
\ No newline at end of file
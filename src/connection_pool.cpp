@@ -0,0 +1,282 @@
+#include "connection_pool.h"
+#include <algorithm>
+#include <stdexcept>
+
+Connection::Connection(boost::asio::io_context &io_context,
+                       std::string ip_addr, unsigned short port)
+    : socket_(boost::asio::make_strand(io_context))
+    , ip_addr_(std::move(ip_addr))
+    , port_(port)
+    , state_(State::CONNECTING)
+    , next_request_id_(0)
+    , closed_(false)
+    , in_flight_(0)
+{
+    Touch();
+}
+
+void Connection::Open()
+{
+    auto self(shared_from_this());
+    boost::asio::post(socket_.get_executor(), [this, self] {
+        boost::system::error_code ec;
+        auto addr = boost::asio::ip::address::from_string(ip_addr_, ec);
+        if(ec)
+            return Fail(std::make_exception_ptr(std::exception()));
+
+        socket_.async_connect({ addr, port_ },
+                              [this, self](boost::system::error_code ec) {
+            if(state_ == State::CLOSED)
+                return;
+            if(ec)
+                return Fail(std::make_exception_ptr(std::exception()));
+
+            socket_.set_option(tcp::no_delay(true), ec);
+            state_ = State::OPEN;
+            DoReadHeader();
+            if(!write_queue_.empty())
+                DoWrite();
+        });
+    });
+}
+
+void Connection::Send(std::shared_ptr<const std::string> body,
+                      WireFormat format, ResponseHandler handler)
+{
+    in_flight_++;
+    Touch();
+    auto self(shared_from_this());
+    boost::asio::post(socket_.get_executor(),
+                      [this, self, body = std::move(body), format,
+                       handler = std::move(handler)]() mutable {
+        if(state_ == State::CLOSED) {
+            // Nothing was sent, so the request can safely go elsewhere.
+            in_flight_--;
+            handler(std::make_exception_ptr(
+                            std::runtime_error("Connection closed.")),
+                    format, std::string(), true);
+            return;
+        }
+
+        uint32_t request_id = next_request_id_++;
+        FrameHeader header;
+        try {
+            header = EncodeFrameHeader(body->size(), format, request_id);
+        } catch(...) {
+            in_flight_--;
+            handler(std::current_exception(), format, std::string(), false);
+            return;
+        }
+
+        pending_[request_id] = { std::move(handler), state_ == State::OPEN };
+        write_queue_.push_back({ header, std::move(body) });
+        if(state_ == State::OPEN && write_queue_.size() == 1)
+            DoWrite();
+    });
+}
+
+void Connection::Close()
+{
+    auto self(shared_from_this());
+    boost::asio::post(socket_.get_executor(), [this, self] {
+        Fail(std::make_exception_ptr(std::runtime_error("Connection closed.")));
+    });
+}
+
+bool Connection::IsClosed() const
+{
+    return closed_;
+}
+
+size_t Connection::InFlight() const
+{
+    return in_flight_;
+}
+
+bool Connection::IsIdle(std::chrono::steady_clock::time_point now,
+                        std::chrono::milliseconds timeout) const
+{
+    std::chrono::steady_clock::time_point last_active(
+            std::chrono::steady_clock::duration(last_active_.load()));
+    return in_flight_ == 0 && now - last_active >= timeout;
+}
+
+void Connection::DoWrite()
+{
+    auto self(shared_from_this());
+    const OutgoingFrame &frame = write_queue_.front();
+    std::array<boost::asio::const_buffer, 2> buffers {
+        boost::asio::buffer(frame.header_), boost::asio::buffer(*frame.body_)
+    };
+    boost::asio::async_write(socket_, buffers,
+                             [this, self](boost::system::error_code ec,
+                                          std::size_t) {
+        if(ec)
+            return Fail(std::make_exception_ptr(
+                    boost::system::system_error(ec)));
+
+        write_queue_.pop_front();
+        if(!write_queue_.empty())
+            DoWrite();
+    });
+}
+
+void Connection::DoReadHeader()
+{
+    auto self(shared_from_this());
+    boost::asio::async_read(socket_, boost::asio::buffer(resp_header_),
+                            [this, self](boost::system::error_code ec,
+                                         std::size_t) {
+        if(ec)
+            return Fail(std::make_exception_ptr(
+                    boost::system::system_error(ec)));
+        DoReadBody();
+    });
+}
+
+void Connection::DoReadBody()
+{
+    try {
+        resp_body_.resize(DecodeFrameHeader(resp_header_));
+    } catch(...) {
+        // A bogus length means we can no longer find message boundaries
+        // on this connection, so drop it.
+        return Fail(std::current_exception());
+    }
+
+    auto self(shared_from_this());
+    boost::asio::async_read(socket_, boost::asio::buffer(resp_body_),
+                            [this, self](boost::system::error_code ec,
+                                         std::size_t) {
+        if(ec)
+            return Fail(std::make_exception_ptr(
+                    boost::system::system_error(ec)));
+
+        auto it = pending_.find(FrameRequestId(resp_header_));
+        if(it != pending_.end()) {
+            ResponseHandler handler = std::move(it->second.handler_);
+            pending_.erase(it);
+            in_flight_--;
+            Touch();
+            handler(nullptr, FrameFormat(resp_header_), std::move(resp_body_),
+                    false);
+            resp_body_.clear();
+        }
+        DoReadHeader();
+    });
+}
+
+void Connection::Fail(std::exception_ptr err)
+{
+    state_ = State::CLOSED;
+    closed_ = true;
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+    write_queue_.clear();
+
+    auto pending = std::move(pending_);
+    pending_.clear();
+    for(auto &[_, request] : pending) {
+        in_flight_--;
+        request.handler_(err, WireFormat::JSON, std::string(),
+                         request.sent_on_open_connection_);
+    }
+}
+
+void Connection::Touch()
+{
+    last_active_ = std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+ConnectionPool::ConnectionPool(boost::asio::io_context &io_context,
+                               size_t connections_per_peer,
+                               std::chrono::milliseconds idle_timeout)
+    : io_context_(io_context)
+    , connections_per_peer_(std::max<size_t>(connections_per_peer, 1))
+    , idle_timeout_(idle_timeout)
+    , last_eviction_(std::chrono::steady_clock::now())
+{}
+
+ConnectionPool::~ConnectionPool()
+{
+    Clear();
+}
+
+std::shared_ptr<Connection> ConnectionPool::Get(const std::string &ip_addr,
+                                                unsigned short port)
+{
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(now - last_eviction_ >= idle_timeout_ / 2)
+        EvictIdleLocked(now);
+
+    std::vector<std::shared_ptr<Connection>> &conns =
+            connections_[Endpoint(ip_addr, port)];
+    conns.erase(std::remove_if(conns.begin(), conns.end(),
+                               [](const auto &conn) {
+                                   return conn->IsClosed();
+                               }),
+                conns.end());
+
+    std::shared_ptr<Connection> least_busy;
+    for(const auto &conn : conns)
+        if(!least_busy || conn->InFlight() < least_busy->InFlight())
+            least_busy = conn;
+
+    // Requests share a connection once opening another would exceed the
+    // limit, or if one is free anyway.
+    if(least_busy && (least_busy->InFlight() == 0 ||
+                      conns.size() >= connections_per_peer_))
+        return least_busy;
+
+    auto conn = std::make_shared<Connection>(io_context_, ip_addr, port);
+    conn->Open();
+    conns.push_back(conn);
+    return conn;
+}
+
+void ConnectionPool::EvictIdle()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    EvictIdleLocked(std::chrono::steady_clock::now());
+}
+
+void ConnectionPool::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(const auto &[_, conns] : connections_)
+        for(const auto &conn : conns)
+            conn->Close();
+    connections_.clear();
+}
+
+size_t ConnectionPool::Size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t size = 0;
+    for(const auto &[_, conns] : connections_)
+        size += conns.size();
+    return size;
+}
+
+void ConnectionPool::EvictIdleLocked(std::chrono::steady_clock::time_point now)
+{
+    last_eviction_ = now;
+    for(auto it = connections_.begin(); it != connections_.end();) {
+        std::vector<std::shared_ptr<Connection>> &conns = it->second;
+        conns.erase(std::remove_if(conns.begin(), conns.end(),
+                                   [this, now](const auto &conn) {
+                                       bool idle = conn->IsIdle(now,
+                                                                idle_timeout_);
+                                       if(idle)
+                                           conn->Close();
+                                       return idle || conn->IsClosed();
+                                   }),
+                    conns.end());
+
+        if(conns.empty())
+            it = connections_.erase(it);
+        else
+            ++it;
+    }
+}
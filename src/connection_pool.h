@@ -0,0 +1,235 @@
+/**
+ * connection_pool.h
+ *
+ * This file implements a pool of open TCP connections, keyed by the endpoint
+ * they lead to. A peer sends most of its requests to the same few peers (its
+ * successors and fingers), so rather than connect afresh for every request a
+ * Client sends them over connections kept in the pool.
+ *
+ * Each connection is multiplexed: any number of requests may be in flight on
+ * it at once, each tagged with a request ID (see message_frame.h), and the
+ * server may answer them in any order. The pool spreads requests across at
+ * most a fixed number of connections per endpoint, opening another only when
+ * every existing one is busy.
+ *
+ * Connections on which no request has been in flight for longer than a fixed
+ * timeout are closed. A connection always has a read pending, so one which
+ * the server closes (e.g. because it was killed) is noticed at once and
+ * dropped from the pool.
+ */
+
+#ifndef CHORD_FINAL_CONNECTION_POOL_H
+#define CHORD_FINAL_CONNECTION_POOL_H
+#define POOL_CONNECTIONS_PER_PEER 2
+#define POOL_IDLE_TIMEOUT_MS 30000
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include "message_frame.h"
+
+using boost::asio::ip::tcp;
+
+/**
+ * A single multiplexed connection to a server. Its socket and bookkeeping
+ * are only touched on the connection's strand; the public methods may be
+ * called from any thread.
+ */
+class Connection : public std::enable_shared_from_this<Connection> {
+public:
+	/**
+	 * Called once a response arrives, or the request fails. On failure, body
+	 * is empty, and retryable states whether the request is worth sending
+	 * again on a fresh connection: i.e. it was sent on a connection already
+	 * established, which the server has since closed, rather than on one
+	 * which could not be opened at all.
+	 */
+	typedef std::function<void(std::exception_ptr err, WireFormat format,
+	                           std::string body, bool retryable)>
+			ResponseHandler;
+
+	/**
+	 * Constructor. The connection is not opened until Open is called.
+	 *
+	 * @param io_context Context on which the connection runs. It must be
+	 *                   running for requests to complete.
+	 * @param ip_addr IP address of server.
+	 * @param port Port of server.
+	 */
+	Connection(boost::asio::io_context &io_context, std::string ip_addr,
+	           unsigned short port);
+
+	/**
+	 * Start connecting to the server. Requests may be sent straight away;
+	 * they are written once the connection is established.
+	 */
+	void Open();
+
+	/**
+	 * Send a request over this connection.
+	 *
+	 * @param body Serialized request.
+	 * @param format Encoding of body.
+	 * @param handler Called with the response on the connection's strand.
+	 *                It should not block.
+	 */
+	void Send(std::shared_ptr<const std::string> body, WireFormat format,
+	          ResponseHandler handler);
+
+	/**
+	 * Close the connection, failing any requests in flight.
+	 */
+	void Close();
+
+	/// Has the connection been closed (by either end) or failed to open?
+	bool IsClosed() const;
+
+	/// Number of requests sent and not yet answered.
+	size_t InFlight() const;
+
+	/**
+	 * Has the connection had no request in flight since before the timeout?
+	 *
+	 * @param now Current time.
+	 * @param timeout Time after which an unused connection is idle.
+	 * @return Is connection idle?
+	 */
+	bool IsIdle(std::chrono::steady_clock::time_point now,
+	            std::chrono::milliseconds timeout) const;
+
+private:
+	typedef struct {
+		/// Called with the response.
+		ResponseHandler handler_;
+		/// Was the connection established when the request was sent?
+		bool sent_on_open_connection_;
+	} PendingRequest;
+
+	typedef struct {
+		FrameHeader header_;
+		std::shared_ptr<const std::string> body_;
+	} OutgoingFrame;
+
+	enum class State { CONNECTING, OPEN, CLOSED };
+
+	tcp::socket socket_;
+	std::string ip_addr_;
+	unsigned short port_;
+	State state_;
+
+	/// ID to give the next request.
+	uint32_t next_request_id_;
+	/// Requests awaiting a response, by ID.
+	std::unordered_map<uint32_t, PendingRequest> pending_;
+	/// Frames waiting to be written, the first of them being written now.
+	std::deque<OutgoingFrame> write_queue_;
+
+	/// Header and body of the response currently being read.
+	FrameHeader resp_header_;
+	std::string resp_body_;
+
+	/// Mirrors of state readable from any thread, for the pool's benefit.
+	std::atomic<bool> closed_;
+	std::atomic<size_t> in_flight_;
+	std::atomic<std::chrono::steady_clock::rep> last_active_;
+
+	void DoWrite();
+	void DoReadHeader();
+	void DoReadBody();
+
+	/**
+	 * Mark the connection closed and fail every request in flight.
+	 *
+	 * @param err Error to pass to their handlers.
+	 */
+	void Fail(std::exception_ptr err);
+
+	/**
+	 * Record that the connection is in use at this moment.
+	 */
+	void Touch();
+};
+
+class ConnectionPool {
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param io_context Context on which connections run.
+	 * @param connections_per_peer Maximum number of connections kept open to
+	 *                             any one endpoint.
+	 * @param idle_timeout Time after which an unused connection is closed.
+	 */
+	ConnectionPool(boost::asio::io_context &io_context,
+	               size_t connections_per_peer,
+	               std::chrono::milliseconds idle_timeout);
+
+	/**
+	 * Close every connection.
+	 */
+	~ConnectionPool();
+
+	/**
+	 * Get a connection to ip_addr:port on which to send a request: the least
+	 * busy open connection, or a new one if all are busy and there is room
+	 * for another.
+	 *
+	 * @param ip_addr IP address of server.
+	 * @param port Port of server.
+	 * @return Connection to server (possibly still being opened).
+	 */
+	std::shared_ptr<Connection> Get(const std::string &ip_addr,
+	                                unsigned short port);
+
+	/**
+	 * Close every connection which has been unused for longer than the idle
+	 * timeout, and drop those which have closed.
+	 */
+	void EvictIdle();
+
+	/**
+	 * Close all connections.
+	 */
+	void Clear();
+
+	/// Number of connections currently held (including any which have closed
+	/// but have not yet been dropped).
+	size_t Size() const;
+
+private:
+	typedef std::pair<std::string, unsigned short> Endpoint;
+
+	/// Context on which connections run.
+	boost::asio::io_context &io_context_;
+
+	size_t connections_per_peer_;
+	std::chrono::milliseconds idle_timeout_;
+
+	/// Connections to each endpoint.
+	std::map<Endpoint, std::vector<std::shared_ptr<Connection>>> connections_;
+
+	/// Time of the last sweep for idle connections.
+	std::chrono::steady_clock::time_point last_eviction_;
+
+	/// Client requests may be issued from several threads at once.
+	mutable std::mutex mutex_;
+
+	/**
+	 * Close idle connections and drop closed ones. Caller must hold mutex_.
+	 *
+	 * @param now Current time.
+	 */
+	void EvictIdleLocked(std::chrono::steady_clock::time_point now);
+};
+
+#endif
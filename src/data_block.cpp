@@ -1,152 +1,263 @@
 #include "data_block.h"
 
+#include <algorithm>
+#include <numeric>
 #include <utility>
 #include <cassert>
 
-IDA::IDA(int n, int m, int p)
+GaloisIDA::GaloisIDA(int n, int m)
     : n_(n)
     , m_(m)
-    , p_(p)
-{}
-
-TwoDimMatrix IDA::Encode(const OneDimMatrix &message) const
+    , encoding_matrix_(n, m)
+    , decode_cache_(SharedDecodeCache(n, m))
 {
-    auto length = int(message.size());
-    TwoDimMatrix a(n_, OneDimMatrix(m_, 0)),
-            c(n_, OneDimMatrix(length / m_, 0));
+    if(m < 1 || n < m || n > 255)
+        throw std::invalid_argument("Need 1 <= m <= n <= 255.");
 
     for(int i = 0; i < n_; i++)
         for(int j = 0; j < m_; j++)
-            a[i][j] = pow(1 + i, j);
+            encoding_matrix_(i, j) = GFPow(uint8_t(i + 1), j);
+}
 
-    for(int i = 0; i < n_; i++)
-        for(int j = 0; j < (length / m_); j++)
-            for(int k = 0; k < m_; k++)
-                c[i][j] += a[i][k] * message[j * m_ + k];
+size_t GaloisIDA::FragmentSize(size_t length) const
+{
+    return (length + m_ - 1) / m_;
+}
 
+GFMatrix GaloisIDA::Encode(const uint8_t *message, size_t length) const
+{
+    GFMatrix c(n_, FragmentSize(length));
+    EncodeInto(message, length, c.Row(0), c.Cols());
     return c;
 }
 
-OneDimMatrix IDA::Decode(const TwoDimMatrix &encoded,
-                         const std::vector<int> &fid) const
+void GaloisIDA::EncodeInto(const uint8_t *message, size_t length,
+                           uint8_t *out, size_t stride) const
 {
-    unsigned long num_rows = encoded.size() * encoded[0].size();
-    TwoDimMatrix a(m_, OneDimMatrix(m_));
-    OneDimMatrix dm(num_rows);
-
-    for(int i = 0; i < m_; i++)
-        for(int j = 0; j < m_; j++)
-            a[i][j] = pow(fid[i], j);
-
-    TwoDimMatrix ia = Invert(a);
+    size_t frag_size = FragmentSize(length);
+
+    // Finish each fragment before starting the next, so that the one being
+    // accumulated stays in cache while the stripes stream past. Only the
+    // last stripe holding any of the message can be short, and its padding
+    // would contribute nothing, so only its bytes are multiplied; so are
+    // those of any stripes after it (none). The first stripe is never
+    // short, and sets the fragment rather than adding to it.
+    for(int i = 0; i < n_; i++) {
+        uint8_t *frag = out + i * stride;
+        GFMulRegion(frag, message, encoding_matrix_(i, 0), frag_size);
+        for(int k = 1; k < m_ && k * frag_size < length; k++) {
+            size_t offset = k * frag_size;
+            GFMulAddRegion(frag, message + offset, encoding_matrix_(i, k),
+                           std::min(frag_size, length - offset));
+        }
+    }
+}
 
-    for(int i = 0; i < num_rows; i++)
-        for(int k = 0; k < m_; k++)
-            dm[i] += ia[i % m_][k] * encoded[k][i / m_];
+ByteArr GaloisIDA::Decode(const ByteMatrix &encoded,
+                          const std::vector<int> &fid, size_t length) const
+{
+    if(encoded.size() < size_t(m_) || fid.size() < size_t(m_))
+        throw std::invalid_argument("Too few fragments to decode.");
+
+    std::vector<const uint8_t *> fragments(m_);
+    for(int i = 0; i < m_; i++) {
+        if(encoded[i].size() != FragmentSize(length))
+            throw std::invalid_argument("Fragment is the wrong size.");
+        fragments[i] = encoded[i].data();
+    }
 
-    for(int i = 0; i < dm.size(); i++)
-        dm[i] = round(dm[i]);
+    ByteArr dm(length);
+    DecodeInto(fragments.data(), fid.data(), length, dm.data());
     return dm;
 }
 
-std::string IDA::EncodeAsStr(const std::string &str) const
+void GaloisIDA::DecodeInto(const uint8_t *const *fragments, const int *fid,
+                           size_t length, uint8_t *out) const
 {
-    std::string res;
-    StringArr split_by_space = Split(str, " ");
-    auto num_words = int(split_by_space.size());
-    OneDimMatrix message(num_words, 0);
-
-    for(int i = 0; i < num_words; i++)
-        message[i] = std::stod(split_by_space[i]);
-
-    TwoDimMatrix encoded = Encode(message);
-
-    for(int i = 0; i < n_; i++) {
-        res += std::to_string(i + 1) + ":";
-        for(int j = 0; j < num_words / n_; j++)
-            res += std::to_string(encoded[i][j]) + " ";
-
-        res += "\n";
+    IndexSet indices{};
+    for(int i = 0; i < m_; i++) {
+        if(fid[i] < 1 || fid[i] > n_)
+            throw std::invalid_argument("Fragment index out of range.");
+        uint64_t bit = uint64_t(1) << ((fid[i] - 1) % 64);
+        if(indices[(fid[i] - 1) / 64] & bit)
+            throw std::invalid_argument("Fragment indices are not distinct.");
+        indices[(fid[i] - 1) / 64] |= bit;
+    }
+    std::shared_ptr<const GFMatrix> ia = DecodingMatrix(indices);
+
+    // Column j of the inverse belongs to the fragment with the jth smallest
+    // index.
+    std::array<int, 255> order;
+    std::iota(order.begin(), order.begin() + m_, 0);
+    std::sort(order.begin(), order.begin() + m_,
+              [fid](int a, int b) { return fid[a] < fid[b]; });
+
+    // Stripe k is the kth row of the inverse applied to the fragments. Only
+    // as much of the last stripe as holds the block is decoded.
+    size_t frag_size = FragmentSize(length);
+    for(int k = 0; k < m_ && k * frag_size < length; k++) {
+        size_t offset = k * frag_size;
+        size_t len = std::min(frag_size, length - offset);
+        GFMulRegion(out + offset, fragments[order[0]], (*ia)(k, 0), len);
+        for(int j = 1; j < m_; j++)
+            GFMulAddRegion(out + offset, fragments[order[j]], (*ia)(k, j),
+                           len);
     }
-
-    return res;
 }
 
-OneDimMatrix IDA::DecodeFromStr(const std::string &str) const
+void GaloisIDA::PrewarmDecodeCache() const
 {
-    std::string rme;
-    StringArr sms = Split(str, "\n");
-    auto sl = int(sms.size());
-    StringArr id(sl);
-
-    for(int i = 0; i < sl; i++) {
-        StringArr tm = Split(sms[i], ":");
-        id[i] = tm[0];
-        sms[i] = tm[1];
+    // Walk every set of m_ indices in lexicographic order.
+    std::vector<int> fid(m_);
+    std::iota(fid.begin(), fid.end(), 1);
+    while(DecodeCacheSize() < GALOIS_IDA_CACHE_MAX) {
+        IndexSet indices{};
+        for(int index : fid)
+            indices[(index - 1) / 64] |= uint64_t(1) << ((index - 1) % 64);
+        DecodingMatrix(indices);
+
+        int i = m_ - 1;
+        while(i >= 0 && fid[i] == n_ - m_ + i + 1)
+            i--;
+        if(i < 0)
+            return;
+        fid[i]++;
+        for(int j = i + 1; j < m_; j++)
+            fid[j] = fid[j - 1] + 1;
     }
+}
 
-    StringArr fl = Split(sms[0], " ");
-    auto f = int(fl.size());
-    std::vector<StringArr> smess(sl, StringArr(f));
-    std::vector<int> fid(sl);
-    TwoDimMatrix mess(sl, OneDimMatrix(f));
+size_t GaloisIDA::DecodeCacheSize() const
+{
+    std::shared_lock<std::shared_mutex> lock(decode_cache_->mutex_);
+    return decode_cache_->inverses_.size();
+}
 
-    for(int i = 0; i < sl; i++)
-        smess[i] = Split(sms[i], " ");
+std::shared_ptr<GaloisIDA::DecodeCache> GaloisIDA::SharedDecodeCache(int n,
+                                                                     int m)
+{
+    static std::mutex mutex;
+    static std::map<std::pair<int, int>, std::shared_ptr<DecodeCache>> caches;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<DecodeCache> &cache = caches[{ n, m }];
+    if(! cache)
+        cache = std::make_shared<DecodeCache>();
+    return cache;
+}
 
-    for(int i = 0; i < sl; i++)
-        fid[i] = stoi(id[i]);
+std::shared_ptr<const GFMatrix> GaloisIDA::DecodingMatrix(
+        const IndexSet &indices) const
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(decode_cache_->mutex_);
+        auto it = decode_cache_->inverses_.find(indices);
+        if(it != decode_cache_->inverses_.end())
+            return it->second;
+    }
 
-    for(int i = 0; i < sl; i++)
-        for(int j = 0; j < f; j++)
-            mess[i][j] = std::stod(smess[i][j]);
+    // Invert outside the lock. Two threads may race to invert the same
+    // matrix; both get the same answer, and the first to finish is kept.
+    GFMatrix a(m_, m_);
+    for(int index = 1, i = 0; index <= n_; index++) {
+        if(indices[(index - 1) / 64] & (uint64_t(1) << ((index - 1) % 64)))
+            std::copy(encoding_matrix_.Row(index - 1),
+                      encoding_matrix_.Row(index - 1) + m_, a.Row(i++));
+    }
+    auto inverse = std::make_shared<const GFMatrix>(GFInvert(std::move(a)));
 
-    return Decode(mess, fid);
+    std::unique_lock<std::shared_mutex> lock(decode_cache_->mutex_);
+    if(decode_cache_->inverses_.size() >= GALOIS_IDA_CACHE_MAX)
+        return inverse;
+    return decode_cache_->inverses_.try_emplace(indices, inverse)
+            .first->second;
 }
 
-std::string IDA::DecodeAsStr(const std::string &str) const
+/**
+ * Write bytes as lowercase hex digits.
+ *
+ * @param bytes Bytes to write.
+ * @return Hex string, two digits per byte.
+ */
+static std::string ToHex(const ByteArr &bytes)
 {
-    std::string rme;
-    OneDimMatrix rm = DecodeFromStr(str);
-    for(double i : rm)
-        rme += std::to_string(int(round(i))) + " ";
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(bytes.size() * 2, '0');
+    for(size_t i = 0; i < bytes.size(); i++) {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0xf];
+    }
+    return hex;
+}
 
-    return rme;
+/**
+ * Read bytes written by ToHex.
+ *
+ * @param hex Hex string, two digits per byte.
+ * @return Bytes. Throws std::invalid_argument if hex is malformed.
+ */
+static ByteArr FromHex(const std::string &hex)
+{
+    auto digit_value = [](char c) {
+        if(c >= '0' && c <= '9')
+            return c - '0';
+        if(c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        throw std::invalid_argument("Malformed hex in fragment.");
+    };
+
+    if(hex.size() % 2)
+        throw std::invalid_argument("Malformed hex in fragment.");
+    ByteArr bytes(hex.size() / 2);
+    for(size_t i = 0; i < bytes.size(); i++)
+        bytes[i] = uint8_t((digit_value(hex[2 * i]) << 4) |
+                           digit_value(hex[2 * i + 1]));
+    return bytes;
 }
 
-DataFragment::DataFragment(OneDimMatrix matrix, int index)
-                            : fragment_(std::move(matrix))
+DataFragment::DataFragment(ByteArr fragment, int index, size_t block_size)
+                            : fragment_(std::move(fragment))
                             , index_(index)
+                            , block_size_(block_size)
 {}
 
 DataFragment::DataFragment(const std::string& serialized_frag)
 {
-	printf("SERIALIZED FRAG: %s", serialized_frag.c_str());
     StringArr tm = Split(serialized_frag, ":");
+    if(tm.size() != 3)
+        throw std::invalid_argument("Malformed fragment.");
     index_ = stoi(tm[0]);
-    for(const auto &frag_el : Split(tm[1], " "))
-	    fragment_.push_back(std::stod(frag_el));
+    block_size_ = std::stoull(tm[1]);
+    // Tolerate the trailing newline of the string form.
+    if(! tm[2].empty() && tm[2].back() == '\n')
+        tm[2].pop_back();
+    fragment_ = FromHex(tm[2]);
 }
 
-DataFragment::operator OneDimMatrix() const
-{
-    return fragment_;
-}
+DataFragment::DataFragment(const Json::Value &json_frag)
+    : fragment_(FromHex(json_frag["DATA"].asString()))
+    , index_(json_frag["INDEX"].asInt())
+    , block_size_(json_frag["SIZE"].asUInt64())
+{}
 
 DataFragment::operator std::string() const
 {
-    std::string fragment_str;
-    for(double value : fragment_)
-        fragment_str += std::to_string(value) + " ";
-    // Remove trailing space.
-    fragment_str.pop_back();
+    return std::to_string(index_) + ":" + std::to_string(block_size_) + ":" +
+           ToHex(fragment_) + "\n";
+}
 
-    return std::to_string(index_) + ":" + fragment_str + "\n";
+DataFragment::operator Json::Value() const
+{
+    Json::Value json_frag;
+    json_frag["INDEX"] = index_;
+    json_frag["SIZE"] = Json::UInt64(block_size_);
+    json_frag["DATA"] = ToHex(fragment_);
+    return json_frag;
 }
 
 bool operator == (const DataFragment &df1, const DataFragment &df2)
 {
-    return df1.fragment_ == df2.fragment_ && df1.index_ == df2.index_;
+    return df1.fragment_ == df2.fragment_ && df1.index_ == df2.index_ &&
+           df1.block_size_ == df2.block_size_;
 }
 
 bool operator < (const DataFragment &df1, const DataFragment &df2)
@@ -154,93 +265,89 @@ bool operator < (const DataFragment &df1, const DataFragment &df2)
 	return df1.index_ < df2.index_;
 }
 
-std::vector<DataFragment> FragsFromMatrix(const TwoDimMatrix &matrix)
+std::vector<DataFragment> FragsFromMatrix(const GFMatrix &matrix,
+                                          size_t block_size)
 {
     std::vector<DataFragment> frags;
-    for(int i = 0; i < matrix.size(); i++)
-        frags.push_back(DataFragment(matrix[i], i + 1));
+    frags.reserve(matrix.Rows());
+    for(size_t i = 0; i < matrix.Rows(); i++)
+        frags.emplace_back(ByteArr(matrix.Row(i),
+                                   matrix.Row(i) + matrix.Cols()),
+                           int(i) + 1, block_size);
     return frags;
 }
 
 DataBlock::DataBlock(const std::string &input, bool sanity_check)
-                        : ida_(14, 10, 40)
+                        : ida_(14, 10)
+                        , original_(input)
 {
-	if (input.size() > 40)
-		throw std::runtime_error("Cannot encode, input too large");
-
-	for (const char &c : input) {
-		auto char_utf = double(c);
-
-		// For some reason, IDA has issues with large values.
-		// And I don't know nearly enough linear algebra to debug it.
-		if (char_utf < 1000) original_.push_back(double(c));
-		else
-			throw std::runtime_error(
-					std::string("Cannot encode character %c", c));
-	}
+    fragments_ = FragsFromMatrix(
+            ida_.Encode(reinterpret_cast<const uint8_t *>(input.data()),
+                        input.size()),
+            input.size());
 
-    // Push an empty UTF code to back of buffer as padding.
-    while(original_.size() < 40)
-        original_.push_back(0);
-
-    fragments_ = FragsFromMatrix(ida_.Encode(original_));
-
-    // Because of aforementioned issues with IDA class, if a sanity
-    // check is requested, we will check to ensure that the encoded frags
-    // can be adequately decoded to match the original text.
+    // Decoding is exact, but if a sanity check is requested, we will check
+    // that the encoded frags decode to match the original text.
     if(sanity_check) {
-        TwoDimMatrix first_ten_frags(fragments_.cbegin(),
-                                     fragments_.cbegin() + 10);
-        std::vector<int> indices = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
-        assert(ida_.Decode(first_ten_frags, indices) == original_);
+        const uint8_t *first_ten_frags[10];
+        int indices[10];
+        for(int i = 0; i < 10; i++) {
+            first_ten_frags[i] = fragments_[i].fragment_.data();
+            indices[i] = fragments_[i].index_;
+        }
+        std::string decoded(input.size(), '\0');
+        ida_.DecodeInto(first_ten_frags, indices, input.size(),
+                        reinterpret_cast<uint8_t *>(decoded.data()));
+        assert(decoded == input);
     }
 }
 
 DataBlock::DataBlock(const std::string &encoded_str)
-                        : ida_(14, 10, 40)
-{
-    StringArr split_by_line = Split(encoded_str, "\n");
-
-    if(split_by_line.size() < 10)
-        throw std::runtime_error("10 or more fragment are required.");
-
-    // IDA::Decode (which is used in IDA::DecodeFromStr) requires 2d-vector
-    // with a number of rows equivalent to the value passed for m_ (in this
-    // case 10). Split the string, get the first 10 lines, join then by
-    // newline, and pass that to IDA::DecodeFromStr.
-    StringArr first_ten_lines(split_by_line.cbegin(),
-                              split_by_line.cbegin() + 10);
-    std::string truncated;
-    for (StringArr::const_iterator i = first_ten_lines.begin();
-         i != first_ten_lines.end(); i++)
-        truncated += *i + "\n";
-    // Remove trailing newline.
-    truncated.pop_back();
-
-    original_  = ida_.DecodeFromStr(truncated);
-    fragments_ = FragsFromMatrix(ida_.Encode(original_));
-}
+                        : DataBlock([&encoded_str] {
+                            StringArr split_by_line = Split(encoded_str, "\n");
+                            std::vector<DataFragment> fragments;
+                            for(const std::string &line : split_by_line)
+                                if(! line.empty())
+                                    fragments.emplace_back(line);
+                            return fragments;
+                        }())
+{}
 
 DataBlock::DataBlock(const std::vector<DataFragment> &fragments)
-                        : ida_(14, 10, 40)
+                        : ida_(14, 10)
 {
-    // Create fragments and indices.
+    // Use the first fragment of each index, up to the ten needed. They are
+    // decoded where they lie, without copying.
+    size_t block_size = fragments.empty() ? 0 : fragments.front().block_size_;
     std::vector<int> frag_indices;
-    TwoDimMatrix frag_matrix;
+    std::vector<const uint8_t *> frag_data;
     for(const DataFragment &fragment : fragments) {
+        if(frag_indices.size() == size_t(ida_.m_))
+            break;
+        if(std::find(frag_indices.begin(), frag_indices.end(),
+                     fragment.index_) != frag_indices.end())
+            continue;
+        if(fragment.fragment_.size() != ida_.FragmentSize(block_size))
+            throw std::invalid_argument("Fragment is the wrong size.");
         frag_indices.push_back(fragment.index_);
-        frag_matrix.push_back(fragment.fragment_);
+        frag_data.push_back(fragment.fragment_.data());
     }
 
+    if(frag_indices.size() < size_t(ida_.m_))
+        throw std::runtime_error("10 or more fragment are required.");
+
     // This may seem redundant. Why decode original and then re-encode it?
-    // The answer is because the IDA::Decode method requires only a fraction
-    // of the total fragments produced from encoding (in this case, only 10
-    // of the 14 fragments produced from encoding are needed to decode.)
-    // As a result, we cannot simply pass a list of fragments created from
-    // frag_indices and frag_matrix to "FragsFromMatrix", we must instead
-    // re-generate all 14 fragments, in case less than 14 were passed to us.
-    original_ = ida_.Decode(frag_matrix, frag_indices);
-    fragments_ = FragsFromMatrix(ida_.Encode(original_));
+    // The answer is because the GaloisIDA::Decode method requires only a
+    // fraction of the total fragments produced from encoding (in this case,
+    // only 10 of the 14 fragments produced from encoding are needed to
+    // decode.) As a result, we must re-generate all 14 fragments, in case
+    // less than 14 were passed to us.
+    original_.resize(block_size);
+    auto *original = reinterpret_cast<uint8_t *>(original_.data());
+    ida_.DecodeInto(frag_data.data(), frag_indices.data(), block_size,
+                    original);
+    fragments_ = FragsFromMatrix(ida_.Encode(original, block_size),
+                                 block_size);
 }
 
 DataBlock::operator std::string const()
@@ -256,21 +363,10 @@ DataBlock::operator std::string const()
 
 std::string DataBlock::Decode() const
 {
-    std::string res;
-
-    // "original_" is a double vector consisting of UTF codes, possibly
-    // with padding.
-    for(const double &utf_code : original_) {
-        // 0 codes are used to pad end of buffer
-        if(utf_code == 0)
-            break;
-
-        res += char(utf_code);
-    }
-    return res;
+    return original_;
 }
 
 bool operator == (const DataBlock &db1, const DataBlock &db2)
 {
     return db1.original_ == db2.original_ && db1.fragments_ == db2.fragments_;
-}
\ No newline at end of file
+}
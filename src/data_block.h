@@ -5,16 +5,17 @@
  * Though it contains 3 classes (all implemented in the '.h' file in anticip-
  * ation of the likely conversion of DataBlock into a template class at some
  * point in the future), I have opted to place them all within the same file,
- * since the IDA and DataFragment classes are only useful insofar as they
- * support the implementation of the DataBlock class.
+ * since the GaloisIDA and DataFragment classes are only useful insofar as
+ * they support the implementation of the DataBlock class.
  *
  * This file should accomplish the following tasks:
- *      - Implement a class IDA which supports the encoding of 1D matrices
- *        as 2D matrices; the IDA class should subsequently be able to
- *        decode the original matrix from a fraction of the rows in the 2D
- *        matrix, based on principles outlined in Michael Rabin's 'The
- *        Information Dispersal Algorithm and its Applications'
- *        (https://sci-hub.se/10.1007/978-1-4612-3352-7_32).
+ *      - Implement a class GaloisIDA which encodes a block of bytes as the
+ *        rows of a 2D matrix, and can subsequently decode the original
+ *        block from a fraction of those rows, based on principles outlined
+ *        in Michael Rabin's 'The Information Dispersal Algorithm and its
+ *        Applications' (https://sci-hub.se/10.1007/978-1-4612-3352-7_32).
+ *        Arithmetic is in GF(2^8) (see gf256.h), so that any data can be
+ *        dispersed exactly.
  *      - Implement a class DataFragment which represents a single row of
  *        a matrix resultant from IDA encoding, storing its index and its
  *        data.
@@ -32,138 +33,186 @@
 #pragma once
 #ifndef CHORD_FINAL_DATA_BLOCK_H
 #define CHORD_FINAL_DATA_BLOCK_H
-
-#include <cmath>
+#define GALOIS_IDA_CACHE_MAX 4096
+
+#include <array>
+#include <json/json.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
 #include <string>
 #include <vector>
-
-/// Turns out IDAs are linear-algebra heavy.
-/// Just gonna make my life a little easier here.
-typedef std::vector<double> OneDimMatrix;
-typedef std::vector<OneDimMatrix> TwoDimMatrix;
+#include "gf256.h"
 
 /// Vector of strings.
 typedef std::vector<std::string> StringArr;
 
 /**
- * DHash proposes the use of an Information Dispersal Algorithm (IDA),
- * which segments a block of data with length L into n pieces, each with
- * size L/m. In this scenario, only m blocks are necessary to reconstruct
- * the original data block.
+ * Rabin's IDA over GF(2^8). A block of L bytes is split into m stripes of
+ * L/m bytes (the last zero-padded), and fragment i (numbered from 1) is the
+ * sum of the stripes weighted by the powers of i: row i of an n x m
+ * Vandermonde matrix. Any m rows of that matrix are linearly independent, so
+ * any m fragments recover the stripes through the inverse of the matrix
+ * formed by their rows.
+ *
+ * Since every operation is on bytes, each fragment is exactly L/m bytes and
+ * decoding is exact for any input. Encoding and decoding both come down to
+ * multiplying long runs of bytes by a constant (see GFMulAddRegion).
+ *
+ * There are only C(n, m) sets of m fragment indices (1001 for 14/10), so the
+ * inverse for each set is computed once and cached, shared by every
+ * GaloisIDA with the same n and m. Decoding is then just the multiplication.
  *
- * I understand very little of how this works. This code is primarily based on
- * the description offered in Michael Rabin's 'The Information Dispersal
- * Algorithm and its Applications' (https://sci-hub.se/10.1007/978-1-4612-3352-7_32)
- * and a Java implementation on github(https://github.com/rkj2096/IDA),
- * so, while I was able to create a functional implementation, I was not able to
- * document it particularly well due to a lack of knowledge about the underlying
- * linear algebra.
+ * EncodeInto and DecodeInto work in buffers the caller provides, and
+ * allocate nothing once the decoding matrix is cached; Encode and Decode
+ * are conveniences over them.
  */
-class IDA {
+class GaloisIDA {
 public:
 	/**
 	 * Constructor.
 	 *
-	 * @param n Total number fragments produced per block.
-	 * @param m Minimum number replicas necessary to reconstruct a block.
-	 * @param p Prime number used for...something?
+	 * @param n Total number fragments produced per block (at most 255).
+	 * @param m Minimum number of fragments necessary to reconstruct a block.
 	 */
-    IDA(int n, int m, int p);
+	GaloisIDA(int n, int m);
 
 	/**
-	 * Encode an array of doubles as a 2D matrix, with each row as a new data
-	 * fragment. (i.e. with m fragments, you can reconstruct the original arr.)
+	 * Size of each fragment of a block.
 	 *
-	 * @param message Array of doubles to encode
-	 * @return Array of encoded data fragments.
+	 * @param length Length of the block in bytes.
+	 * @return Length of each of its fragments in bytes.
 	 */
-    [[nodiscard]] TwoDimMatrix Encode(const OneDimMatrix &message) const;
+	[[nodiscard]] size_t FragmentSize(size_t length) const;
 
 	/**
-	 * Decode a list of encoded fragments into a data block given fragments
-	 * and their indices.
+	 * Encode a block of bytes as n_ fragments, any m_ of which can
+	 * reconstruct it.
 	 *
-	 * @param encoded A vector containing (at least m_) encoded fragments of
-	 *                the original matrix, with each fragment represented as
-	 *                an array of doubles.
-	 * @param fid A vector specifying the index of the fragments in 'encoded',
-	 *            such that the index of the nth entry in 'encoded' is given
-	 *            by the nth entry of 'fid'.
-	 * @return The decoded one-d matrix (array of doubles).
+	 * @param message Block to encode.
+	 * @param length Length of block in bytes.
+	 * @return n_ x FragmentSize(length) matrix, whose row i is the fragment
+	 *         with index i + 1.
 	 */
-    [[nodiscard]] OneDimMatrix Decode(const TwoDimMatrix &encoded,
-                                      const std::vector<int> &fid) const;
+	[[nodiscard]] GFMatrix Encode(const uint8_t *message,
+	                              size_t length) const;
 
 	/**
-	 * Take a string of space-delimited numbers, parse as array of numbers,
-	 * return data fragments of encoded array as string of form.:
-	 *      [FRAG_1]:[num_1] [num_2]...[num_(p_/m_)]
-	 *      [FRAG_2]:[num_1] [num_2]...[num_(p_/m_)]
-	 *      ...
-	 *      [FRAG_(n_)]:[num_1] [num_2]...[num_(p_/m_)]
+	 * Encode a block of bytes into a buffer.
 	 *
-	 * @param str String of space delimited numbers to encode as a string
-	 *            newline-delimited fragments consisting of space-delimited
-	 *            numbers.
-	 * @return Encoded string in form described above.
+	 * @param message Block to encode.
+	 * @param length Length of block in bytes.
+	 * @param out Buffer to which fragment i + 1 is written at out + i *
+	 *            stride, for i < n_.
+	 * @param stride Distance between fragments in out; at least
+	 *               FragmentSize(length).
 	 */
-    [[nodiscard]] std::string EncodeAsStr(const std::string &str) const;
+	void EncodeInto(const uint8_t *message, size_t length, uint8_t *out,
+	                size_t stride) const;
 
-    /**
-     * Produce a 1D double vector from string encoded via "IDA::EncodeAsStr".
-     * It is useful to define encode and decode operations to operate
-     * specifically on strings, because we will frequently pass data from peer
-     * to peer. Since there are cases where an intermediate peer may seek
-     * to decode the data only to forward to another peer, it would be redundant
-     * to decode into a OneDimMatrix only to subsequently re-serialize that
-     * matrix as a string.
-     *
-     * @param str String encoded in form:
-     *      [FRAG_1]:[num_1] [num_2]...[num_(p_/m_)]
-     *      [FRAG_2]:[num_1] [num_2]...[num_(p_/m_)]
-     *      ...
-     *      [FRAG_(n_)]:[num_1] [num_2]...[num_(p_/m_)]
-     * @return Decoded array represented of doubles.
-     */
-	[[nodiscard]] OneDimMatrix DecodeFromStr(const std::string &str) const;
+	/**
+	 * Decode a block from m_ of its fragments.
+	 *
+	 * @param encoded At least m_ fragments of the block; only the first m_
+	 *                are used.
+	 * @param fid Index of each fragment in 'encoded', such that the index of
+	 *            the nth entry in 'encoded' is given by the nth entry of 'fid'.
+	 * @param length Length of the original block in bytes.
+	 * @return The original block. Throws std::invalid_argument if there are
+	 *         too few fragments, or they are the wrong size, or their indices
+	 *         are out of range or repeated.
+	 */
+	[[nodiscard]] ByteArr Decode(const ByteMatrix &encoded,
+	                             const std::vector<int> &fid,
+	                             size_t length) const;
 
 	/**
-	 * Decode string representing encoded info into space-delimited string
-	 * of doubles.
+	 * Decode a block from m_ of its fragments into a buffer.
 	 *
-	 * @param str String encoded in form:
-     *      [FRAG_1]:[num_1] [num_2]...[num_(p_/m_)]
-     *      [FRAG_2]:[num_1] [num_2]...[num_(p_/m_)]
-     *      ...
-     *      [FRAG_(n_)]:[num_1] [num_2]...[num_(p_/m_)]
-	 * @return Space-delimited string of doubles.
+	 * @param fragments m_ fragments of the block, each FragmentSize(length)
+	 *                  bytes.
+	 * @param fid m_ indices, that of fragments[i] being fid[i].
+	 * @param length Length of the original block in bytes.
+	 * @param out Buffer of length bytes for the original block. Throws
+	 *            std::invalid_argument if indices are out of range or
+	 *            repeated.
+	 */
+	void DecodeInto(const uint8_t *const *fragments, const int *fid,
+	                size_t length, uint8_t *out) const;
+
+	/**
+	 * Compute the decoding matrix of every set of m_ fragment indices ahead
+	 * of time, so that no Decode has to, up to GALOIS_IDA_CACHE_MAX sets.
 	 */
-    [[nodiscard]] std::string DecodeAsStr(const std::string &str) const;
+	void PrewarmDecodeCache() const;
+
+	/**
+	 * Number of decoding matrices cached for this n_ and m_.
+	 *
+	 * @return Number of sets of fragment indices whose matrix is cached.
+	 */
+	[[nodiscard]] size_t DecodeCacheSize() const;
+
+	/// Parameters pertaining to IDA encoding. n=14, m=10 is ideal.
+	int n_, m_;
 
-	/// Parameters pertaining to IDA encoding. n=14, m=10, p=40 is ideal.
-	/// Possibly mark these static in the future.
-    int n_, m_, p_;
+private:
+	/// Set of fragment indices, as a bitmask: index i is bit i - 1.
+	typedef std::array<uint64_t, 4> IndexSet;
+
+	/// Inverses of the m_ x m_ matrices formed by m_ rows of
+	/// encoding_matrix_, keyed by the indices of those rows.
+	struct DecodeCache {
+		std::shared_mutex mutex_;
+		std::map<IndexSet, std::shared_ptr<const GFMatrix>> inverses_;
+	};
+
+	/**
+	 * Get the cache shared by every GaloisIDA with parameters n and m.
+	 */
+	static std::shared_ptr<DecodeCache> SharedDecodeCache(int n, int m);
+
+	/**
+	 * Get the inverse of the matrix formed by rows of encoding_matrix_,
+	 * computing and caching it if need be.
+	 *
+	 * @param indices m_ fragment indices.
+	 * @return Inverse of the matrix formed by the rows with those indices,
+	 *         in ascending order of index.
+	 */
+	std::shared_ptr<const GFMatrix> DecodingMatrix(
+			const IndexSet &indices) const;
+
+	/// n_ x m_ Vandermonde matrix: row i is the powers of i + 1.
+	GFMatrix encoding_matrix_;
+
+	/// Decoding matrices computed so far.
+	std::shared_ptr<DecodeCache> decode_cache_;
 };
 
 /**
- * The IDA will produce a 2D matrix of doubles. This matrix can be reconstructed
+ * The IDA will produce a 2D matrix of bytes. This matrix can be reconstructed
  * in full from only a handful of the rows in that matrix, so long as the index
  * of those rows in the matrix are known.
  * This data structure exists to represent a single row. It should:
- *      - Hold the vector of doubles corresponding to a single row.
+ *      - Hold the bytes corresponding to a single row.
  *      - Hold the index of said row.
+ *      - Hold the length of the block it was encoded from, since the block
+ *        may have been padded to encode it.
  *      - Be able to be serialized into a string.
  */
 class DataFragment {
 public:
 	/**
-	 * Construct from vector of doubles and index.
+	 * Construct from bytes and index.
 	 *
-	 * @param matrix One row of matrix from IDA::Encode.
+	 * @param fragment One row of matrix from GaloisIDA::Encode.
 	 * @param index Index of row in said matrix.
+	 * @param block_size Length in bytes of the block encoded.
 	 */
-	DataFragment(OneDimMatrix matrix, int index);
+	DataFragment(ByteArr fragment, int index, size_t block_size);
 
 	/**
 	 * Construct fragment from serialized string.
@@ -173,19 +222,30 @@ public:
 	DataFragment(const std::string &serialized_frag);
 
 	/**
-	 * Convert to a vector of doubles (i.e. return fragment_).
+	 * Construct fragment from JSON.
 	 *
-	 * @return fragment_
+	 * @param json_frag Json object containing keys:
+	 *                      - "INDEX"
+	 *                      - "SIZE" (length of the block)
+	 *                      - "DATA" (bytes as a hex string)
 	 */
-	explicit operator OneDimMatrix() const;
+	explicit DataFragment(const Json::Value &json_frag);
 
 	/**
 	 * Serialize fragment.
 	 *
-	 * @return string of form "[INDEX]:[VAL_1] [VAL_2]...[VAL_N]\n"
+	 * @return string of form "[INDEX]:[SIZE]:[HEX DATA]\n"
 	 */
 	operator std::string() const;
 
+	/**
+	 * Convert fragment to JSON. The binary wire format packs the hex string
+	 * back into raw bytes.
+	 *
+	 * @return JSON object with keys "INDEX", "SIZE" and "DATA".
+	 */
+	explicit operator Json::Value() const;
+
 	/**
 	 * Comparison operator.
 	 *
@@ -205,22 +265,26 @@ public:
 	 */
 	friend bool operator < (const DataFragment &df1, const DataFragment &df2);
 
-    /// A vector of doubles representing a row from a matrix given by
-    /// IDA::Encode.
-    OneDimMatrix fragment_;
+    /// Bytes representing a row from a matrix given by GaloisIDA::Encode.
+    ByteArr fragment_;
 
 	/// Index of the fragment. (e.g. IDA produced 14 fragments, this is nth).
     int index_;
+
+	/// Length in bytes of the block the fragment was encoded from.
+	size_t block_size_;
 };
 
 /**
- * Convert a 2-dimensional matrix of encoded data (result of an IDA::encode
- * call) into a vector of fragments.
+ * Convert a 2-dimensional matrix of encoded data (result of a
+ * GaloisIDA::Encode call) into a vector of fragments.
  *
  * @param matrix Encoded data.
+ * @param block_size Length in bytes of the block encoded.
  * @return List of fragments initialized from matrix.
  */
-std::vector<DataFragment> FragsFromMatrix(const TwoDimMatrix &matrix);
+std::vector<DataFragment> FragsFromMatrix(const GFMatrix &matrix,
+                                          size_t block_size);
 
 /**
  * The DataBlock class represents a piece of data corresponding to a key.
@@ -238,9 +302,8 @@ class DataBlock {
 public:
 	/**
 	 * Constructor #1.
-	 * Create a data block by first encoding an input string as a vector of
-	 * doubles corresponding to its characters' UTF codes, then encode
-	 * that vector as data fragments.
+	 * Create a data block by encoding the bytes of an input string as data
+	 * fragments. The input may be of any length, and contain any bytes.
 	 *
 	 * @param input String to encode.
 	 * @param sanity_check Should the constructor check whether encoding
@@ -260,7 +323,8 @@ public:
 	 * Constructor #3.
 	 * Decode from an array of data fragments.
 	 *
-	 * @param fragments An array of data fragments.
+	 * @param fragments An array of data fragments, of which at least 10 must
+	 *                  have distinct indices.
 	 */
 	explicit DataBlock(const std::vector<DataFragment> &fragments);
 
@@ -268,15 +332,15 @@ public:
 	 * Convert data block into string.
 	 * (Will there be issues that we're giving constructor 2 14 els instead of 10?
 	 * @return Data block serialzied in form:
-	 *      [FRAG_1]:[num_1] [num_2]...[num_(p_/m_)]
-     *      [FRAG_2]:[num_1] [num_2]...[num_(p_/m_)]
+	 *      [FRAG_1]:[SIZE]:[HEX DATA]
+     *      [FRAG_2]:[SIZE]:[HEX DATA]
      *      ...
-     *      [FRAG_(n_)]:[num_1] [num_2]...[num_(p_/m_)]
+     *      [FRAG_(n_)]:[SIZE]:[HEX DATA]
 	 */
 	operator std::string const();
 
     /**
-     * Convert DataBlock to string by decoding "original_".
+     * Get the original string.
      *
      * @return The string used to create this DataBlock - i.e. the argument
      *         passed as "input" to the first constructor.
@@ -292,107 +356,17 @@ public:
 	 */
 	friend bool operator == (const DataBlock &db1, const DataBlock &db2);
 
-	/// Used to encode, decode, serialize, and parse matrices.
-	IDA ida_;
+	/// Used to encode and decode fragments.
+	GaloisIDA ida_;
 
-	/// The original string translated into a vector of doubles, with
-	/// the nth double corresponding to string's nth char's UTF code.
-	OneDimMatrix original_;
+	/// The original string, byte for byte.
+	std::string original_;
 
-	/// A two-d vector containing one-d vectors of doubles, with each one-d
-	/// double vector representing a "fragment". These can be decoded into
-	/// a single one-d double vector ("original_"), which can in turn be
-	/// decoded into a string.
+	/// The fragments the original string was encoded as, any 10 of which
+	/// can be decoded back into it.
 	std::vector<DataFragment> fragments_;
 };
 
-/**
- * Partial Pivot Gaussian Elimination. No idea how this works.
- *
- * @param matrix Matrix which will be pivoted in-place.
- * @param index Another vector to be modified in-place. Idk.
- */
-static void PartialPivotGaussElim(TwoDimMatrix &matrix, std::vector<int> &index)
-{
-    unsigned long index_size = index.size();
-    OneDimMatrix c(index_size, 0);
-
-    for(int i = 0; i < index_size; i++)
-        index[i] = i;
-
-    for(int i = 0; i < index_size; i++) {
-        double c1 = 0;
-        for(int j = 0; j < index_size; j++) {
-            double c0 = abs(matrix[i][j]);
-            if(c0 > c1) c1 = c0;
-        }
-        c[i] = c1;
-    }
-
-    int k = 0;
-    for(int j = 0; j < index_size - 1; j++) {
-        double pi1 = 0;
-        for(int i = j; i < index_size; i++) {
-            double pi0 = abs(matrix[index[i]][j]);
-            pi0 /= c[index[i]];
-            if(pi0 > pi1) {
-                pi1 = pi0;
-                k = i;
-            }
-        }
-
-        int itmp = index[j];
-        index[j] = index[k];
-        index[k] = itmp;
-
-        for(int i = j + 1; i < index_size; i++) {
-            double pj = matrix[index[i]][j] / matrix[index[j]][j];
-            matrix[index[i]][j] = pj;
-            for(int l = j + 1; l < index_size; l++)
-                matrix[index[i]][l] -= pj * matrix[index[j]][l];
-        }
-    }
-}
-/**
- * Invert a matrix - i.e. find the matrix which, when multiplied by the input
- * matrix, will produce the identity matrix.
- *
- * @param matrix Matrix to invert.
- * @return Inverted version of matrix.
- */
-static TwoDimMatrix Invert(TwoDimMatrix &matrix)
-{
-    int num_rows = int(matrix.size());
-    TwoDimMatrix x(num_rows, OneDimMatrix(num_rows, 0)),
-            b(num_rows, OneDimMatrix(num_rows, 0));
-    std::vector<int> index(num_rows, 0);
-
-    for(int i = 0; i < num_rows; i++)
-        b[i][i] = 1;
-
-    PartialPivotGaussElim(matrix, index);
-
-    for(int i = 0; i < num_rows - 1; i++)
-        for(int j = i + 1; j < num_rows; j++)
-            for(int k = 0; k < num_rows; k++)
-                b[index[j]][k] -= matrix[index[j]][i] * b[index[i]][k];
-
-    // Alter column-by-column.
-    for(int i = 0; i < num_rows; i++) {
-        x[num_rows - 1][i] = (b[index[num_rows - 1]][i] /
-                              matrix[index[num_rows - 1]][num_rows - 1]);
-        for(int j = num_rows - 2; j >= 0; j--) {
-            x[j][i] = b[index[j]][i];
-            for(int k = j + 1; k < num_rows; k++) {
-                x[j][i] -= (matrix[index[j]][k] * x[k][i]);
-            }
-            x[j][i] /= matrix[index[j]][j];
-        }
-    }
-
-    return x;
-}
-
 /**
  * Split a string into a vector of substrings based on delimiter.
  *
@@ -12,6 +12,7 @@ Database::~Database()
 
 void Database::Insert(const std::pair<Key, DataFragment> &key_frag_pair)
 {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
 	if(data_.find(key_frag_pair.first) != data_.end())
         throw std::runtime_error("Key already exists in db");
 
@@ -21,6 +22,7 @@ void Database::Insert(const std::pair<Key, DataFragment> &key_frag_pair)
 
 DataFragment Database::Lookup(const Key &key)
 {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
     // Searching merkel tree is quicker than calling map::find.
     if(index_.Contains(key))
         return data_.at(key);
@@ -30,6 +32,7 @@ DataFragment Database::Lookup(const Key &key)
 
 void Database::Update(const std::pair<Key, DataFragment> &key_frag_pair)
 {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
     std::map<Key, DataFragment>::iterator it;
     if((it = data_.find(key_frag_pair.first)) == data_.end())
         throw std::runtime_error("Key does not exist in database.");
@@ -39,14 +42,17 @@ void Database::Update(const std::pair<Key, DataFragment> &key_frag_pair)
 
 void Database::Delete(const Key &key)
 {
-    if(index_.Contains(key))
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if(index_.Contains(key)) {
+        index_.Delete(key);
         data_.erase(key);
-    else
+    } else
         throw std::runtime_error("Key does not exist in database.");
 }
 
 KeyFragPair *Database::Next(const Key &key)
 {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
 	if(data_.empty())
 		return nullptr;
 
@@ -60,6 +66,7 @@ KeyFragPair *Database::Next(const Key &key)
 
 KeyFragMap Database::ReadRange(const Key &lower_bound, const Key &upper_bound)
 {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
     std::map<Key, DataFragment> keys_in_range;
     for(auto &[key, frag] : data_)
         if(key.InBetween(lower_bound, upper_bound, true))
@@ -69,5 +76,6 @@ KeyFragMap Database::ReadRange(const Key &lower_bound, const Key &upper_bound)
 
 bool Database::Contains(const Key &key)
 {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
     return index_.Contains(key);
 }
\ No newline at end of file
@@ -5,6 +5,10 @@
  * tree index (facilitating quick synchronization of ranges between local and
  * remote databases) and a map of keys to values.
  *
+ * Request handlers, maintenance and the peer's own creates and reads all use
+ * the database, possibly at once, so every operation takes a lock: shared
+ * for lookups, exclusive for modifications.
+ *
  * TO DO:
  *      - Make persistent.
  */
@@ -12,6 +16,7 @@
 #ifndef CHORD_FINAL_DATABASE_H
 #define CHORD_FINAL_DATABASE_H
 
+#include <shared_mutex>
 #include "data_block.h"
 #include "merkle_node.h"
 
@@ -86,6 +91,9 @@ private:
 
 	/// Index of keys held in database.
 	CSMerkleNode index_;
+
+	/// Guards data_ and index_.
+	std::shared_mutex mutex_;
 };
 
 
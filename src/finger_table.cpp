@@ -1,33 +1,72 @@
 #include "finger_table.h"
+#include <algorithm>
 #include <iomanip>
 
 FingerTable::FingerTable(Key starting_key)
-                            : starting_key_(std::move(starting_key))
-                            // Num keys in chord is 16 ^ hex-id-length.
-                            , keys_in_chord_(mp::pow(mp::cpp_int(16),
-                                                     starting_key.Size()))
                             // Num entries is binary ID length of key.
-                            , num_entries_(4 * 32)
-{}
+                            : num_entries_(Key::kNumBits)
+                            , num_fingers_(0)
+                            , starting_key_(starting_key)
+{
+    // The nth range is [start + 2^n, start + 2^(n+1) - 1]. Key arithmetic
+    // wraps around the ring, so once the offset doubles past 2^(m-1) it
+    // becomes 0 and the final upper bound is simply start - 1.
+    auto ranges = std::make_shared<std::vector<FingerRange>>();
+    ranges->reserve(num_entries_);
+    Key offset(1);
+    for(int n = 0; n < num_entries_; n++) {
+        Key lower_bound = starting_key_ + offset;
+        offset = offset + offset;
+        ranges->emplace_back(lower_bound, starting_key_ + offset - 1);
+    }
+    ranges_ = std::move(ranges);
+}
 
 void FingerTable::AddFinger(const Finger &finger)
 {
-    table_.push_back(finger);
+    const std::vector<FingerRange> &ranges = *ranges_;
+    if(num_fingers_ >= num_entries_ ||
+       finger.lower_bound_ != ranges[num_fingers_].first ||
+       finger.upper_bound_ != ranges[num_fingers_].second)
+        throw std::runtime_error("Finger does not match next table range.");
+
+    // Extend the last run if it shares a successor with the new finger.
+    if(runs_.empty() || !(runs_.back().successor_ == finger.successor_))
+        runs_.push_back(FingerRun { num_fingers_, finger.successor_, {} });
+    num_fingers_++;
+}
+
+Finger FingerTable::GetNthEntry(int n) const
+{
+    if(n < 0 || n >= num_fingers_)
+        throw std::out_of_range("Finger not in table.");
+    const FingerRange &range = (*ranges_)[n];
+    return Finger { range.first, range.second, RunOf(n)->successor_ };
 }
 
-Finger FingerTable::GetNthEntry(int n)
+PeerRepr FingerTable::Lookup(const Key &key) const
 {
-    return table_.at(n);
+    // Index of the finger whose range holds the key. Distance 0 (i.e. the
+    // starting key itself) is not covered by any finger, yielding -1.
+    int n = (key - starting_key_).BitLength() - 1;
+    if(n < 0 || n >= num_fingers_)
+        throw std::runtime_error("Key not found");
+
+    auto run = RunOf(n);
+    const Key &lower_bound = (*ranges_)[n].first;
+    for(const PeerRepr &peer : run->proximate_)
+        if(peer.id_.InBetween(lower_bound, key, true))
+            return peer;
+    return run->successor_;
 }
 
-PeerRepr FingerTable::Lookup(const Key &key)
+PeerRepr FingerTable::LinearLookup(const Key &key) const
 {
-    for (const Finger &finger: table_) {
-        bool key_in_range = key.InBetween(finger.lower_bound_,
-		                                  finger.upper_bound_,
-                                          true);
+    for(int n = 0; n < num_fingers_; n++) {
+        const FingerRange &range = (*ranges_)[n];
+        bool key_in_range = key.InBetween(range.first, range.second, true);
         if(key_in_range)
-            return finger.successor_;
+            return RunOf(n)->successor_;
     }
 
     throw std::runtime_error("Key not found");
@@ -35,44 +74,152 @@ PeerRepr FingerTable::Lookup(const Key &key)
 
 void FingerTable::EditNthFinger(int n, const PeerRepr &succ)
 {
-    table_.at(n).successor_ = succ;
+    if(n < 0 || n >= num_fingers_)
+        throw std::out_of_range("Finger not in table.");
+    SetSuccessor(n, n, succ);
 }
 
 void FingerTable::AdjustFingers(const PeerRepr &new_peer)
 {
-    for(auto &finger : table_)
-        if(finger.lower_bound_.InBetween(new_peer.min_key_, new_peer.max_key_,
-                                         true))
-            finger.successor_ = new_peer;
+    // Lower bounds lie at increasing distances from the starting key, so the
+    // fingers within the new peer's range form at most two spans of indices
+    // (two only if that range wraps past the starting key).
+    const std::vector<FingerRange> &ranges = *ranges_;
+    int span_start = -1;
+    for(int n = 0; n <= num_fingers_; n++) {
+        bool in_range = n < num_fingers_ &&
+                        ranges[n].first.InBetween(new_peer.min_key_,
+                                                  new_peer.max_key_, true);
+        if(in_range && span_start < 0)
+            span_start = n;
+        else if(!in_range && span_start >= 0) {
+            SetSuccessor(span_start, n - 1, new_peer);
+            span_start = -1;
+        }
+    }
+}
+
+void LatencyTable::Record(const PeerRepr &peer, float rtt)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = peers_.find(peer.id_);
+    if(it == peers_.end()) {
+        PeerRepr measured = peer;
+        measured.latency_ = rtt;
+        peers_.emplace(peer.id_, measured);
+    } else
+        it->second.latency_ += kWeight * (rtt - it->second.latency_);
 }
 
-std::pair<Key, Key> FingerTable::GetNthRange(int n)
+void LatencyTable::Forget(const Key &id)
 {
-    mp::cpp_int starting_key = starting_key_;
-    mp::cpp_int lb_increment_value = mp::pow(mp::cpp_int(2), n);
-    auto lower_bound = mp::uint256_t((starting_key + lb_increment_value)
-                                     % keys_in_chord_);
-    mp::cpp_int ub_increment_value = mp::pow(mp::cpp_int(2), n + 1);
-    auto upper_bound = mp::uint256_t((starting_key + ub_increment_value)
-                                     % keys_in_chord_) - 1;
-    return { Key(lower_bound), Key(upper_bound) };
+    std::lock_guard<std::mutex> lock(mutex_);
+    peers_.erase(id);
+}
+
+void FingerTable::ChooseProximatePeers(const LatencyTable &latencies)
+{
+    const std::vector<FingerRange> &ranges = *ranges_;
+    std::lock_guard<std::mutex> lock(latencies.mutex_);
+    const std::map<Key, PeerRepr> &measured = latencies.peers_;
+
+    for(auto it = runs_.begin(); it != runs_.end(); ++it) {
+        it->proximate_.clear();
+        auto succ_it = measured.find(it->successor_.id_);
+        if(succ_it == measured.end())
+            continue;
+
+        // Gather the measured peers faster than the successor between the
+        // run's lowest and highest key. Runs partition the ring, so all runs
+        // together scan the measurements once.
+        std::vector<PeerRepr> &faster = it->proximate_;
+        auto consider = [&faster, &succ_it](
+                std::map<Key, PeerRepr>::const_iterator first,
+                std::map<Key, PeerRepr>::const_iterator last) {
+            for(auto peer = first; peer != last; ++peer)
+                if(peer->second.latency_ < succ_it->second.latency_)
+                    faster.push_back(peer->second);
+        };
+        const Key &lower = ranges[it->first_finger_].first;
+        const Key &upper = ranges[LastFingerOf(it)].second;
+        if(lower <= upper)
+            consider(measured.lower_bound(lower), measured.upper_bound(upper));
+        else {
+            // Run wraps around zero.
+            consider(measured.lower_bound(lower), measured.end());
+            consider(measured.begin(), measured.upper_bound(upper));
+        }
+
+        size_t keep = std::min(faster.size(), size_t(PNS_CANDIDATES));
+        std::partial_sort(faster.begin(), faster.begin() + keep, faster.end(),
+                          LatencySort());
+        faster.erase(faster.begin() + keep, faster.end());
+    }
+}
+
+std::vector<FingerRun>::const_iterator FingerTable::RunOf(int n) const
+{
+    // First run starting after n, less one.
+    return std::prev(std::upper_bound(runs_.begin(), runs_.end(), n,
+                                      [](int n, const FingerRun &run) {
+                                          return n < run.first_finger_;
+                                      }));
+}
+
+int FingerTable::LastFingerOf(std::vector<FingerRun>::const_iterator run) const
+{
+    return std::next(run) == runs_.end() ?
+           num_fingers_ - 1 : std::next(run)->first_finger_ - 1;
+}
+
+void FingerTable::SetSuccessor(int first, int last, const PeerRepr &succ)
+{
+    std::vector<FingerRun> runs;
+    auto append = [&runs](int first_finger, const PeerRepr &successor) {
+        if(runs.empty() || !(runs.back().successor_ == successor))
+            runs.push_back(FingerRun { first_finger, successor, {} });
+    };
+
+    // Each old run contributes up to three pieces, in order: the part before
+    // the updated span, the updated span itself (emitted once, by the run
+    // containing "first"), and the part after the updated span.
+    for(auto it = runs_.begin(); it != runs_.end(); ++it) {
+        int run_first = it->first_finger_;
+        int run_last = LastFingerOf(it);
+
+        if(run_first < first)
+            append(run_first, it->successor_);
+        if(run_first <= first && first <= run_last)
+            append(first, succ);
+        if(run_last > last)
+            append(std::max(run_first, last + 1), it->successor_);
+    }
+    runs_ = std::move(runs);
+}
+
+FingerRange FingerTable::GetNthRange(int n) const
+{
+    return ranges_->at(n);
+}
+
+const std::vector<FingerRange> &FingerTable::GetRanges() const
+{
+    return *ranges_;
 }
 
 // This method will pay dividends during debugging.
-FingerTable::operator std::string()
+FingerTable::operator std::string() const
 {
     // Since ranges start out so small, we need to visually condense this info.
     // To do so, we collate ranges of keys that are succeeded by the same peer.
+	// The runs stored by the table are exactly these ranges.
+	const std::vector<FingerRange> &ranges = *ranges_;
 	std::vector<Finger> display_fingers;
-	for(const auto &finger : table_) {
-		if(display_fingers.empty())
-			display_fingers.push_back(finger);
-		else if(display_fingers.back().successor_ == finger.successor_)
-			display_fingers.back().upper_bound_ = finger.upper_bound_;
-		// If this seems redundant, bear in mind that trying to get the
-		// successor of back if it's empty would cause a segfault.
-		else
-			display_fingers.push_back(finger);
+	for(auto it = runs_.begin(); it != runs_.end(); ++it) {
+		int last = LastFingerOf(it);
+		display_fingers.push_back(Finger { ranges[it->first_finger_].first,
+		                                   ranges[last].second,
+		                                   it->successor_ });
     }
 
 	std::stringstream res;
@@ -104,6 +251,21 @@ FingerTable::operator std::string()
     return res.str();
 }
 
-bool FingerTable::Empty() {
-	return table_.empty();
-}
\ No newline at end of file
+bool FingerTable::Empty() const {
+	return num_fingers_ == 0;
+}
+
+int FingerTable::Size() const
+{
+	return num_fingers_;
+}
+
+unsigned long FingerTable::NumRuns() const
+{
+	return runs_.size();
+}
+
+const std::vector<FingerRun> &FingerTable::GetRuns() const
+{
+	return runs_;
+}
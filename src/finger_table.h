@@ -8,8 +8,11 @@
 
 #ifndef CHORD_FINAL_FINGER_TABLE_H
 #define CHORD_FINAL_FINGER_TABLE_H
+#define PNS_CANDIDATES 4
 
 #include <map>
+#include <memory>
+#include <mutex>
 #include <utility>
 #include <boost/uuid/uuid.hpp>
 #include "peer_repr.h"
@@ -34,6 +37,61 @@ typedef struct {
     PeerRepr successor_;
 } Finger;
 
+/// Lower and upper bound (inclusive) of the range of keys covered by a finger.
+typedef std::pair<Key, Key> FingerRange;
+
+/**
+ * In a ring of N peers, most of the fingers of a table point to the same
+ * handful of peers, so the table stores maximal runs of consecutive fingers
+ * which share a successor rather than one successor per finger.
+ */
+typedef struct {
+    /// Index of the first finger in the run.
+    int first_finger_;
+    /// Node succeeding the lower bound of every finger in the run.
+    PeerRepr successor_;
+    /// Up to PNS_CANDIDATES measured peers within the run's fingers which
+    /// answer faster than successor_, fastest first (see
+    /// FingerTable::ChooseProximatePeers).
+    std::vector<PeerRepr> proximate_;
+} FingerRun;
+
+/**
+ * Round-trip latencies measured to other peers, as exponentially-weighted
+ * moving averages. Requests complete on several threads at once, so the
+ * measurements are guarded by a mutex. They are kept apart from the finger
+ * table, whose copies are immutable routing snapshots: a peer folds them
+ * into each new snapshot with FingerTable::ChooseProximatePeers.
+ */
+class LatencyTable {
+public:
+	/**
+	 * Fold a round-trip time measured to a peer into its moving average.
+	 * @param peer Peer which answered a request.
+	 * @param rtt Round-trip time of the request in seconds.
+	 */
+	void Record(const PeerRepr &peer, float rtt);
+
+	/**
+	 * Stop considering a peer for proximity routing (e.g. because a request
+	 * to it failed).
+	 * @param id ID of the peer.
+	 */
+	void Forget(const Key &id);
+
+	/// Weight given to each new RTT sample in the moving average.
+	static constexpr float kWeight = 0.125f;
+
+private:
+	friend class FingerTable;
+
+	mutable std::mutex mutex_;
+
+	/// Peers measured, keyed by ID, with PeerRepr::latency_ holding the
+	/// moving average.
+	std::map<Key, PeerRepr> peers_;
+};
+
 class FingerTable {
 public:
 	/**
@@ -44,7 +102,8 @@ public:
 
 	/**
 	 * Add a new finger to end of the table.
-	 * @param finger Finger to add.
+	 * @param finger Finger to add. Its bounds must be GetNthRange(n), where n
+	 *               is the number of fingers already in the table.
 	 */
 	void AddFinger(const Finger &finger);
 
@@ -53,16 +112,37 @@ public:
 	 * @param n Index of table entry.
 	 * @return Nth table entry.
 	 */
-	Finger GetNthEntry(int n);
+	Finger GetNthEntry(int n) const;
+
+    /**
+     * Find the peer to which a request for a given key should be routed.
+     * The nth finger covers keys whose clockwise distance from the starting
+     * key lies in [2^n, 2^(n+1)), so the index of the finger is the position
+     * of the highest set bit of key - starting_key_. The run holding that
+     * finger is then found by binary search.
+     *
+     * Proximity neighbor selection: any known peer whose ID lies between the
+     * finger's lower bound and the key is at least as far along the ring as
+     * the finger's successor without passing the key, so the fastest of the
+     * run's proximate_ peers in that interval, if any, is returned instead.
+     * Only the table itself is read, so lookups on a snapshot take no lock.
+     *
+     * @param key Key to lookup.
+     * @return The successor of the finger for which
+     *         finger.lower_bound_ <= key <= finger.upper_bound_, or a
+     *         lower-latency peer in [finger.lower_bound_, key].
+     */
+    PeerRepr Lookup(const Key &key) const;
 
     /**
      * Iterate through fingers in the table, find the successor of a given key.
+     * Kept as a reference implementation for tests and benchmarks.
      *
      * @param key Key to lookup.
      * @return The entry in the finger table for which
      *         finger.lower_bound_ <= key <= finger.upper_bound_.
      */
-    PeerRepr Lookup(const Key &key);
+    PeerRepr LinearLookup(const Key &key) const;
 
 	/**
 	 * Update the nth table entry to the given finger.
@@ -85,31 +165,93 @@ public:
 	 * @return ((starting_key + 2^n) mod 2^m)-((starting_key + 2^(n+1)) mod 2^m)
      *         where m is the number keys in ring.
 	 */
-	std::pair<Key, Key> GetNthRange(int n);
+	FingerRange GetNthRange(int n) const;
+
+	/**
+	 * Return the bounds of every finger in the table, in order. These are
+	 * computed once when the table is constructed.
+	 * @return Array whose nth entry is GetNthRange(n).
+	 */
+	const std::vector<FingerRange> &GetRanges() const;
+
+	/**
+	 * Choose each run's proximate_ peers from the latest measurements: the
+	 * PNS_CANDIDATES fastest peers within the run's fingers which are faster
+	 * than its successor. Runs whose successor has not been measured get
+	 * none. Call this when building a snapshot, before it is published.
+	 * @param latencies Latencies measured to other peers.
+	 */
+	void ChooseProximatePeers(const LatencyTable &latencies);
 
 	/**
 	 * Convert to string
 	 * @return Table in string form.
 	 */
-	operator std::string();
+	operator std::string() const;
 
 	/**
 	 * @return Is table empty?
 	 */
-	bool Empty();
+	bool Empty() const;
+
+	/**
+	 * @return Number of fingers in the table.
+	 */
+	int Size() const;
+
+	/**
+	 * @return Number of runs of fingers sharing a successor (i.e. the number
+	 *         of PeerReprs actually stored by the table).
+	 */
+	unsigned long NumRuns() const;
+
+	/**
+	 * @return Runs of fingers sharing a successor, in finger order.
+	 */
+	const std::vector<FingerRun> &GetRuns() const;
 
     /// Number of entries the table should have (length of binary key ID).
-    unsigned long long num_entries_;
+    int num_entries_;
 
 private:
-    /// The finger table itself, represented as a vector of fingers.
-    std::vector<Finger> table_;
+    /// The finger table itself, represented as runs of fingers sharing a
+    /// successor, ordered by first_finger_.
+    std::vector<FingerRun> runs_;
+
+    /// Number of fingers added to the table so far.
+    int num_fingers_;
 
 	/// First finger table entry - 1.
 	Key starting_key_;
 
-	/// Number keys in entire hash ring.
-    mp::cpp_int keys_in_chord_;
+	/// Bounds of each finger's range, indexed by finger. Held contiguously
+	/// so that table population and lookups need no big-integer math, and
+	/// shared by copies of the table, since they never change.
+	std::shared_ptr<const std::vector<FingerRange>> ranges_;
+
+	/**
+	 * Return the run holding the nth finger.
+	 * @param n Index of finger, which must be in the table.
+	 * @return Iterator to run holding finger n.
+	 */
+	std::vector<FingerRun>::const_iterator RunOf(int n) const;
+
+	/**
+	 * Return the index of the last finger in a run.
+	 * @param run Run in the table.
+	 * @return Index of the run's last finger.
+	 */
+	int LastFingerOf(std::vector<FingerRun>::const_iterator run) const;
+
+	/**
+	 * Point fingers [first, last] at the given successor, splitting and
+	 * merging runs so that adjacent runs always have distinct successors.
+	 * The runs changed have no proximate_ peers until they are next chosen.
+	 * @param first Index of first finger to update.
+	 * @param last Index of last finger to update.
+	 * @param succ New successor of those fingers.
+	 */
+	void SetSuccessor(int first, int last, const PeerRepr &succ);
 };
 
 #endif
@@ -0,0 +1,348 @@
+#include "gf256.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GF_X86
+#endif
+
+/// Lookup tables behind every operation, built once on first use.
+struct GFTables {
+    /// exp_[i] = 2^i, doubled in length so that exp_[log a + log b] needs
+    /// no reduction mod 255.
+    uint8_t exp_[510];
+    /// log_[a] = i such that 2^i = a (log_[0] is unused).
+    uint8_t log_[256];
+    /// mul_[a][b] = a * b.
+    uint8_t mul_[256][256];
+    /// low_[c][x] = c * x and high_[c][x] = c * (x << 4), for each nibble x:
+    /// the shuffle tables of the vector kernels.
+    alignas(16) uint8_t low_[256][16];
+    alignas(16) uint8_t high_[256][16];
+
+    GFTables()
+    {
+        unsigned x = 1;
+        for(int i = 0; i < 255; i++) {
+            exp_[i] = exp_[i + 255] = uint8_t(x);
+            log_[x] = uint8_t(i);
+            x <<= 1;
+            if(x & 0x100)
+                x ^= GF_POLYNOMIAL;
+        }
+        log_[0] = 0;
+
+        for(int a = 0; a < 256; a++)
+            for(int b = 0; b < 256; b++)
+                mul_[a][b] = (a == 0 || b == 0) ? 0 :
+                             exp_[log_[a] + log_[b]];
+
+        for(int c = 0; c < 256; c++) {
+            for(int x = 0; x < 16; x++) {
+                low_[c][x] = mul_[c][x];
+                high_[c][x] = mul_[c][x << 4];
+            }
+        }
+    }
+};
+
+static const GFTables &Tables()
+{
+    static const GFTables tables;
+    return tables;
+}
+
+uint8_t GFMul(uint8_t a, uint8_t b)
+{
+    return Tables().mul_[a][b];
+}
+
+uint8_t GFInv(uint8_t a)
+{
+    if(a == 0)
+        throw std::domain_error("Zero has no inverse in GF(2^8).");
+    const GFTables &tables = Tables();
+    return tables.exp_[255 - tables.log_[a]];
+}
+
+uint8_t GFPow(uint8_t a, int n)
+{
+    if(n == 0)
+        return 1;
+    if(a == 0)
+        return 0;
+    const GFTables &tables = Tables();
+    return tables.exp_[(tables.log_[a] * (n % 255)) % 255];
+}
+
+/**
+ * Multiply len bytes of src by c, storing the product in dst or (if
+ * Accumulate) adding it to dst. Only called with c > 0.
+ */
+template<bool Accumulate>
+static void ScalarRegion(uint8_t *dst, const uint8_t *src, uint8_t c,
+                         size_t len)
+{
+    const uint8_t *row = Tables().mul_[c];
+    for(size_t i = 0; i < len; i++)
+        dst[i] = Accumulate ? dst[i] ^ row[src[i]] : row[src[i]];
+}
+
+#ifdef GF_X86
+template<bool Accumulate>
+__attribute__((target("ssse3")))
+static void Ssse3Region(uint8_t *dst, const uint8_t *src, uint8_t c,
+                        size_t len)
+{
+    const GFTables &tables = Tables();
+    const __m128i low = _mm_load_si128(
+            reinterpret_cast<const __m128i *>(tables.low_[c]));
+    const __m128i high = _mm_load_si128(
+            reinterpret_cast<const __m128i *>(tables.high_[c]));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for(; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i product = _mm_xor_si128(
+                _mm_shuffle_epi8(low, _mm_and_si128(x, mask)),
+                _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(x, 4),
+                                                     mask)));
+        auto *out = reinterpret_cast<__m128i *>(dst + i);
+        if(Accumulate)
+            product = _mm_xor_si128(product, _mm_loadu_si128(out));
+        _mm_storeu_si128(out, product);
+    }
+    ScalarRegion<Accumulate>(dst + i, src + i, c, len - i);
+}
+
+template<bool Accumulate>
+__attribute__((target("avx2")))
+static void Avx2Region(uint8_t *dst, const uint8_t *src, uint8_t c,
+                       size_t len)
+{
+    const GFTables &tables = Tables();
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_load_si128(
+            reinterpret_cast<const __m128i *>(tables.low_[c])));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_load_si128(
+            reinterpret_cast<const __m128i *>(tables.high_[c])));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for(; i + 32 <= len; i += 32) {
+        __m256i x = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(src + i));
+        __m256i product = _mm256_xor_si256(
+                _mm256_shuffle_epi8(low, _mm256_and_si256(x, mask)),
+                _mm256_shuffle_epi8(high,
+                                    _mm256_and_si256(_mm256_srli_epi64(x, 4),
+                                                     mask)));
+        auto *out = reinterpret_cast<__m256i *>(dst + i);
+        if(Accumulate)
+            product = _mm256_xor_si256(product, _mm256_loadu_si256(out));
+        _mm256_storeu_si256(out, product);
+    }
+    Ssse3Region<Accumulate>(dst + i, src + i, c, len - i);
+}
+#endif
+
+typedef void (*RegionFn)(uint8_t *, const uint8_t *, uint8_t, size_t);
+
+/// Region operations of one kernel.
+struct KernelFns {
+    GFKernel kernel_;
+    RegionFn mul_;
+    RegionFn mul_add_;
+};
+
+static const KernelFns kKernels[] = {
+    { GFKernel::SCALAR, ScalarRegion<false>, ScalarRegion<true> },
+#ifdef GF_X86
+    { GFKernel::SSSE3, Ssse3Region<false>, Ssse3Region<true> },
+    { GFKernel::AVX2, Avx2Region<false>, Avx2Region<true> },
+#endif
+};
+
+std::vector<GFKernel> GFSupportedKernels()
+{
+    std::vector<GFKernel> kernels { GFKernel::SCALAR };
+#ifdef GF_X86
+    // Both check CPUID (and, for AVX2, that the OS saves YMM registers).
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3"))
+        kernels.push_back(GFKernel::SSSE3);
+    if(__builtin_cpu_supports("avx2"))
+        kernels.push_back(GFKernel::AVX2);
+#endif
+    return kernels;
+}
+
+/**
+ * Find a kernel's region operations.
+ */
+static const KernelFns *FindKernel(GFKernel kernel)
+{
+    for(const KernelFns &fns : kKernels)
+        if(fns.kernel_ == kernel)
+            return &fns;
+    return nullptr;
+}
+
+/**
+ * Get the kernel in use, choosing the fastest on first use.
+ */
+static std::atomic<const KernelFns *> &ActiveKernel()
+{
+    static std::atomic<const KernelFns *> active(
+            FindKernel(GFSupportedKernels().back()));
+    return active;
+}
+
+GFKernel GFCurrentKernel()
+{
+    return ActiveKernel().load(std::memory_order_relaxed)->kernel_;
+}
+
+void GFUseKernel(GFKernel kernel)
+{
+    std::vector<GFKernel> supported = GFSupportedKernels();
+    if(std::find(supported.begin(), supported.end(), kernel) ==
+       supported.end())
+        throw std::invalid_argument("Kernel " + GFKernelName(kernel) +
+                                    " is not supported by this CPU.");
+    ActiveKernel().store(FindKernel(kernel), std::memory_order_relaxed);
+}
+
+std::string GFKernelName(GFKernel kernel)
+{
+    switch(kernel) {
+        case GFKernel::SCALAR:
+            return "scalar";
+        case GFKernel::SSSE3:
+            return "SSSE3";
+        case GFKernel::AVX2:
+            return "AVX2";
+    }
+    return "unknown";
+}
+
+void GFMulRegion(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    if(c == 0) {
+        std::memset(dst, 0, len);
+        return;
+    }
+    if(c == 1) {
+        std::memmove(dst, src, len);
+        return;
+    }
+
+    ActiveKernel().load(std::memory_order_relaxed)->mul_(dst, src, c, len);
+}
+
+void GFMulAddRegion(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    // c == 1 is common (a Vandermonde matrix has a row and a column of ones)
+    // and goes through the kernel too, whose tables for 1 are the identity.
+    if(c == 0)
+        return;
+
+    ActiveKernel().load(std::memory_order_relaxed)->mul_add_(dst, src, c,
+                                                              len);
+}
+
+GFMatrix::GFMatrix(size_t rows, size_t cols)
+    : rows_(rows)
+    , cols_(cols)
+    , data_(rows * cols, 0)
+{}
+
+GFMatrix GFMatrix::Identity(size_t size)
+{
+    GFMatrix identity(size, size);
+    for(size_t i = 0; i < size; i++)
+        identity(i, i) = 1;
+    return identity;
+}
+
+size_t GFMatrix::Rows() const
+{
+    return rows_;
+}
+
+size_t GFMatrix::Cols() const
+{
+    return cols_;
+}
+
+uint8_t *GFMatrix::Row(size_t i)
+{
+    return data_.data() + i * cols_;
+}
+
+const uint8_t *GFMatrix::Row(size_t i) const
+{
+    return data_.data() + i * cols_;
+}
+
+uint8_t &GFMatrix::operator () (size_t i, size_t j)
+{
+    return data_[i * cols_ + j];
+}
+
+uint8_t GFMatrix::operator () (size_t i, size_t j) const
+{
+    return data_[i * cols_ + j];
+}
+
+bool operator == (const GFMatrix &a, const GFMatrix &b)
+{
+    return a.rows_ == b.rows_ && a.cols_ == b.cols_ && a.data_ == b.data_;
+}
+
+/**
+ * Swap two rows of a matrix.
+ */
+static void SwapRows(GFMatrix &matrix, size_t a, size_t b)
+{
+    std::swap_ranges(matrix.Row(a), matrix.Row(a) + matrix.Cols(),
+                     matrix.Row(b));
+}
+
+GFMatrix GFInvert(GFMatrix matrix)
+{
+    size_t size = matrix.Rows();
+    if(matrix.Cols() != size)
+        throw std::invalid_argument("Only square matrices are invertible.");
+    GFMatrix inverse = GFMatrix::Identity(size);
+
+    for(size_t col = 0; col < size; col++) {
+        size_t pivot = col;
+        while(pivot < size && matrix(pivot, col) == 0)
+            pivot++;
+        if(pivot == size)
+            throw std::domain_error("Matrix is singular.");
+        if(pivot != col) {
+            SwapRows(matrix, col, pivot);
+            SwapRows(inverse, col, pivot);
+        }
+
+        // Scale the pivot row so the pivot is 1, then clear the column from
+        // every other row. Subtraction is addition in GF(2^8).
+        uint8_t scale = GFInv(matrix(col, col));
+        GFMulRegion(matrix.Row(col), matrix.Row(col), scale, size);
+        GFMulRegion(inverse.Row(col), inverse.Row(col), scale, size);
+        for(size_t row = 0; row < size; row++) {
+            uint8_t factor = matrix(row, col);
+            if(row == col || factor == 0)
+                continue;
+            GFMulAddRegion(matrix.Row(row), matrix.Row(col), factor, size);
+            GFMulAddRegion(inverse.Row(row), inverse.Row(col), factor, size);
+        }
+    }
+
+    return inverse;
+}
@@ -0,0 +1,191 @@
+/**
+ * gf256.h
+ *
+ * This file implements arithmetic over GF(2^8), the field of 256 elements in
+ * which information dispersal (see data_block.h) is done. Working in a finite
+ * field rather than over doubles makes dispersal exact for arbitrary bytes:
+ * every element is a byte, every sum and product of bytes is a byte, and a
+ * fragment of a block of L bytes is itself L/m bytes.
+ *
+ * Addition is XOR. Multiplication is table-driven: log/antilog tables for
+ * single products and inverses, plus a full 256 x 256 product table. The
+ * field is generated by the polynomial x^8 + x^4 + x^3 + x^2 + 1, for which 2
+ * is a primitive element.
+ *
+ * Dispersal spends its time multiplying long runs of bytes by a constant c.
+ * Since multiplication distributes over XOR, c * x = c * (x & 0x0f) ^
+ * c * (x & 0xf0), so two 16-entry tables of products cover every byte. On
+ * x86 those tables fit in a vector register, and a single PSHUFB looks up 16
+ * (SSSE3) or 32 (AVX2) nibbles at once. The best kernel the CPU supports is
+ * chosen at run time; a portable scalar kernel using the full product table
+ * is always available.
+ */
+
+#ifndef CHORD_FINAL_GF256_H
+#define CHORD_FINAL_GF256_H
+#define GF_POLYNOMIAL 0x11d
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// A run of bytes, each an element of GF(2^8).
+typedef std::vector<uint8_t> ByteArr;
+
+/// Separately allocated runs of bytes, e.g. fragments gathered from peers.
+typedef std::vector<ByteArr> ByteMatrix;
+
+/**
+ * A matrix over GF(2^8), stored row-major in a single buffer: row i starts
+ * i * Cols() bytes in. A whole matrix is one allocation, and its rows can be
+ * handed straight to the region operations below.
+ */
+class GFMatrix {
+public:
+	/**
+	 * Constructor. The matrix starts as all zeroes.
+	 *
+	 * @param rows Number of rows.
+	 * @param cols Number of columns.
+	 */
+	GFMatrix(size_t rows = 0, size_t cols = 0);
+
+	/**
+	 * Construct the identity matrix.
+	 *
+	 * @param size Number of rows and columns.
+	 * @return size x size identity.
+	 */
+	static GFMatrix Identity(size_t size);
+
+	/// Dimensions.
+	[[nodiscard]] size_t Rows() const;
+	[[nodiscard]] size_t Cols() const;
+
+	/**
+	 * Get a row.
+	 *
+	 * @param i Row index.
+	 * @return Pointer to Cols() bytes of row i.
+	 */
+	uint8_t *Row(size_t i);
+	[[nodiscard]] const uint8_t *Row(size_t i) const;
+
+	/**
+	 * Get an element.
+	 *
+	 * @param i Row index.
+	 * @param j Column index.
+	 * @return Element in row i, column j.
+	 */
+	uint8_t &operator () (size_t i, size_t j);
+	uint8_t operator () (size_t i, size_t j) const;
+
+	/**
+	 * Comparison operator.
+	 *
+	 * @param a Lefthand.
+	 * @param b Righthand.
+	 * @return Do a and b have the same dimensions and elements?
+	 */
+	friend bool operator == (const GFMatrix &a, const GFMatrix &b);
+
+private:
+	size_t rows_, cols_;
+
+	/// Rows, back to back.
+	ByteArr data_;
+};
+
+/**
+ * Multiply two elements.
+ *
+ * @param a Lefthand.
+ * @param b Righthand.
+ * @return a * b.
+ */
+uint8_t GFMul(uint8_t a, uint8_t b);
+
+/**
+ * Find the multiplicative inverse of an element.
+ *
+ * @param a Non-zero element.
+ * @return a^-1. Throws std::domain_error if a is zero.
+ */
+uint8_t GFInv(uint8_t a);
+
+/**
+ * Raise an element to a power.
+ *
+ * @param a Element.
+ * @param n Non-negative exponent.
+ * @return a^n (with 0^0 = 1).
+ */
+uint8_t GFPow(uint8_t a, int n);
+
+/**
+ * Multiply a run of bytes by a constant: dst[i] = c * src[i].
+ *
+ * @param dst Output, which may be src itself.
+ * @param src Input.
+ * @param c Constant.
+ * @param len Number of bytes.
+ */
+void GFMulRegion(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+
+/**
+ * Multiply a run of bytes by a constant, adding the result into another:
+ * dst[i] += c * src[i].
+ *
+ * @param dst Accumulator.
+ * @param src Input.
+ * @param c Constant.
+ * @param len Number of bytes.
+ */
+void GFMulAddRegion(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+
+/// Implementations of GFMulRegion and GFMulAddRegion.
+enum class GFKernel { SCALAR, SSSE3, AVX2 };
+
+/**
+ * Find the kernels this CPU can run.
+ *
+ * @return Supported kernels, from slowest to fastest.
+ */
+std::vector<GFKernel> GFSupportedKernels();
+
+/**
+ * Get the kernel region operations currently use. It is the fastest
+ * supported kernel, unless GFUseKernel has chosen another.
+ *
+ * @return Kernel in use.
+ */
+GFKernel GFCurrentKernel();
+
+/**
+ * Use a particular kernel for region operations, e.g. to compare kernels.
+ *
+ * @param kernel Kernel to use. Throws std::invalid_argument if this CPU does
+ *               not support it.
+ */
+void GFUseKernel(GFKernel kernel);
+
+/**
+ * Name a kernel.
+ *
+ * @param kernel Kernel.
+ * @return Its name, e.g. "AVX2".
+ */
+std::string GFKernelName(GFKernel kernel);
+
+/**
+ * Invert a square matrix by Gauss-Jordan elimination. Unlike over doubles,
+ * no pivot is better than another, so the first non-zero one is taken.
+ *
+ * @param matrix Matrix to invert.
+ * @return Inverse of matrix. Throws std::domain_error if it is singular.
+ */
+GFMatrix GFInvert(GFMatrix matrix);
+
+#endif
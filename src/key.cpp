@@ -1,8 +1,6 @@
 #include "key.h"
-#include <utility>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
-#include <sstream>
 
 namespace mp = boost::multiprecision;
 
@@ -19,93 +17,159 @@ boost::uuids::uuid GenerateSha1Hash(const std::string &plaintext)
 }
 
 /**
- * Convert integer to hex string.
+ * Convert a single hex digit to its numeric value.
  *
- * @param val Some sort of integer value.
- * @return Int as hexadecimal stirng.
+ * @param digit Character in [0-9a-fA-F].
+ * @return Value of digit.
  */
-template <typename int_type>
-std::string IntToHexStr(int_type val)
+static uint64_t HexDigitValue(char digit)
 {
-    std::stringstream hex_stream;
-    hex_stream << std::hex << val;
-    return hex_stream.str();
+    if(digit >= '0' && digit <= '9') return digit - '0';
+    if(digit >= 'a' && digit <= 'f') return digit - 'a' + 10;
+    if(digit >= 'A' && digit <= 'F') return digit - 'A' + 10;
+    throw std::runtime_error("Unexpected content found while parsing key.");
 }
 
-Key::Key(const std::string &key,
-         bool hashed)
-    : plaintext_(hashed ? "" : key)
+Key::Key(const std::string &key, bool hashed)
+    : words_()
 {
     if(hashed) {
-        // Boost interprets numeric strings beginning with 0x as hashes.
-        value_ = boost::multiprecision::uint256_t("0x" + key);
+        // Shift each hex digit in from the least significant end. Digits
+        // beyond the width of the ring fall off the top, i.e. the value is
+        // taken modulo the number of keys in the ring.
+        for(char digit : key) {
+            uint64_t value = HexDigitValue(digit);
+            for(int i = kNumWords - 1; i > 0; i--)
+                words_[i] = (words_[i] << 4) | (words_[i - 1] >> 60);
+            words_[0] = (words_[0] << 4) | value;
+        }
     } else {
+        // The uuid holds the hash as big-endian bytes.
         boost::uuids::uuid uuid = GenerateSha1Hash(key);
-        value_ = boost::multiprecision::uint256_t (uuid);
+        for(int i = 0; i < int(uuid.size()); i++) {
+            int word = kNumWords - 1 - i / 8;
+            words_[word] = (words_[word] << 8) | uuid.data[i];
+        }
     }
+}
 
-    string_ = IntToHexStr(value_);
+Key::Key(const mp::uint256_t &key)
+    : words_()
+{
+    for(int i = 0; i < kNumWords; i++)
+        words_[i] = static_cast<uint64_t>(key >> (64 * i));
 }
 
-Key::Key(mp::uint256_t key) :
-        value_(std::move(key)),
-        string_(IntToHexStr(value_)) {}
+Key::Key(uint64_t key)
+    : words_({ key })
+{}
 
 unsigned long long Key::Size() const
 {
-    return IntToHexStr(value_).length();
+    // Zero is still written with a single digit.
+    return BitLength() ? (BitLength() + 3) / 4 : 1;
 }
 
-bool Key::InBetween(const mp::uint256_t &lower_bound,
-                    const mp::uint256_t &upper_bound,
+int Key::BitLength() const
+{
+    for(int i = kNumWords - 1; i >= 0; i--)
+        if(words_[i])
+            return 64 * i + 64 - __builtin_clzll(words_[i]);
+    return 0;
+}
+
+bool Key::InBetween(const Key &lower_bound, const Key &upper_bound,
                     bool inclusive) const
 {
     // If upper and lower bound are same value, see if value is equal to either.
-    if (lower_bound == upper_bound) {
-        if (value_ == upper_bound) return true;
-        else return false;
+    if (lower_bound == upper_bound)
+        return *this == upper_bound;
+
+    // Measure clockwise distances from the lower bound. Subtraction wraps
+    // modulo the size of the ring, so ranges which cross zero need no special
+    // treatment: the key is in range iff it is no further from the lower
+    // bound than the upper bound is.
+    Key key_dist = *this - lower_bound,
+        range_dist = upper_bound - lower_bound;
+
+    return inclusive ?
+           key_dist <= range_dist :
+           key_dist != Key(0) && key_dist < range_dist;
+}
+
+Key::operator mp::uint256_t() const
+{
+    mp::uint256_t value = 0;
+    for(int i = kNumWords - 1; i >= 0; i--)
+        value = (value << 64) | words_[i];
+    return value;
+}
+
+Key::operator mp::cpp_int() const
+{
+    return mp::cpp_int(mp::uint256_t(*this));
+}
+
+Key::operator std::string() const
+{
+    static const char digits[] = "0123456789abcdef";
+    unsigned long long size = Size();
+    std::string res(size, '0');
+    for(unsigned long long i = 0; i < size; i++)
+        res[size - 1 - i] = digits[(words_[i / 16] >> (4 * (i % 16))) & 0xf];
+    return res;
+}
+
+bool operator == (const Key &key1, const Key &key2)     {   return key1.words_ == key2.words_;                  }
+bool operator != (const Key &key1, const Key &key2)     {   return key1.words_ != key2.words_;                  }
+bool operator >  (const Key &key1, const Key &key2)     {   return key2 < key1;                                 }
+bool operator <= (const Key &key1, const Key &key2)     {   return !(key2 < key1);                              }
+bool operator >= (const Key &key1, const Key &key2)     {   return !(key1 < key2);                              }
+
+bool operator < (const Key &key1, const Key &key2)
+{
+    // Compare from the most significant word down.
+    for(int i = Key::kNumWords - 1; i > 0; i--)
+        if(key1.words_[i] != key2.words_[i])
+            return key1.words_[i] < key2.words_[i];
+    return key1.words_[0] < key2.words_[0];
+}
+
+Key operator + (const Key &key1, const Key &key2)
+{
+    Key sum;
+    uint64_t carry = 0;
+    for(int i = 0; i < Key::kNumWords; i++) {
+        uint64_t partial = key1.words_[i] + carry;
+        carry = partial < carry;
+        sum.words_[i] = partial + key2.words_[i];
+        carry += sum.words_[i] < partial;
     }
+    // Carry out of the top word is dropped, i.e. the sum wraps around the ring.
+    return sum;
+}
 
-    // Modulo the upper bound, lower bound, and value by number keys in ring.
-    mp::cpp_int keys_in_ring = mp::pow(mp::cpp_int(16), 32);
-    mp::cpp_int mod_lower_bound = lower_bound % keys_in_ring;
-    mp::cpp_int mod_upper_bound = upper_bound % keys_in_ring;
-    mp::cpp_int mod_value = value_ % keys_in_ring;
-
-    // Now compare.
-    if (lower_bound < upper_bound) {
-        return (inclusive ?
-                 mod_lower_bound <= mod_value && mod_value <= upper_bound :
-                 mod_lower_bound < mod_value && mod_value < upper_bound);
-    } else {
-        // if in [b, a] then not in [a, b]
-        return !(inclusive ?
-                  mod_upper_bound < mod_value && mod_value < mod_lower_bound :
-                  mod_upper_bound <= mod_value && mod_value <= mod_lower_bound);
+Key operator - (const Key &key1, const Key &key2)
+{
+    Key diff;
+    uint64_t borrow = 0;
+    for(int i = 0; i < Key::kNumWords; i++) {
+        uint64_t partial = key1.words_[i] - borrow;
+        borrow = key1.words_[i] < borrow;
+        diff.words_[i] = partial - key2.words_[i];
+        borrow += partial < key2.words_[i];
     }
+    return diff;
 }
 
-bool Key::InBetween( const mp::uint256_t &lower_bound,
-                     const mp::uint256_t &upper_bound,
-                     bool inclusive)
+Key operator + (const Key &key, int number)
 {
-    // Cast away the const from the non-const version of this method.
-    return (const_cast<const Key*>(this)->InBetween(lower_bound, upper_bound,
-	                                                 inclusive));
+    return number >= 0 ? key + Key(uint64_t(number)) :
+                         key - Key(uint64_t(-int64_t(number)));
 }
 
-Key::operator boost::multiprecision::uint256_t() const  {   return value_;                                      }
-Key::operator boost::multiprecision::cpp_int()   const  {   return boost::multiprecision::cpp_int(value_);      }
-Key::operator std::string()                      const  {   return string_;                                     }
-
-bool operator == (const Key &key1, const Key &key2)     {   return key1.value_ == key2.value_;                  }
-bool operator != (const Key &key1, const Key &key2)     {   return key1.value_ != key2.value_;                  }
-bool operator <  (const Key &key1, const Key &key2)     {   return key1.value_ < key2.value_;                   }
-bool operator >  (const Key &key1, const Key &key2)     {   return key1.value_ > key2.value_;                   }
-bool operator <= (const Key &key1, const Key &key2)     {   return key1.value_ <= key2.value_;                  }
-bool operator >= (const Key &key1, const Key &key2)     {   return key1.value_ >= key2.value_;                  }
-
-Key operator + (const Key &key, int number)             {   return Key(key.value_ + mp::uint256_t (number));    }
-Key operator - (const Key &key, int number)             {   return Key(key.value_ - mp::uint256_t(number));     }
-Key operator + (const Key &key1, const Key &key2)       {   return Key(key1.value_ + key2.value_);              }
-Key operator - (const Key &key1, const Key &key2)       {   return Key(key1.value_ - key2.value_);              }
\ No newline at end of file
+Key operator - (const Key &key, int number)
+{
+    return number >= 0 ? key - Key(uint64_t(number)) :
+                         key + Key(uint64_t(-int64_t(number)));
+}
@@ -6,6 +6,12 @@
  * (Key::InBetween), which will allow for peers to determine the location of
  * keys in relation to other keys in a chord ring through a bit of modular
  * arithmetic.
+ *
+ * Keys are compared, copied and added on every routing decision, every map
+ * lookup and every merkle walk, so a key is stored as a fixed-width array of
+ * machine words rather than as a multiprecision integer. Key is trivially
+ * copyable and none of its arithmetic or comparison operators allocate; the
+ * hex string representation is only built when it is asked for.
  */
 #ifndef CHORD_FINAL_KEY_H
 #define CHORD_FINAL_KEY_H
@@ -14,10 +20,19 @@
 #include <boost/multiprecision/cpp_int.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/multiprecision/cpp_bin_float.hpp>
+#include <array>
+#include <cstdint>
 #include <string>
 
 class Key {
 public:
+    /// Number of 64-bit words in a key. Boost's SHA-1 name generator yields
+    /// a 16-byte uuid, so the ring holds 2^128 keys.
+    static constexpr int kNumWords = 2;
+
+    /// Number of bits in a key (i.e. the ring holds 2^kNumBits keys).
+    static constexpr int kNumBits = 64 * kNumWords;
+
     /**
      * Constructor 1: Generate a key from a string.
      *
@@ -28,12 +43,19 @@ public:
     Key(const std::string &key, bool hashed);
 
     /**
-     * Constructor 2: Generate a key from a boost::multiprecision::uint128_t.
+     * Constructor 2: Generate a key from a boost::multiprecision::uint256_t.
+     * Values outside of the ring are reduced modulo 2^kNumBits.
      *
      * @param key A numeric value.
      */
+    Key(const boost::multiprecision::uint256_t &key);
 
-    Key(boost::multiprecision::uint256_t key);
+    /**
+     * Constructor 3: Generate a key from a machine integer.
+     *
+     * @param key A numeric value.
+     */
+    Key(uint64_t key = 0);
 
     /**
      * Is key "in between" lower_bound and upper_bound on a logical ring?
@@ -43,50 +65,44 @@ public:
      * @param inclusive Is range inclusive?
      * @return Whether or not this key is within specified range on logical ring.
      */
-    bool InBetween(const boost::multiprecision::uint256_t &lower_bound,
-                          const boost::multiprecision::uint256_t &upper_bound,
-                          bool inclusive) const;
+    bool InBetween(const Key &lower_bound, const Key &upper_bound,
+                   bool inclusive) const;
 
     /**
      * Return key size.
      *
-     * @return this->key_size_
+     * @return Number of hex digits needed to represent key (without padding).
      */
     unsigned long long Size() const;
 
     /**
-     * Non-const version of above function.
+     * Return the number of significant bits in the key.
      *
-     * @param lower_bound Lower bound of query.
-     * @param upper_bound Upper bound of query.
-     * @param inclusive Is range inclusive?
-     * @return Whether or not this key is within specified range on logical ring.
+     * @return floor(log2(key)) + 1, or 0 if the key is zero.
      */
-    bool InBetween(const boost::multiprecision::uint256_t &lower_bound,
-                    const boost::multiprecision::uint256_t &upper_bound,
-                    bool inclusive);
+    int BitLength() const;
 
     /**
      * Overload typecast to boost:multiprecision::uint256_t for const instances of Key.
-     * @return this->value_
+     * @return Numeric value of key.
      */
     operator boost::multiprecision::uint256_t() const;
 
     /**
      * Overload typecast to boost::multiprecision::cpp_int.
      *
-     * @return Key->value_ as cpp_int.
+     * @return Numeric value of key as cpp_int.
      */
     operator boost::multiprecision::cpp_int() const;
 
     /**
      * Overload typecast to std::string.
      *
-     * @return Key::string_ (a string version of Key::value_).
+     * @return Lowercase hex representation of key, without leading zeros.
      */
     operator std::string() const;
 
-    /// Overload operators for numeric comparison using Key::value_.
+    /// Overload operators for numeric comparison.
     friend bool operator ==     (const Key &key1, const Key &key2);
     friend bool operator !=     (const Key &key1, const Key &key2);
     friend bool operator <      (const Key &key1, const Key &key2);
@@ -95,7 +111,7 @@ public:
     friend bool operator >=     (const Key &key1, const Key &key2);
 
     /**
-     * Add a key to some numerical type.
+     * Add a key to some numerical type, modulo the size of the ring.
      *
      * @param key The lefthand equation side, a key whose value will be incremented by "number".
      * @param number The number by which "key"'s value will be incremented.
@@ -107,16 +123,11 @@ public:
 	friend Key operator -       (const Key &key1, const Key &key2);
 
 private:
-    /// Numeric value of key stored as boost uuid.
-    boost::multiprecision::uint256_t value_;
-
-    /// String representation of key.
-    std::string string_;
-
-    /// Plaintext of the hashed key, if given to us in a constructor.
-    /// If plaintext is unknown, Key::plaintext_ is left empty.
-    /// Useful primarily for debugging.
-    std::string plaintext_;
+    /// Numeric value of key, least significant word first.
+    std::array<uint64_t, kNumWords> words_;
 };
 
+static_assert(std::is_trivially_copyable<Key>::value,
+              "Keys are copied on every lookup and must not allocate.");
+
 #endif
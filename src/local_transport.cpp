@@ -0,0 +1,44 @@
+#include "local_transport.h"
+#include <mutex>
+
+LocalTransport &LocalTransport::Default()
+{
+    // Constructed on first use, so that servers created during static
+    // initialization may register.
+    static LocalTransport registry;
+    return registry;
+}
+
+void LocalTransport::Listen(const std::string &ip_addr, unsigned short port,
+                            RequestHandler handler)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    handlers_.insert_or_assign(Endpoint(ip_addr, port), std::move(handler));
+}
+
+void LocalTransport::Unlisten(const std::string &ip_addr, unsigned short port)
+{
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    handlers_.erase(Endpoint(ip_addr, port));
+}
+
+bool LocalTransport::Send(const std::string &ip_addr, unsigned short port,
+                          const Json::Value &request, ResponseHandler &handler)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = handlers_.find(Endpoint(ip_addr, port));
+    if(it == handlers_.end())
+        return false;
+
+    it->second(request, std::move(handler));
+    return true;
+}
+
+std::optional<bool> LocalTransport::IsAlive(const std::string &ip_addr,
+                                            unsigned short port)
+{
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if(handlers_.count(Endpoint(ip_addr, port)))
+        return true;
+    return std::nullopt;
+}
@@ -0,0 +1,63 @@
+/**
+ * local_transport.h
+ *
+ * This file implements a registry of servers running in this process. Peers
+ * often send requests to themselves (e.g. when the finger table points back
+ * at them), and tests run many peers side by side in one process. Requests to
+ * an endpoint in the registry are handed straight to its server as a
+ * Json::Value, skipping serialization and the loopback round trip.
+ *
+ * A Client consults the registry before touching the network, so callers
+ * need not know whether the server they address is local. A local server
+ * answers exactly as it would over the network: on its own threads, and with
+ * the same errors once it has been killed.
+ */
+
+#ifndef CHORD_FINAL_LOCAL_TRANSPORT_H
+#define CHORD_FINAL_LOCAL_TRANSPORT_H
+
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include "transport.h"
+
+class LocalTransport : public Transport {
+public:
+	/**
+	 * Get the registry shared by every Client and Server in the process.
+	 *
+	 * @return Process-wide registry.
+	 */
+	static LocalTransport &Default();
+
+	void Listen(const std::string &ip_addr, unsigned short port,
+	            RequestHandler handler) override;
+
+	void Unlisten(const std::string &ip_addr, unsigned short port) override;
+
+	/**
+	 * Pass a request to the local server at ip_addr:port, if there is one.
+	 * Requests to any other endpoint are left to TCP.
+	 */
+	bool Send(const std::string &ip_addr, unsigned short port,
+	          const Json::Value &request, ResponseHandler &handler) override;
+
+	/**
+	 * A registered endpoint is alive; whether any other is, only TCP can
+	 * tell.
+	 */
+	std::optional<bool> IsAlive(const std::string &ip_addr,
+	                            unsigned short port) override;
+
+private:
+	typedef std::pair<std::string, unsigned short> Endpoint;
+
+	/// Every registered endpoint.
+	std::map<Endpoint, RequestHandler> handlers_;
+	/// Send holds this (shared) while calling a handler, so that Unlisten can
+	/// wait it out.
+	std::shared_mutex mutex_;
+};
+
+#endif
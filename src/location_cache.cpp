@@ -0,0 +1,124 @@
+#include "location_cache.h"
+#include <algorithm>
+
+LocationCache::LocationCache(size_t max_entries, std::chrono::milliseconds ttl)
+    : max_entries_(max_entries)
+    , ttl_(ttl)
+    , hits_(0)
+    , misses_(0)
+{}
+
+bool LocationCache::Lookup(const Key &key, std::vector<PeerRepr> &successors)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = Find(key);
+    if(it != entries_.end() &&
+       it->second.expiry_ <= std::chrono::steady_clock::now()) {
+        entries_.erase(it);
+        it = entries_.end();
+    }
+
+    if(it == entries_.end()) {
+        misses_++;
+        return false;
+    }
+
+    hits_++;
+    successors = it->second.successors_;
+    return true;
+}
+
+void LocationCache::Insert(const Key &lower_bound, const Key &upper_bound,
+                           const std::vector<PeerRepr> &successors)
+{
+    if(successors.empty() || max_entries_ == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Entries ending within the new range describe a view of the ring which
+    // has since changed (or duplicate this one), so they are replaced.
+    for(auto it = entries_.begin(); it != entries_.end();) {
+        if(it->first.InBetween(lower_bound, upper_bound, true))
+            it = entries_.erase(it);
+        else
+            ++it;
+    }
+
+    if(entries_.size() >= max_entries_) {
+        auto oldest = std::min_element(
+                entries_.begin(), entries_.end(),
+                [](const auto &entry1, const auto &entry2) {
+                    return entry1.second.expiry_ < entry2.second.expiry_;
+                });
+        entries_.erase(oldest);
+    }
+
+    entries_[upper_bound] = { lower_bound, successors,
+                              std::chrono::steady_clock::now() + ttl_ };
+}
+
+void LocationCache::Invalidate(const Key &key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = Find(key);
+    if(it != entries_.end())
+        entries_.erase(it);
+}
+
+void LocationCache::InvalidatePeer(const Key &id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto it = entries_.begin(); it != entries_.end();) {
+        // A successor list runs clockwise from the range to its last entry,
+        // so it covers any peer whose ID lies in that span.
+        const Entry &entry = it->second;
+        bool spans_peer = id.InBetween(entry.lower_bound_,
+                                       entry.successors_.back().id_, true);
+        if(spans_peer)
+            it = entries_.erase(it);
+        else
+            ++it;
+    }
+}
+
+void LocationCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+}
+
+size_t LocationCache::Size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+unsigned long LocationCache::Hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+unsigned long LocationCache::Misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+std::map<Key, LocationCache::Entry>::iterator LocationCache::Find(const Key &key)
+{
+    if(entries_.empty())
+        return entries_.end();
+
+    // The first entry ending at or after key is the only one which may
+    // cover it. Past the last entry, wrap around to the first (whose range
+    // may cross zero).
+    auto it = entries_.lower_bound(key);
+    if(it == entries_.end())
+        it = entries_.begin();
+
+    if(key.InBetween(it->second.lower_bound_, it->first, true))
+        return it;
+    return entries_.end();
+}
@@ -0,0 +1,119 @@
+/**
+ * location_cache.h
+ *
+ * This file implements a bounded cache of key locations. Every create and
+ * read needs the NUM_REPLICAS successors of a key, and resolving those takes
+ * a lookup (possibly several hops) per successor. Every key between two
+ * adjacent peers has the same successor list, though, so once a list has
+ * been resolved it can be reused for any nearby key until it goes stale.
+ *
+ * Entries expire after a fixed TTL, and are dropped early if any of their
+ * peers fails to respond or a new peer joins within their range.
+ */
+
+#ifndef CHORD_FINAL_LOCATION_CACHE_H
+#define CHORD_FINAL_LOCATION_CACHE_H
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "key.h"
+#include "peer_repr.h"
+
+class LocationCache {
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param max_entries Maximum number of ranges held at once.
+	 * @param ttl Time for which a resolved successor list is trusted.
+	 */
+	LocationCache(size_t max_entries, std::chrono::milliseconds ttl);
+
+	/**
+	 * Find the cached successor list of a key. Counts a hit or a miss.
+	 *
+	 * @param key Key to look up.
+	 * @param successors Set to the cached successor list on a hit.
+	 * @return Was a live entry covering key found?
+	 */
+	bool Lookup(const Key &key, std::vector<PeerRepr> &successors);
+
+	/**
+	 * Record that every key in [lower_bound, upper_bound] has the given
+	 * successor list, replacing any entries that end within that range. If
+	 * the cache is full, the entry closest to expiry is evicted.
+	 *
+	 * @param lower_bound Lower bound of range (inclusive).
+	 * @param upper_bound Upper bound of range (inclusive).
+	 * @param successors Successor list shared by keys in range.
+	 */
+	void Insert(const Key &lower_bound, const Key &upper_bound,
+	            const std::vector<PeerRepr> &successors);
+
+	/**
+	 * Drop the entry covering a key, if any (e.g. because the successors it
+	 * lists no longer hold the key).
+	 *
+	 * @param key Key whose entry will be dropped.
+	 */
+	void Invalidate(const Key &key);
+
+	/**
+	 * Drop every entry whose successor list does or should include a given
+	 * peer, i.e. lists it or spans its ID. Used both when a peer fails to
+	 * respond and when a new peer joins.
+	 *
+	 * @param id ID of peer.
+	 */
+	void InvalidatePeer(const Key &id);
+
+	/**
+	 * Drop all entries. Counters are kept.
+	 */
+	void Clear();
+
+	/// Number of entries currently held (including expired entries which
+	/// have not yet been dropped).
+	size_t Size() const;
+
+	/// Number of lookups answered from the cache.
+	unsigned long Hits() const;
+
+	/// Number of lookups which found no live entry.
+	unsigned long Misses() const;
+
+private:
+	typedef struct {
+		/// Lower bound of range (inclusive).
+		Key lower_bound_;
+		/// Successor list shared by keys in range.
+		std::vector<PeerRepr> successors_;
+		/// Time after which entry is no longer trusted.
+		std::chrono::steady_clock::time_point expiry_;
+	} Entry;
+
+	size_t max_entries_;
+	std::chrono::milliseconds ttl_;
+
+	/// Entries keyed by upper bound of their range, so that the entry
+	/// covering a key (if any) is the first whose upper bound is >= key,
+	/// wrapping around to the first entry.
+	std::map<Key, Entry> entries_;
+
+	unsigned long hits_, misses_;
+
+	/// Create/Read, request handlers and the stabilizer all use the cache.
+	mutable std::mutex mutex_;
+
+	/**
+	 * Find the entry whose range covers key.
+	 *
+	 * @param key Key to look for.
+	 * @return Iterator to entry, or entries_.end() if none covers key.
+	 */
+	std::map<Key, Entry>::iterator Find(const Key &key);
+};
+
+#endif
@@ -56,9 +56,10 @@ void CSMerkleNode::Delete(const Key &key)
     // If this key has no children, just create new node as child.
     if(root_) {
         root_ = Delete(root_, key);
-        left_ = root_->left_;
-        right_ = root_->right_;
-        hash_ = root_->hash_;
+        // Removing the last key leaves the tree empty again.
+        left_ = root_ ? root_->left_ : nullptr;
+        right_ = root_ ? root_->right_ : nullptr;
+        hash_ = root_ ? root_->hash_ : Key("0", true);
     } else
         throw std::runtime_error("No root to delete from.");
 }
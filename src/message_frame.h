@@ -0,0 +1,105 @@
+#ifndef CHORD_FINAL_MESSAGE_FRAME_H
+#define CHORD_FINAL_MESSAGE_FRAME_H
+#define FRAME_HEADER_SIZE 8
+#define MAX_FRAME_SIZE (64 * 1024 * 1024)
+#define FRAME_BINARY_FLAG 0x80000000u
+
+/**
+ * message_frame.h
+ *
+ * Requests and responses exchanged between Client and Server are framed as a
+ * 4-byte big-endian length followed by that many bytes of serialized message.
+ * This lets either side read exactly one message, of any size, without
+ * relying on a fixed buffer or on the peer closing its end of the connection.
+ *
+ * The top bit of the length is set when the message is in the binary
+ * encoding rather than JSON (see wire_format.h).
+ *
+ * The length is followed by a 4-byte big-endian request ID, which a server
+ * copies from each request into its response. A connection may carry many
+ * requests at once, and the server may answer them in any order, so this is
+ * how a client matches responses to requests.
+ */
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "wire_format.h"
+
+typedef std::array<unsigned char, FRAME_HEADER_SIZE> FrameHeader;
+
+/**
+ * Encode the header for a message body of the given size.
+ *
+ * @param body_size Size of the message body in bytes.
+ * @param format Encoding of the message body.
+ * @param request_id ID of the request the message is or answers.
+ * @return Header to be written immediately before the body.
+ */
+inline FrameHeader EncodeFrameHeader(std::size_t body_size,
+                                     WireFormat format, uint32_t request_id)
+{
+    if(body_size > MAX_FRAME_SIZE)
+        throw std::runtime_error("Message too large to frame.");
+
+    if(format == WireFormat::BINARY)
+        body_size |= FRAME_BINARY_FLAG;
+
+    return {
+        static_cast<unsigned char>(body_size >> 24),
+        static_cast<unsigned char>(body_size >> 16),
+        static_cast<unsigned char>(body_size >> 8),
+        static_cast<unsigned char>(body_size),
+        static_cast<unsigned char>(request_id >> 24),
+        static_cast<unsigned char>(request_id >> 16),
+        static_cast<unsigned char>(request_id >> 8),
+        static_cast<unsigned char>(request_id)
+    };
+}
+
+/**
+ * Decode the body size announced by a frame header.
+ *
+ * @param header Header read from the wire.
+ * @return Size of the message body that follows in bytes.
+ */
+inline std::size_t DecodeFrameHeader(const FrameHeader &header)
+{
+    std::size_t body_size = (std::size_t(header[0]) << 24) |
+                            (std::size_t(header[1]) << 16) |
+                            (std::size_t(header[2]) << 8) |
+                            std::size_t(header[3]);
+    body_size &= ~std::size_t(FRAME_BINARY_FLAG);
+
+    if(body_size > MAX_FRAME_SIZE)
+        throw std::runtime_error("Announced message size is too large.");
+
+    return body_size;
+}
+
+/**
+ * Read the encoding of a message body from its frame header.
+ *
+ * @param header Header read from the wire.
+ * @return Encoding of the message body that follows.
+ */
+inline WireFormat FrameFormat(const FrameHeader &header)
+{
+    return header[0] & (FRAME_BINARY_FLAG >> 24) ? WireFormat::BINARY :
+                                                   WireFormat::JSON;
+}
+
+/**
+ * Read the request ID from a frame header.
+ *
+ * @param header Header read from the wire.
+ * @return ID of the request the message that follows is or answers.
+ */
+inline uint32_t FrameRequestId(const FrameHeader &header)
+{
+    return (uint32_t(header[4]) << 24) | (uint32_t(header[5]) << 16) |
+           (uint32_t(header[6]) << 8) | uint32_t(header[7]);
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include <random>
 #include <chrono>
 #include <algorithm>
+#include <future>
 
 using namespace std::chrono_literals;
 
@@ -9,21 +10,36 @@ using namespace std::chrono_literals;
  * CONSTRUCTORS/MISC: Implement peer constructors and miscellaneous.
  * -------------------------------------------------------------------------- */
 
-Peer::Peer(const char *ip_addr, int port)
+Peer::Peer(const char *ip_addr, int port, int num_server_threads,
+           Transport *transport)
 // C++ requires you initialize the base class in the member init list.
         : PeerRepr(Key(std::string(ip_addr) + ":" + std::to_string(port), false),
                    Key(std::string(ip_addr) + ":" + std::to_string(port), false),
                    Key(std::string(ip_addr) + ":" + std::to_string(port), false),
                    ip_addr, port)
-        , successors_(NUM_REPLICAS)
+        , location_cache_(LOCATION_CACHE_SIZE,
+                          std::chrono::milliseconds(LOCATION_CACHE_TTL_MS))
+        , transport_(transport ? transport : &LocalTransport::Default())
+        , lookups_resolved_(0)
+        , lookup_hops_(0)
+        , maintenance_running_(false)
+        , maintenance_requested_(false)
+        , maintenance_stopped_(false)
+        , lookup_fan_out_(LOOKUP_FAN_OUT)
+        , lookup_mode_(LookupMode::RECURSIVE)
+        , stabilizer_running_(false)
+        , next_finger_(0)
+        , next_successor_(0)
 {
     Log("Creating new node with id " + std::string(id_));
-    finger_table_ = new FingerTable(id_);
+    PeerRepr *this_peer = this;
+    routing_ = std::make_shared<const RoutingState>(RoutingState {
+            *this_peer, std::nullopt, PeerList(NUM_REPLICAS), FingerTable(id_)
+    });
 
     std::map<std::string, RequestHandler> commands {
-            { "JOIN", std::mem_fn(&Peer::JoinHandler) },
-            { "GET_SUCC", std::mem_fn(&Peer::GetSuccHandler) },
-            { "GET_PRED", std::mem_fn(&Peer::GetPredHandler) },
+            { "GET_NEXT_HOP", std::mem_fn(&Peer::GetNextHopHandler) },
+            { "GET_SUCC_LIST", std::mem_fn(&Peer::GetSuccListHandler) },
             { "CREATE_FRAG", std::mem_fn(&Peer::CreateFragmentHandler) },
             { "READ_FRAG", std::mem_fn(&Peer::ReadFragmentHandler) },
             { "LEAVE", std::mem_fn(&Peer::LeaveHandler) },
@@ -33,33 +49,109 @@ Peer::Peer(const char *ip_addr, int port)
             { "MAINTENANCE", std::mem_fn(&Peer::RunGeneralMaintenanceHandler) }
     };
 
-    server_ = new Server(port_, commands, this);
-    client_ = new Client;
+    // Lookups may have to wait on other peers, so are answered asynchronously.
+    std::map<std::string, AsyncRequestHandler> async_commands {
+            { "JOIN", std::mem_fn(&Peer::JoinHandler) },
+            { "GET_SUCC", std::mem_fn(&Peer::GetSuccHandler) },
+            { "GET_PRED", std::mem_fn(&Peer::GetPredHandler) }
+    };
+
+    // Given a transport of its own, the peer needs no TCP port.
+    server_ = std::make_unique<Server<RequestHandler, Peer>>(
+            port_, commands, this, num_server_threads,
+            Server<RequestHandler, Peer>::AsyncCommandMap(
+                    async_commands.begin(), async_commands.end()),
+            transport == nullptr);
+    client_ = std::make_unique<Client>(WireFormat::BINARY, transport);
+
+    // Otherwise, requests from peers in this process (including this one)
+    // still skip the network.
+    transport_->Listen(ip_addr_, port_,
+                       [this](Json::Value request,
+                              Transport::ResponseHandler handler) {
+        server_->Dispatch(std::move(request), std::move(handler));
+    });
 }
 
-void Peer::Destroy()
+Peer::~Peer()
 {
-    if(maintenance_thread_.joinable())
-        maintenance_thread_.join();
-    else
-        Log("Not joinable");
+    transport_->Unlisten(ip_addr_, port_);
+    StopStabilizer();
+    StopMaintenance();
+
+    // Handlers on the server's threads may still be making requests, and
+    // requests still in flight may answer through the server. So the
+    // server's threads are stopped first, then the client waits out its
+    // requests, and only then is the server destroyed.
+    server_->Kill();
+    server_->Join();
+    client_.reset();
+    server_.reset();
+}
 
-    Log("FINAL RANGE: " + std::string(min_key_) + " - " + std::string(id_));
-    Log("PREDECESSOR: " + (predecessor_.has_value() ?
-                           (std::string(predecessor_->id_) + " at " +
-                            predecessor_->ip_addr_ + ":" + std::to_string(predecessor_->port_)) :
+void Peer::Destroy()
+{
+    StopMaintenance();
+
+    auto routing = Routing();
+    const std::optional<PeerRepr> &pred = routing->predecessor_;
+    Log("FINAL RANGE: " + std::string(routing->self_.min_key_) + " - " +
+        std::string(id_));
+    Log("PREDECESSOR: " + (pred.has_value() ?
+                           (std::string(pred->id_) + " at " +
+                            pred->ip_addr_ + ":" + std::to_string(pred->port_)) :
                            "NONE"));
 
-    if(successors_.Size() == 0)
+    const PeerList &successors = routing->successors_;
+    if(successors.Size() == 0)
         Log("SUCCESSORS: NONE");
     else {
         Log("SUCCESSORS:");
-        for(int i = 0; i < successors_.Size(); i++)
-            std::cout << "\t\t\t" << std::string(successors_.GetNthEntry(i).id_)
+        for(int i = 0; i < successors.Size(); i++)
+            std::cout << "\t\t\t" << std::string(successors.GetNthEntry(i).id_)
                       << std::endl;
     }
 
-    Log("FINAL FINGER TABLE:\n" + std::string(*finger_table_));
+    Log("FINAL FINGER TABLE:\n" + std::string(routing->finger_table_));
+}
+
+std::shared_ptr<const RoutingState> Peer::Routing() const
+{
+    return std::atomic_load(&routing_);
+}
+
+void Peer::UpdateRouting(const std::function<void(RoutingState &)> &update)
+{
+    std::lock_guard<std::mutex> lock(routing_mutex_);
+    auto next = std::make_shared<RoutingState>(*Routing());
+    update(*next);
+    next->finger_table_.ChooseProximatePeers(latencies_);
+    std::atomic_store(&routing_, std::shared_ptr<const RoutingState>(next));
+}
+
+void Peer::ForgetPeer(const Key &id)
+{
+    latencies_.Forget(id);
+    location_cache_.InvalidatePeer(id);
+    UpdateRouting([](RoutingState &) {});
+}
+
+std::optional<Key> Peer::CurrentClientId() const
+{
+    std::lock_guard<std::mutex> lock(current_client_ids_mutex_);
+    auto it = current_client_ids_.find(std::this_thread::get_id());
+    if(it == current_client_ids_.end())
+        return std::nullopt;
+    return it->second;
+}
+
+void Peer::SetCurrentClientId(const std::optional<Key> &id)
+{
+    std::lock_guard<std::mutex> lock(current_client_ids_mutex_);
+    if(id.has_value())
+        current_client_ids_.insert_or_assign(std::this_thread::get_id(), *id);
+    else
+        current_client_ids_.erase(std::this_thread::get_id());
 }
 
 void Peer::Log(const std::string &str)
@@ -76,15 +168,16 @@ bool Peer::OwnedLocally(const Key &key)
     // Ownership of a key by a peer implies that said peer is the *immediate*
     // successor of the key in question, i.e. the key is between the peer's
     // predecessor and itself.
-    if(predecessor_.has_value())
-        return key.InBetween(predecessor_.value().id_ + 1, id_, true);
+    auto routing = Routing();
+    if(routing->predecessor_.has_value())
+        return key.InBetween(routing->predecessor_->id_ + 1, id_, true);
 
     return true;
 }
 
 bool Peer::StoredLocally(const Key &key)
 {
-    return key.InBetween(min_key_, id_, true);
+    return key.InBetween(Routing()->self_.min_key_, id_, true);
 }
 
 
@@ -99,31 +192,79 @@ Json::Value Peer::MakeRequest(Json::Value request, const PeerRepr &peer)
     request["SENDER_ID"] = std::string(id_);
     request["RECIPIENT_ID"] = std::string(peer.id_);
     try {
-        return client_->MakeRequest(peer.ip_addr_, peer.port_, request);
+        // Time the round trip so that lookups can favor less latent peers.
+        auto start = std::chrono::steady_clock::now();
+        Json::Value resp = client_->MakeRequest(peer.ip_addr_, peer.port_,
+                                                request);
+        std::chrono::duration<float> rtt = std::chrono::steady_clock::now()
+                                           - start;
+        latencies_.Record(peer, rtt.count());
+        return resp;
     } catch(...) {
+        ForgetPeer(peer.id_);
         throw std::exception();
     }
 }
 
+std::future<Json::Value> Peer::MakeRequestAsync(Json::Value request,
+                                                const PeerRepr &peer)
+{
+    auto promise = std::make_shared<std::promise<Json::Value>>();
+    std::future<Json::Value> resp = promise->get_future();
+    MakeRequestAsync(std::move(request), peer,
+                     [promise](std::exception_ptr err, Json::Value resp) {
+        if(err)
+            promise->set_exception(err);
+        else
+            promise->set_value(std::move(resp));
+    });
+    return resp;
+}
+
+void Peer::MakeRequestAsync(Json::Value request, const PeerRepr &peer,
+                            Client::ResponseHandler handler)
+{
+    request["SENDER_ID"] = std::string(id_);
+    request["RECIPIENT_ID"] = std::string(peer.id_);
+
+    auto start = std::chrono::steady_clock::now();
+    client_->MakeRequestAsync(peer.ip_addr_, peer.port_, request,
+                              [this, peer, start, handler = std::move(handler)]
+                              (std::exception_ptr err, Json::Value resp) {
+        if(err) {
+            ForgetPeer(peer.id_);
+            handler(std::make_exception_ptr(std::exception()), Json::Value());
+            return;
+        }
+
+        std::chrono::duration<float> rtt = std::chrono::steady_clock::now()
+                                           - start;
+        latencies_.Record(peer, rtt.count());
+        handler(nullptr, std::move(resp));
+    });
+}
+
 bool Peer::ValidateRequest(const Json::Value &request)
 {
     if(request["RECIPIENT_ID"].asString() != std::string(id_))
         return false;
 
-    current_client_id_ = Key(request["SENDER_ID"].asString(), true);
+    SetCurrentClientId(Key(request["SENDER_ID"].asString(), true));
     return true;
 }
 
 Json::Value Peer::ForwardRequest(const Json::Value &request, const Key &key) {
-    PeerRepr key_succ = finger_table_->Lookup(key);
-    bool key_succ_is_busy = key_succ.id_ == current_client_id_,
+    auto routing = Routing();
+    std::optional<Key> current_client_id = CurrentClientId();
+    PeerRepr key_succ = routing->finger_table_.Lookup(key);
+    bool key_succ_is_busy = key_succ.id_ == current_client_id,
             key_succ_is_us = key_succ.id_ == id_;
 
     if(key_succ_is_busy || key_succ_is_us) {
-        if(current_client_id_ == predecessor_->id_)
-            return MakeRequest(request, successors_.GetNthEntry(0));
+        if(current_client_id == routing->predecessor_->id_)
+            return MakeRequest(request, routing->successors_.GetNthEntry(0));
         else
-            return MakeRequest(request, predecessor_.value());
+            return MakeRequest(request, routing->predecessor_.value());
     }
 
     try {
@@ -133,6 +274,65 @@ Json::Value Peer::ForwardRequest(const Json::Value &request, const Key &key) {
     }
 }
 
+void Peer::ForwardRequestAsync(const Json::Value &request, const Key &key,
+                               const std::optional<Key> &client_id,
+                               Client::ResponseHandler handler)
+{
+    auto routing = Routing();
+    PeerRepr key_succ = routing->finger_table_.Lookup(key);
+    bool key_succ_is_busy = key_succ.id_ == client_id,
+            key_succ_is_us = key_succ.id_ == id_;
+
+    if(key_succ_is_busy || key_succ_is_us) {
+        if(client_id == routing->predecessor_->id_)
+            return MakeRequestAsync(request,
+                                    routing->successors_.GetNthEntry(0),
+                                    std::move(handler));
+        else
+            return MakeRequestAsync(request, routing->predecessor_.value(),
+                                    std::move(handler));
+    }
+
+    MakeRequestAsync(request, key_succ, std::move(handler));
+}
+
+/**
+ * Adapt a Responder to the response of a peer whose answer is another peer,
+ * passing on that peer's representation (or the error raised in reading it).
+ *
+ * @param respond Responder to answer.
+ * @return Handler for the peer's response.
+ */
+static Client::ResponseHandler RespondWithPeer(Responder respond)
+{
+    return [respond = std::move(respond)](std::exception_ptr err,
+                                          Json::Value resp) {
+        if(err)
+            return respond(err, Json::Value());
+
+        Json::Value peer;
+        try {
+            peer = Json::Value(PeerRepr(resp));
+        } catch(...) {
+            return respond(std::current_exception(), Json::Value());
+        }
+        respond(nullptr, std::move(peer));
+    };
+}
+
+/**
+ * Make the error with which a lookup that has taken too many hops fails.
+ *
+ * @param key Key being looked up.
+ * @return The error.
+ */
+static std::exception_ptr TooManyHops(const Key &key)
+{
+    return std::make_exception_ptr(std::runtime_error(
+            "Lookup of " + std::string(key) + " exceeded "
+            + std::to_string(MAX_LOOKUP_HOPS) + " hops."));
+}
+
 
 /* ----------------------------------------------------------------------------
  * JOIN/LEAVE: Implement functions for peers to start a chord, join it,
@@ -149,7 +349,9 @@ bool Peer::StartChord()
     try {
         // If this peer is the only peer in ring, then this peer owns all keys.
         // Hence, its range will be [id_ + 1, id_], covering the whole of the ring.
-        min_key_ = id_ + 1;
+        UpdateRouting([this](RoutingState &routing) {
+            routing.self_.min_key_ = id_ + 1;
+        });
 
         // Run server as daemon.
         server_->RunInBackground();
@@ -157,11 +359,11 @@ bool Peer::StartChord()
         // Prevent race condition.
         std::this_thread::sleep_for(10ms);
 
-        maintenance_thread_ = std::thread([this] {
-          sleep(5);
-          RunGeneralMaintenance();
-        });
-        maintenance_thread_.detach();
+        StartStabilizer(std::chrono::milliseconds(STABILIZE_PERIOD_MS),
+                        std::chrono::milliseconds(STABILIZE_JITTER_MS));
+
+        // Maintenance starts once there is a successor to hand it on to.
+        StartMaintenance(5s);
 
         return true;
     } catch (...) {
@@ -178,59 +380,77 @@ bool Peer::Join(const char *gateway_ip, int port)
 
     Json::Value join_req;
     join_req["COMMAND"] = "JOIN";
-    PeerRepr *this_peer = this;
-    join_req["NEW_PEER"] = Json::Value(*this_peer);
+    join_req["NEW_PEER"] = Json::Value(Routing()->self_);
     Json::Value join_resp = client_->MakeRequest(gateway_ip, port, join_req);
-    predecessor_ = PeerRepr(join_resp["PREDECESSOR"]);
-    min_key_ = predecessor_->id_ + 1;
-    Log("Predecessor given by gateway is " + std::string(predecessor_->id_));
-    Log("New range is " + std::string(min_key_) + "-" + std::string(id_));
+    PeerRepr pred(join_resp["PREDECESSOR"]);
+    UpdateRouting([&pred](RoutingState &routing) {
+        routing.predecessor_ = pred;
+        routing.self_.min_key_ = pred.id_ + 1;
+    });
+    Log("Predecessor given by gateway is " + std::string(pred.id_));
+    Log("New range is " + std::string(pred.id_ + 1) + "-" + std::string(id_));
 
     PopulateFingerTable(true);
-    Log("CURRENT RANGE: " + std::string(min_key_) + "-" + std::string(id_));
-    Log("FINGER TABLE INITIALIZED AS:\n" + std::string(*finger_table_));
+    auto routing = Routing();
+    Log("CURRENT RANGE: " + std::string(routing->self_.min_key_) + "-" +
+        std::string(id_));
+    Log("FINGER TABLE INITIALIZED AS:\n" +
+        std::string(routing->finger_table_));
 
     // Notify all 14 predecessors so they can update their successor lists.
-    for(const PeerRepr &pred : GetNPredecessors(id_, NUM_REPLICAS))
-        Notify(*this_peer, pred);
+    for(const PeerRepr &nth_pred : GetNPredecessors(id_, NUM_REPLICAS))
+        Notify(routing->self_, nth_pred);
 
-    successors_ = PeerList(NUM_REPLICAS, GetNSuccessors(id_, NUM_REPLICAS));
-    Notify(*this_peer, successors_.GetNthEntry(0));
+    std::vector<PeerRepr> succs = GetNSuccessors(id_, NUM_REPLICAS);
+    UpdateRouting([&succs](RoutingState &routing) {
+        routing.successors_ = PeerList(NUM_REPLICAS, succs);
+    });
+    Notify(routing->self_, succs.at(0));
+
+    StartStabilizer(std::chrono::milliseconds(STABILIZE_PERIOD_MS),
+                    std::chrono::milliseconds(STABILIZE_JITTER_MS));
+    return true;
 }
 
-Json::Value Peer::JoinHandler(const Json::Value &request)
+void Peer::JoinHandler(const Json::Value &request, Responder respond)
 {
-    Log("Here");
-    Json::Value join_resp;
     PeerRepr new_peer(request["NEW_PEER"]);
 
-    // Get the predecessor and successor of new peer, store in JSON.
-    PeerRepr new_peer_pred = GetPredecessor(new_peer.id_);
-
-    join_resp["PREDECESSOR"] = Json::Value(new_peer_pred);
-    Log("RESPONDING TO JOIN RESP WITH " + join_resp.toStyledString());
-    return join_resp;
+    // Get the predecessor of new peer, store in JSON.
+    GetPredecessorAsync(new_peer.id_, std::nullopt,
+                        [this, respond](std::exception_ptr err,
+                                        Json::Value new_peer_pred) {
+        if(err)
+            return respond(err, Json::Value());
+
+        Json::Value join_resp;
+        join_resp["PREDECESSOR"] = std::move(new_peer_pred);
+        Log("RESPONDING TO JOIN RESP WITH " + join_resp.toStyledString());
+        respond(nullptr, std::move(join_resp));
+    });
 }
 
 bool Peer::Leave()
 {
+    auto routing = Routing();
     Json::Value notification_for_succ, notification_for_pred;
     // Our predecessor becomes our successor's predecessor.
     notification_for_succ["COMMAND"] = "LEAVE";
-    notification_for_succ["NEW_PRED"] = Json::Value(*predecessor_);
-    notification_for_succ["NEW_MIN"] = std::string(min_key_ + 1);
+    notification_for_succ["NEW_PRED"] = Json::Value(*routing->predecessor_);
+    notification_for_succ["NEW_MIN"] = std::string(routing->self_.min_key_ + 1);
 
     // Allow predecessor to update its finger table entries to account for our
     // absence.
-    PeerRepr succ = successors_.GetNthEntry(0);
-    succ.min_key_ = min_key_;
+    PeerRepr succ = routing->successors_.GetNthEntry(0);
+    succ.min_key_ = routing->self_.min_key_;
     notification_for_pred["COMMAND"] = "LEAVE";
     notification_for_pred["NEW_SUCC"] = Json::Value(succ);
 
-    MakeRequest(notification_for_succ, successors_.GetNthEntry(0));
-    MakeRequest(notification_for_pred, *predecessor_);
+    MakeRequest(notification_for_succ, routing->successors_.GetNthEntry(0));
+    MakeRequest(notification_for_pred, *routing->predecessor_);
 
     Kill();
+    return true;
 }
 
 Json::Value Peer::LeaveHandler(const Json::Value &request)
@@ -238,21 +458,27 @@ Json::Value Peer::LeaveHandler(const Json::Value &request)
     ValidateRequest(request);
     Json::Value json_resp;
 
-    if(current_client_id_ == predecessor_->id_) {
-        predecessor_ = PeerRepr(request["NEW_PRED"]);
-        min_key_ = Key(request["NEW_MIN"].asString(), true);
-    }
+    std::optional<Key> current_client_id = CurrentClientId();
+    UpdateRouting([&current_client_id, &request](RoutingState &routing) {
+        if(current_client_id == routing.predecessor_->id_) {
+            routing.predecessor_ = PeerRepr(request["NEW_PRED"]);
+            routing.self_.min_key_ = Key(request["NEW_MIN"].asString(), true);
+        }
 
-    if(current_client_id_ == successors_.GetNthEntry(0).id_)
-        finger_table_->AdjustFingers(request["NEW_SUCC"]);
+        if(current_client_id == routing.successors_.GetNthEntry(0).id_)
+            routing.finger_table_.AdjustFingers(request["NEW_SUCC"]);
+    });
 
-    current_client_id_.reset();
+    SetCurrentClientId(std::nullopt);
     return json_resp;
 }
 
 void Peer::Kill()
 {
     // This would be equivalent to an un-graceful leave.
+    StopStabilizer();
+    StopMaintenance();
+    transport_->Unlisten(ip_addr_, port_);
     server_->Kill();
 }
 
@@ -278,33 +504,48 @@ Json::Value Peer::NotifyHandler(const Json::Value &request)
     Key recipient_id(request["RECIP_ID"].asString(), true);
     PeerRepr new_peer(request["NEW_PEER"]);
 
+    // Any cached successor list spanning the new peer is now out of date.
+    location_cache_.InvalidatePeer(new_peer.id_);
+
     // If the new peer is clockwise-between the current predecessor and
     // this peer, then the new peer will replace the current predecessor.
     // If we don't have a predecessor, then this key can be assumed as our pred.
     // This ternary ensures that the second condition is not evaluate if
     // predecessor is nullptr (which would cause segfault.
-    bool peer_is_pred = ! predecessor_.has_value() ||
-                        new_peer.id_.InBetween(predecessor_->id_, id_, false);
+    bool peer_is_pred;
+    std::optional<PeerRepr> old_pred;
+    UpdateRouting([this, &new_peer, &peer_is_pred,
+                   &old_pred](RoutingState &routing) {
+        old_pred = routing.predecessor_;
+        peer_is_pred = ! old_pred.has_value() ||
+                       new_peer.id_.InBetween(old_pred->id_, id_, false);
+        if(! peer_is_pred)
+            return;
 
-    if(peer_is_pred) {
         // Update any finger tables which should now point to new peer.
-        finger_table_->AdjustFingers(new_peer);
-        Log("Old predecessor was " + (predecessor_.has_value() ?
-                                      std::string(predecessor_->id_) :
+        routing.finger_table_.AdjustFingers(new_peer);
+        routing.predecessor_ = new_peer;
+        routing.self_.min_key_ = new_peer.id_ + 1;
+    });
+
+    if(peer_is_pred) {
+        Log("Old predecessor was " + (old_pred.has_value() ?
+                                      std::string(old_pred->id_) :
                                       "Nothing"));
         Log("New predecessor is " + std::string(new_peer.id_));
-        predecessor_ = new_peer;
-        min_key_ = predecessor_->id_ + 1;
-        Log("New range is " + std::string(min_key_) + "-" + std::string(id_));
+        Log("New range is " + std::string(new_peer.id_ + 1) + "-" +
+            std::string(id_));
         return notify_resp;
     }
 
-    if(finger_table_->Empty())
+    if(Routing()->finger_table_.Empty())
         PopulateFingerTable(true);
 
     // Update any finger tables which should now point to new peer.
-    finger_table_->AdjustFingers(new_peer);
-    successors_.Insert(new_peer);
+    UpdateRouting([&new_peer](RoutingState &routing) {
+        routing.finger_table_.AdjustFingers(new_peer);
+        routing.successors_.Insert(new_peer);
+    });
 
     return notify_resp;
 }
@@ -320,38 +561,248 @@ Json::Value Peer::NotifyHandler(const Json::Value &request)
  * -------------------------------------------------------------------------- */
 
 void Peer::RunGeneralMaintenance() {
-    while(successors_.Size() == 0) {}
-    sleep(1);
+    // Wait for a successor to hand maintenance on to, then a second more,
+    // unless the peer is torn down meanwhile.
+    {
+        auto stopped = [this] { return maintenance_stopped_; };
+        std::unique_lock<std::mutex> lock(maintenance_mutex_);
+        while(Routing()->successors_.Size() == 0)
+            if(maintenance_cv_.wait_for(lock, 100ms, stopped))
+                return;
+        if(maintenance_cv_.wait_for(lock, 1s, stopped))
+            return;
+    }
     Log("Starting general maintenance");
-    Stabilize();
-    RunLocalMaintenance();
-    RunGlobalMaintenance();
+    // This runs on a thread of its own, which an exception must not escape.
+    try {
+        RunLocalMaintenance();
+        RunGlobalMaintenance();
 
-    Json::Value maintenance_req;
-    maintenance_req["COMMAND"] = "MAINTENANCE";
-    MakeRequest(maintenance_req, successors_.GetNthEntry(0));
+        Json::Value maintenance_req;
+        maintenance_req["COMMAND"] = "MAINTENANCE";
+        MakeRequest(maintenance_req, Routing()->successors_.GetNthEntry(0));
+    } catch(...) {
+        // A peer we contacted may have failed. Maintenance resumes when the
+        // next request for it arrives.
+        Log("General maintenance failed");
+        return;
+    }
     Log("Ending general maintenance");
 }
 
 Json::Value Peer::RunGeneralMaintenanceHandler(const Json::Value &request)
 {
-    maintenance_thread_ = std::thread([this] { RunGeneralMaintenance(); });
-    maintenance_thread_.detach();
+    StartMaintenance(0ms);
     Json::Value resp;
     return resp;
 }
 
-void Peer::Stabilize()
+void Peer::StartMaintenance(std::chrono::milliseconds delay)
+{
+    std::lock_guard<std::mutex> lock(maintenance_mutex_);
+    if(maintenance_stopped_)
+        return;
+    if(maintenance_running_) {
+        maintenance_requested_ = true;
+        return;
+    }
+
+    // Any earlier thread has finished, so joins at once.
+    if(maintenance_thread_.joinable())
+        maintenance_thread_.join();
+    maintenance_running_ = true;
+    maintenance_thread_ = std::thread([this, delay] {
+        auto stopped = [this] { return maintenance_stopped_; };
+        std::unique_lock<std::mutex> lock(maintenance_mutex_);
+        if(! maintenance_cv_.wait_for(lock, delay, stopped)) {
+            do {
+                maintenance_requested_ = false;
+                lock.unlock();
+                RunGeneralMaintenance();
+                lock.lock();
+            } while(maintenance_requested_ && ! maintenance_stopped_);
+        }
+        maintenance_running_ = false;
+    });
+}
+
+void Peer::StopMaintenance()
 {
-    Log("FINGER TABLE BEFORE STABILIZE:\n" + std::string(*finger_table_));
-    PopulateFingerTable(false);
+    std::thread maintenance;
+    {
+        std::lock_guard<std::mutex> lock(maintenance_mutex_);
+        maintenance_stopped_ = true;
+        maintenance = std::move(maintenance_thread_);
+    }
+    maintenance_cv_.notify_all();
+    if(maintenance.joinable())
+        maintenance.join();
+}
 
-    successors_ = PeerList(NUM_REPLICAS, GetNSuccessors(id_, NUM_REPLICAS));
+void Peer::StartStabilizer(std::chrono::milliseconds period,
+                           std::chrono::milliseconds jitter)
+{
+    StopStabilizer();
+    {
+        std::lock_guard<std::mutex> lock(stabilizer_mutex_);
+        stabilizer_running_ = true;
+    }
+
+    stabilizer_thread_ = std::thread([this, period, jitter] {
+        std::mt19937 gen(std::random_device{}());
+        std::uniform_int_distribution<long> offset(-jitter.count(),
+                                                   jitter.count());
+
+        std::unique_lock<std::mutex> lock(stabilizer_mutex_);
+        while(true) {
+            auto delay = period + std::chrono::milliseconds(offset(gen));
+            if(stabilizer_cv_.wait_for(lock, delay,
+                                       [this] { return ! stabilizer_running_; }))
+                return;
+
+            lock.unlock();
+            try {
+                StabilizeTick();
+            } catch(...) {
+                // A peer we contacted may have failed; the next tick will
+                // try again (and may well be checking a different peer).
+                Log("Stabilizer tick failed");
+            }
+            lock.lock();
+        }
+    });
+}
+
+void Peer::StopStabilizer()
+{
+    {
+        std::lock_guard<std::mutex> lock(stabilizer_mutex_);
+        stabilizer_running_ = false;
+    }
+    stabilizer_cv_.notify_all();
+
+    if(stabilizer_thread_.joinable() &&
+       stabilizer_thread_.get_id() != std::this_thread::get_id())
+        stabilizer_thread_.join();
+}
+
+void Peer::StabilizeTick()
+{
+    FixNextFinger();
+    CheckNextSuccessor();
+}
+
+void Peer::FixNextFinger()
+{
+    auto routing = Routing();
+    const FingerTable &finger_table = routing->finger_table_;
+    if(finger_table.Empty())
+        return;
+
+    int n = next_finger_ % finger_table.Size();
+    next_finger_ = (n + 1) % finger_table.Size();
+    Finger finger = finger_table.GetNthEntry(n);
+    PeerRepr succ = finger.successor_;
+
+    // Rather than issue a full (recursive) lookup, ask the finger's current
+    // successor for its predecessor, which it answers without forwarding. If
+    // that predecessor also succeeds the lower bound, it is a closer successor
+    // and the finger steps back to it; repeated ticks walk the finger back to
+    // the true successor. Recursive lookups from every peer's stabilizer at
+    // once would tie up servers waiting on one another.
+    std::optional<PeerRepr> succ_pred;
+    if(succ.id_ == id_) {
+        succ_pred = routing->predecessor_;
+    } else {
+        Json::Value get_pred_req;
+        get_pred_req["COMMAND"] = "GET_PRED";
+        get_pred_req["KEY"] = std::string(succ.id_);
+        try {
+            succ_pred = PeerRepr(MakeRequest(get_pred_req, succ));
+        } catch(...) {
+            // The successor has failed, so a lookup is unavoidable.
+            succ = GetSuccessor(finger.lower_bound_);
+            UpdateRouting([n, &succ](RoutingState &routing) {
+                routing.finger_table_.EditNthFinger(n, succ);
+            });
+            return;
+        }
+    }
+
+    if(succ_pred.has_value() && succ_pred->id_ != succ.id_ &&
+       succ_pred->id_.InBetween(finger.lower_bound_, succ.id_, true))
+        UpdateRouting([n, &succ_pred](RoutingState &routing) {
+            routing.finger_table_.EditNthFinger(n, succ_pred.value());
+        });
+}
+
+void Peer::CheckNextSuccessor()
+{
+    auto routing = Routing();
+    const PeerList &successors = routing->successors_;
+    if(successors.Size() == 0)
+        return;
+
+    int n = next_successor_ % successors.Size();
+    next_successor_ = (n + 1) % successors.Size();
+    PeerRepr succ = successors.GetNthEntry(n);
+    if(succ.id_ == id_)
+        return;
+
+    if(n == 0) {
+        // Ask our successor for its predecessor. If a peer has joined
+        // between us, it becomes our successor. Otherwise, if our successor
+        // has no predecessor or has one preceding us, tell it about us.
+        Json::Value get_pred_req;
+        get_pred_req["COMMAND"] = "GET_PRED";
+        get_pred_req["KEY"] = std::string(succ.id_);
+        PeerRepr succ_pred(MakeRequest(get_pred_req, succ));
+
+        if(succ_pred.id_.InBetween(id_, succ.id_, false)) {
+            UpdateRouting([&succ_pred](RoutingState &routing) {
+                routing.successors_.Insert(succ_pred);
+            });
+        } else if(succ_pred.id_ == succ.id_ ||
+                  id_.InBetween(succ_pred.id_, succ.id_, false)) {
+            Notify(routing->self_, succ);
+        }
+        return;
+    }
+
+    if(client_->IsAlive(succ.ip_addr_, succ.port_))
+        return;
+
+    // Drop the dead successor and refill the list from its far end.
+    Log("Successor " + std::string(succ.id_) + " is unresponsive");
+    latencies_.Forget(succ.id_);
+    std::vector<PeerRepr> succs;
+    UpdateRouting([&succ, &succs](RoutingState &routing) {
+        routing.successors_.Remove(succ.id_);
+        for(size_t i = 0; i < routing.successors_.Size(); i++)
+            succs.push_back(routing.successors_.GetNthEntry(i));
+    });
+    if(succs.empty())
+        return;
+
+    // The replacement follows the last entry, so it is appended directly,
+    // unless the list has changed while we were looking it up.
+    PeerRepr replacement = GetSuccessor(succs.back().id_ + 1);
+    bool is_new = std::find(succs.begin(), succs.end(), replacement)
+                  == succs.end();
+    if(replacement.id_ != id_ && is_new) {
+        succs.push_back(replacement);
+        UpdateRouting([&succs](RoutingState &routing) {
+            const PeerList &current = routing.successors_;
+            if(current.Size() == succs.size() - 1 &&
+               current.GetNthEntry(int(current.Size()) - 1).id_ ==
+               succs.at(succs.size() - 2).id_)
+                routing.successors_ = PeerList(NUM_REPLICAS, succs);
+        });
+    }
 }
 
 void Peer::RunGlobalMaintenance()
 {
-    PeerRepr *this_node = this;
     Key current_key = id_;
 
     do {
@@ -359,7 +810,7 @@ void Peer::RunGlobalMaintenance()
         // If this node is not within the NUM_REPLICAS successors of the key,
         // key should not be stored here.
         bool key_is_misplaced = std::find(succs.begin(), succs.end(),
-                                          *this_node) == succs.end();
+                                          Routing()->self_) == succs.end();
         if (key_is_misplaced) {
             // If that key is misplaced, then the entire range of keys between
             // it and its immediate successor is misplaced.
@@ -368,7 +819,8 @@ void Peer::RunGlobalMaintenance()
 
             for(const auto &[misplaced_key, misplaced_frag] : misplaced_keys) {
                 for(const auto &succ : succs) {
-                    if(CreateFragment(succ, misplaced_key, misplaced_frag)) {
+                    if(CreateFragment(succ, misplaced_key,
+                                      misplaced_frag).get()) {
                         database_.Delete(misplaced_key);
                         break;
                     }
@@ -376,14 +828,16 @@ void Peer::RunGlobalMaintenance()
             }
         }
         current_key = succs.at(0).id_;
-    } while(! current_key.InBetween(min_key_, id_, true));
+    } while(! StoredLocally(current_key));
     // By the time we loop back around through the entire database, we can stop.
 }
 
 void Peer::RunLocalMaintenance()
 {
-    for(int i = 0; i < successors_.Size(); i++)
-        Synchronize(successors_.GetNthEntry(i), min_key_, id_);
+    auto routing = Routing();
+    for(int i = 0; i < routing->successors_.Size(); i++)
+        Synchronize(routing->successors_.GetNthEntry(i),
+                    routing->self_.min_key_, id_);
 }
 
 void Peer::Synchronize(const PeerRepr &succ, const Key &lower_bound,
@@ -433,54 +887,138 @@ void Peer::RetrieveMissing(const Key &key)
 void Peer::PopulateFingerTable(bool initialize)
 {
     Log(std::string(initialize ? "Initializing":"Updating") + " finger table.");
-    for(int i = 0; i < finger_table_->num_entries_; i++) {
-        std::pair<Key, Key> entry_range = finger_table_->GetNthRange(i);
-
-        Json::Value succ_req;
-        succ_req["COMMAND"] = "GET_SUCC";
-        succ_req["KEY"] = std::string(entry_range.first);
-
+    auto routing = Routing();
+    const FingerTable &finger_table = routing->finger_table_;
+    const std::vector<FingerRange> &ranges = finger_table.GetRanges();
+    int num_entries = finger_table.num_entries_;
+    std::vector<std::optional<PeerRepr>> succs(num_entries);
+
+    // Ranges whose lower bound we own point to us; no lookup is needed.
+    for(int i = 0; i < num_entries; i++)
+        if(ranges[i].first.InBetween(routing->self_.min_key_, id_, true))
+            succs[i] = routing->self_;
+
+    // Since the Peer::GetSuccessor member function depends upon a populated
+    // finger table, on initialization we must instead formulate the request
+    // on our own and forward it to a known node. Since the first call to
+    // finger table population occurs after the predecessor has been set, we
+    // forward these requests to the predecessor.
+    // Lookups go out through the asynchronous client, so a wave costs no
+    // threads of its own; only this thread waits on the answers.
+    auto lookup_succ = [this, initialize, routing](const Key &lower_bound) {
         if(initialize) {
-            // Since the Peer::GetSuccessor member function depends upon
-            // a populated finger table, we must instead formulate the
-            // request on our own and forward it to a known node.
-            // Since the first call to finger table population occurs
-            // after the predecessor has been set, we forward these requests
-            // to the predecessor.
-            if(entry_range.first.InBetween(min_key_, id_, true)) {
-                PeerRepr *this_peer = this;
-                finger_table_->AddFinger(Finger { entry_range.first,
-                                                  entry_range.second,
-                                                  PeerRepr(*this_peer) });
-            } else {
-                PeerRepr peer_to_query = i == 0 ?
-                                         *predecessor_ :
-                                         finger_table_->GetNthEntry(i-1).successor_;
-                std::string ip_to_query = peer_to_query.ip_addr_;
-                Json::Value resp = MakeRequest(succ_req, peer_to_query);
-
-                finger_table_->AddFinger(Finger { entry_range.first,
-                                                  entry_range.second,
-                                                  PeerRepr(resp) });
-            }
-        } else {
-            if(i == 0)
-                finger_table_->EditNthFinger(i, GetSuccessor(entry_range.first));
-            else {
-                PeerRepr peer_to_query = finger_table_->GetNthEntry(i-1).successor_;
-                Json::Value resp;
-                try {
-                    resp = MakeRequest(succ_req, peer_to_query);
-                } catch(...) {
-                    resp = GetSuccessor(entry_range.first);
-                }
-                finger_table_->EditNthFinger(i, PeerRepr(resp));
+            Json::Value succ_req;
+            succ_req["COMMAND"] = "GET_SUCC";
+            succ_req["KEY"] = std::string(lower_bound);
+            return MakeRequestAsync(succ_req, *routing->predecessor_);
+        }
+        auto succ = std::make_shared<std::promise<Json::Value>>();
+        GetSuccessorAsync(lower_bound, std::nullopt,
+                          [succ](std::exception_ptr err, Json::Value resp) {
+            if(err)
+                succ->set_exception(err);
+            else
+                succ->set_value(std::move(resp));
+        });
+        return succ->get_future();
+    };
+
+    // Issue lookups in waves of at most lookup_fan_out_ concurrent requests.
+    // Each answer also settles every following finger whose lower bound
+    // precedes the successor found, so in a ring of N peers only about
+    // log(N) distinct lookups are needed.
+    const size_t fan_out = lookup_fan_out_;
+    while(true) {
+        std::vector<int> batch;
+        auto first_unresolved = std::find(succs.begin(), succs.end(),
+                                          std::nullopt);
+        if(first_unresolved == succs.end())
+            break;
+        batch.push_back(int(first_unresolved - succs.begin()));
+
+        // Speculatively look up fingers likely to have a different
+        // successor: when updating, the first finger of each existing run;
+        // when initializing, the highest fingers, since each of them spans
+        // half of the remaining ring.
+        if(!initialize)
+            for(const FingerRun &run : finger_table.GetRuns())
+                if(batch.size() < fan_out && run.first_finger_ > batch[0]
+                   && !succs[run.first_finger_].has_value())
+                    batch.push_back(run.first_finger_);
+        for(int i = num_entries - 1; i > batch[0]; i--)
+            if(batch.size() < fan_out && !succs[i].has_value() &&
+               std::find(batch.begin(), batch.end(), i) == batch.end())
+                batch.push_back(i);
+
+        std::vector<std::future<Json::Value>> lookups;
+        for(int i : batch)
+            lookups.push_back(lookup_succ(ranges[i].first));
+
+        for(size_t j = 0; j < batch.size(); j++) {
+            int i = batch[j];
+            PeerRepr succ = routing->self_;
+            try {
+                succ = PeerRepr(lookups[j].get());
+            } catch(...) {
+                // If a lookup fails while updating, keep the current entry.
+                if(initialize || i >= finger_table.Size())
+                    throw;
+                succ = finger_table.GetNthEntry(i).successor_;
             }
+
+            for(int k = i; k < num_entries && !succs[k].has_value() &&
+                           ranges[k].first.InBetween(ranges[i].first,
+                                                     succ.id_, true); k++)
+                succs[k] = succ;
+            // The lower bound's own lookup always settles its finger.
+            if(!succs[i].has_value())
+                succs[i] = succ;
         }
     }
+
+    UpdateRouting([num_entries, &ranges, &succs](RoutingState &routing) {
+        FingerTable &finger_table = routing.finger_table_;
+        for(int i = 0; i < num_entries; i++) {
+            if(i < finger_table.Size())
+                finger_table.EditNthFinger(i, *succs[i]);
+            else
+                finger_table.AddFinger(Finger { ranges[i].first,
+                                                ranges[i].second, *succs[i] });
+        }
+    });
     Log("Ended finger table population.");
 }
 
+void Peer::SetLookupFanOut(int fan_out)
+{
+    lookup_fan_out_ = std::max(fan_out, 1);
+}
+
+void Peer::SetLookupMode(LookupMode mode)
+{
+    lookup_mode_ = mode;
+}
+
+const LocationCache &Peer::GetLocationCache() const
+{
+    return location_cache_;
+}
+
+PeerRepr Peer::FindSuccessor(const Key &key)
+{
+    return GetSuccessor(key);
+}
+
+std::shared_ptr<const RoutingState> Peer::GetRoutingState() const
+{
+    return Routing();
+}
+
+LookupStats Peer::GetLookupStats() const
+{
+    return { lookups_resolved_, lookup_hops_ };
+}
+
 /* ----------------------------------------------------------------------------
  * SUCC/PRED FUNCTIONS: Implement member functions which retrieve successors
  						and predecessors of a given key by forwarding them
@@ -489,9 +1027,11 @@ void Peer::PopulateFingerTable(bool initialize)
 
 PeerRepr Peer::GetSuccessor(const Key &key)
 {
-    if (key.InBetween(min_key_, id_, true)) {
-        PeerRepr *local_peer = this;
-        return *local_peer;
+    auto routing = Routing();
+    if (key.InBetween(routing->self_.min_key_, id_, true)) {
+        return routing->self_;
+    } else if(lookup_mode_ == LookupMode::ITERATIVE) {
+        return GetSuccessorIteratively(key);
     } else {
         Json::Value get_succ_req, json_peer;
         get_succ_req["COMMAND"] = "GET_SUCC";
@@ -500,60 +1040,359 @@ PeerRepr Peer::GetSuccessor(const Key &key)
         try {
             json_peer = ForwardRequest(get_succ_req, key);
         } catch(const std::exception &err) {
-            json_peer = MakeRequest(get_succ_req, *predecessor_);
+            json_peer = MakeRequest(get_succ_req, *routing->predecessor_);
         }
         return PeerRepr(json_peer);
     }
 }
 
-Json::Value Peer::GetSuccHandler(const Json::Value &request)
+void Peer::GetSuccessorAsync(const Key &key,
+                             const std::optional<Key> &client_id,
+                             Responder respond, int hops)
+{
+    auto routing = Routing();
+    if (key.InBetween(routing->self_.min_key_, id_, true)) {
+        respond(nullptr, Json::Value(routing->self_));
+    } else if(lookup_mode_ == LookupMode::ITERATIVE) {
+        GetSuccessorIterativelyAsync(key, std::move(respond));
+    } else if(hops >= MAX_LOOKUP_HOPS) {
+        respond(TooManyHops(key), Json::Value());
+    } else {
+        Json::Value get_succ_req;
+        get_succ_req["COMMAND"] = "GET_SUCC";
+        get_succ_req["KEY"] = std::string(key);
+        get_succ_req["HOPS"] = hops + 1;
+
+        ForwardRequestAsync(get_succ_req, key, client_id,
+                            [this, get_succ_req, routing, respond]
+                            (std::exception_ptr err, Json::Value resp) {
+            if(! err)
+                return RespondWithPeer(respond)(nullptr, std::move(resp));
+            MakeRequestAsync(get_succ_req, *routing->predecessor_,
+                             RespondWithPeer(respond));
+        });
+    }
+}
+
+void Peer::GetSuccHandler(const Json::Value &request, Responder respond)
 {
     ValidateRequest(request);
+    std::optional<Key> client_id = CurrentClientId();
+    SetCurrentClientId(std::nullopt);
+
     Key key(request["KEY"].asString(), true);
-    PeerRepr succ = GetSuccessor(key);
-    Json::Value succ_json(succ);
-    succ_json["SUCCESS"] = true;
+    GetSuccessorAsync(key, client_id, std::move(respond),
+                      request["HOPS"].asInt());
+}
+
+struct Peer::IterativeLookup {
+    /// Key whose successor is sought.
+    Key key_;
+    /// Peers which have failed to answer, and must be routed around.
+    std::set<Key> failed_;
+    /// Hops which have answered so far, ending with the most recent.
+    std::vector<PeerRepr> path_;
+    /// Hops taken so far.
+    int hops_;
+    /// Called with the successor once it is found.
+    Responder respond_;
+};
+
+PeerRepr Peer::GetSuccessorIteratively(const Key &key)
+{
+    std::promise<Json::Value> succ;
+    GetSuccessorIterativelyAsync(key, [&succ](std::exception_ptr err,
+                                              Json::Value resp) {
+        if(err)
+            succ.set_exception(err);
+        else
+            succ.set_value(std::move(resp));
+    });
+    return PeerRepr(succ.get_future().get());
+}
+
+void Peer::GetSuccessorIterativelyAsync(const Key &key, Responder respond)
+{
+    auto lookup = std::make_shared<IterativeLookup>(IterativeLookup {
+            key, {}, { Routing()->self_ }, 0, std::move(respond)
+    });
+
+    Json::Value next_hop;
+    try {
+        next_hop = NextHop(key, lookup->failed_);
+    } catch(...) {
+        return lookup->respond_(std::current_exception(), Json::Value());
+    }
+    ContinueLookup(lookup, next_hop);
+}
+
+void Peer::ContinueLookup(const std::shared_ptr<IterativeLookup> &lookup,
+                          const Json::Value &next_hop)
+{
+    PeerRepr hop(next_hop["PEER"]);
+    if(next_hop["DONE"].asBool()) {
+        lookups_resolved_++;
+        lookup_hops_ += lookup->hops_;
+        return lookup->respond_(nullptr, Json::Value(hop));
+    }
+
+    if(lookup->hops_++ >= MAX_LOOKUP_HOPS)
+        return lookup->respond_(TooManyHops(lookup->key_), Json::Value());
+
+    AskNextHop(lookup, hop, [this, lookup, hop](std::exception_ptr err,
+                                                Json::Value resp) {
+        if(! err) {
+            lookup->path_.push_back(hop);
+            return ContinueLookup(lookup, resp);
+        }
 
-    current_client_id_.reset();
+        // Ask the last peer which answered for another route.
+        lookup->failed_.insert(hop.id_);
+        BacktrackLookup(lookup);
+    });
+}
 
-    return succ_json;
+void Peer::BacktrackLookup(const std::shared_ptr<IterativeLookup> &lookup)
+{
+    AskNextHop(lookup, lookup->path_.back(),
+               [this, lookup](std::exception_ptr err, Json::Value resp) {
+        if(! err)
+            return ContinueLookup(lookup, resp);
+
+        // If it has since failed as well, back up further.
+        if(lookup->path_.size() == 1)
+            return lookup->respond_(err, Json::Value());
+        lookup->failed_.insert(lookup->path_.back().id_);
+        lookup->path_.pop_back();
+        BacktrackLookup(lookup);
+    });
+}
+
+void Peer::AskNextHop(const std::shared_ptr<IterativeLookup> &lookup,
+                      const PeerRepr &hop, Responder on_answer)
+{
+    if(hop.id_ == id_) {
+        Json::Value next_hop;
+        try {
+            next_hop = NextHop(lookup->key_, lookup->failed_);
+        } catch(...) {
+            return on_answer(std::current_exception(), Json::Value());
+        }
+        return on_answer(nullptr, next_hop);
+    }
+
+    Json::Value next_hop_req;
+    next_hop_req["COMMAND"] = "GET_NEXT_HOP";
+    next_hop_req["KEY"] = std::string(lookup->key_);
+    next_hop_req["AVOID"] = Json::arrayValue;
+    for(const Key &id : lookup->failed_)
+        next_hop_req["AVOID"].append(std::string(id));
+
+    MakeRequestAsync(next_hop_req, hop,
+                     [on_answer = std::move(on_answer)]
+                     (std::exception_ptr err, Json::Value resp) {
+        if(! err && ! resp["SUCCESS"].asBool())
+            err = std::make_exception_ptr(
+                    std::runtime_error(resp["ERRORS"].asString()));
+        on_answer(err, std::move(resp));
+    });
+}
+
+Json::Value Peer::NextHop(const Key &key, const std::set<Key> &avoid)
+{
+    auto routing = Routing();
+    Json::Value next_hop;
+    if(key.InBetween(routing->self_.min_key_, id_, true)) {
+        next_hop["PEER"] = Json::Value(routing->self_);
+        next_hop["DONE"] = true;
+        return next_hop;
+    }
+
+    // Gather every peer we know of which may be chosen as the next hop.
+    std::vector<PeerRepr> known;
+    for(size_t i = 0; i < routing->successors_.Size(); i++)
+        known.push_back(routing->successors_.GetNthEntry(i));
+    for(const FingerRun &run : routing->finger_table_.GetRuns())
+        known.push_back(run.successor_);
+    if(routing->predecessor_.has_value())
+        known.push_back(*routing->predecessor_);
+    known.erase(std::remove_if(known.begin(), known.end(),
+                               [this, &avoid](const PeerRepr &peer) {
+                                   return peer.id_ == id_ ||
+                                          avoid.find(peer.id_) != avoid.end();
+                               }),
+                known.end());
+
+    // Our successor is the nearest of them clockwise (any nearer peers we
+    // have been told to avoid having failed). While peers are joining, the
+    // successor list may be incomplete or out of order, so we do not simply
+    // take its first entry. If key lies between us and our successor, then
+    // our successor owns it.
+    std::optional<PeerRepr> succ;
+    for(const PeerRepr &peer : known)
+        if(! succ.has_value() || peer.id_.InBetween(id_, succ->id_, false))
+            succ = peer;
+
+    if(succ.has_value() && key.InBetween(id_ + 1, succ->id_, true)) {
+        next_hop["PEER"] = Json::Value(*succ);
+        next_hop["DONE"] = true;
+        return next_hop;
+    }
+
+    // Otherwise, hand off to the closest peer we know of which strictly
+    // precedes key, so that every hop makes progress. The finger table's own
+    // choice (which accounts for latency) is preferred, but a stale finger
+    // may point past key, in which case the closest preceding peer is used.
+    auto usable = [this, &key, &avoid](const PeerRepr &peer) {
+        return peer.id_.InBetween(id_, key, false) &&
+               avoid.find(peer.id_) == avoid.end();
+    };
+
+    std::optional<PeerRepr> closest;
+    if(! routing->finger_table_.Empty()) {
+        PeerRepr finger = routing->finger_table_.Lookup(key);
+        if(usable(finger))
+            closest = finger;
+    }
+
+    if(! closest.has_value())
+        for(const PeerRepr &peer : known)
+            if(usable(peer) && (! closest.has_value() ||
+                                peer.id_.InBetween(closest->id_, key, false)))
+                closest = peer;
+
+    if(! closest.has_value())
+        throw std::runtime_error("No route to " + std::string(key) + ".");
+
+    next_hop["PEER"] = Json::Value(*closest);
+    next_hop["DONE"] = false;
+    return next_hop;
+}
+
+Json::Value Peer::GetNextHopHandler(const Json::Value &request)
+{
+    Key key(request["KEY"].asString(), true);
+    std::set<Key> avoid;
+    for(const auto &id : request["AVOID"])
+        avoid.emplace(id.asString(), true);
+
+    return NextHop(key, avoid);
 }
 
 std::vector<PeerRepr> Peer::GetNSuccessors(const Key &key, int n)
 {
     std::vector<PeerRepr> successors_list;
-    Key previous_peer_id = key;
+    if(n <= 0)
+        return successors_list;
+    const size_t count = size_t(n);
 
-    for(int i = 0; i < n; i++) {
-        PeerRepr ith_succ = GetSuccessor(previous_peer_id + 1);
-        successors_list.push_back(ith_succ);
+    PeerRepr first = GetSuccessor(key + 1);
+    successors_list.push_back(first);
+
+    // Rather than look up each successor in turn, take the rest from the
+    // first successor's own successor list. Its entries are only trusted
+    // while each follows the one before it around the ring.
+    std::vector<PeerRepr> succ_list;
+    try {
+        succ_list = GetSuccessorList(first);
+    } catch(...) {
+        // Fall back on individual lookups below.
+    }
+
+    for(const PeerRepr &succ : succ_list) {
+        if(successors_list.size() >= count)
+            break;
+
+        bool in_order = successors_list.size() == 1 ||
+                        succ.id_.InBetween(successors_list.back().id_,
+                                           first.id_, false);
+        if(! in_order)
+            break;
+        successors_list.push_back(succ);
+    }
+
+    // If the list was short or out of order, look up the remainder. A list
+    // which loops back around to the first successor may just be missing a
+    // newly-joined peer, so that too is confirmed by a lookup.
+    while(successors_list.size() < count) {
+        PeerRepr ith_succ = GetSuccessor(successors_list.back().id_ + 1);
 
         // Imagine if this method were called with n=5 in a chord comprised
         // of only 2 peers. In this case, it would not make sense to return
         // a vector alternating between the same two peers until it reaches
-        // 5 entries, so, when we "loop back around" to the first key,
-        // it's time to break and return a 2-entry vector.
-        if(previous_peer_id == key && i != 0) {
-            Log(std::string(previous_peer_id) + " == " + std::string(key));
+        // 5 entries, so, when we "loop back around" to the first successor,
+        // it's time to stop.
+        if(ith_succ.id_ == first.id_)
             break;
-        }
-
-        previous_peer_id = ith_succ.id_;
+        successors_list.push_back(ith_succ);
     }
 
     return successors_list;
 }
 
-PeerRepr Peer::GetPredecessor(const Key &key)
+std::vector<PeerRepr> Peer::GetSuccessorList(const PeerRepr &peer)
 {
-    if(! predecessor_.has_value()) {
-        PeerRepr *this_peer = this;
-        return *this_peer;
+    std::vector<PeerRepr> succ_list;
+    if(peer.id_ == id_) {
+        auto routing = Routing();
+        for(size_t i = 0; i < routing->successors_.Size(); i++)
+            succ_list.push_back(routing->successors_.GetNthEntry(i));
+        return succ_list;
     }
 
+    Json::Value get_succ_list_req;
+    get_succ_list_req["COMMAND"] = "GET_SUCC_LIST";
+    Json::Value get_succ_list_resp = MakeRequest(get_succ_list_req, peer);
+    if(! get_succ_list_resp["SUCCESS"].asBool())
+        throw std::runtime_error(get_succ_list_resp["ERRORS"].asString());
+
+    for(const auto &succ : get_succ_list_resp["SUCCESSORS"])
+        succ_list.emplace_back(succ);
+    return succ_list;
+}
+
+Json::Value Peer::GetSuccListHandler(const Json::Value &request)
+{
+    auto routing = Routing();
+    Json::Value resp;
+    resp["SUCCESSORS"] = Json::arrayValue;
+    for(size_t i = 0; i < routing->successors_.Size(); i++)
+        resp["SUCCESSORS"].append(
+                Json::Value(routing->successors_.GetNthEntry(i)));
+    return resp;
+}
+
+std::vector<PeerRepr> Peer::LocateReplicas(const Key &key, bool &cached)
+{
+    std::vector<PeerRepr> succs;
+    cached = location_cache_.Lookup(key, succs);
+    if(cached)
+        return succs;
+
+    succs = GetNSuccessors(key, NUM_REPLICAS);
+    if(succs.empty())
+        return succs;
+
+    // GetNSuccessors starts from the successor of key + 1, so the same list
+    // is shared by every key k such that k + 1 lies in the range of the first
+    // successor. That range is only trusted if it actually contains key + 1.
+    const PeerRepr &first = succs.front();
+    Key lower_bound = first.min_key_ - 1, upper_bound = first.id_ - 1;
+    if(! key.InBetween(lower_bound, upper_bound, true))
+        lower_bound = key;
+    location_cache_.Insert(lower_bound, upper_bound, succs);
+    return succs;
+}
+
+PeerRepr Peer::GetPredecessor(const Key &key)
+{
+    auto routing = Routing();
+    if(! routing->predecessor_.has_value())
+        return routing->self_;
+
     // If the key is stored locally, then its predecessor is this peer's predecessor.
-    if (StoredLocally(key))
-        return *predecessor_;
+    if (key.InBetween(routing->self_.min_key_, id_, true))
+        return *routing->predecessor_;
         // Otherwise, forward a request to the relevant peer.
     else {
         Json::Value get_pred_req;
@@ -565,16 +1404,38 @@ PeerRepr Peer::GetPredecessor(const Key &key)
     }
 }
 
-Json::Value Peer::GetPredHandler(const Json::Value &request)
+void Peer::GetPredecessorAsync(const Key &key,
+                               const std::optional<Key> &client_id,
+                               Responder respond, int hops)
+{
+    auto routing = Routing();
+    if(! routing->predecessor_.has_value())
+        return respond(nullptr, Json::Value(routing->self_));
+
+    // If the key is stored locally, then its predecessor is this peer's predecessor.
+    if (key.InBetween(routing->self_.min_key_, id_, true))
+        return respond(nullptr, Json::Value(*routing->predecessor_));
+
+    // Otherwise, forward a request to the relevant peer.
+    if(hops >= MAX_LOOKUP_HOPS)
+        return respond(TooManyHops(key), Json::Value());
+    Json::Value get_pred_req;
+    get_pred_req["COMMAND"] = "GET_PRED";
+    get_pred_req["KEY"] = std::string(key);
+    get_pred_req["HOPS"] = hops + 1;
+    ForwardRequestAsync(get_pred_req, key, client_id,
+                        RespondWithPeer(std::move(respond)));
+}
+
+void Peer::GetPredHandler(const Json::Value &request, Responder respond)
 {
     ValidateRequest(request);
-    Key key(request["KEY"].asString(), true);
-    PeerRepr pred = GetPredecessor(key);
-    Json::Value pred_json(pred);
-    pred_json["SUCCESS"] = true;
-    current_client_id_.reset();
+    std::optional<Key> client_id = CurrentClientId();
+    SetCurrentClientId(std::nullopt);
 
-    return pred_json;
+    Key key(request["KEY"].asString(), true);
+    GetPredecessorAsync(key, client_id, std::move(respond),
+                        request["HOPS"].asInt());
 }
 
 std::vector<PeerRepr> Peer::GetNPredecessors(const Key &key, int n)
@@ -621,52 +1482,110 @@ bool Peer::Create(const Key &key, const std::string &value)
 {
     // Encode value into a block comprised of data fragments.
     DataBlock block(value, true);
-    int num_replicas = 0;
-    std::vector<PeerRepr> succ_list = GetNSuccessors(key, NUM_REPLICAS);
+    bool cached;
+    std::vector<PeerRepr> succ_list = LocateReplicas(key, cached);
 
     // A minimum of ten replicas are needed to reconstruct the block.
     if(succ_list.size() < 10)
         return false;
 
-    for(int i = 0; i < block.fragments_.size(); i++) {
-        if(succ_list.at(i).id_ == id_) {
-            database_.Insert({ key, block.fragments_.at(i) });
-            num_replicas++;
+    // Send each fragment to its recipient at once, then note who stored
+    // one. Returns the indices of the fragments which went unstored.
+    std::set<Key> holders;
+    auto store = [this, &key, &block, &holders]
+                 (const std::vector<PeerRepr> &recipients,
+                  const std::vector<size_t> &frags) {
+        std::vector<std::future<bool>> stored;
+        for(size_t j = 0; j < frags.size(); j++) {
+            const DataFragment &fragment = block.fragments_.at(frags[j]);
+            if(recipients.at(j).id_ == id_) {
+                database_.Insert({ key, fragment });
+                stored.push_back(std::async(std::launch::deferred,
+                                            [] { return true; }));
+            }
+            else
+                stored.push_back(CreateFragment(recipients.at(j), key,
+                                                fragment));
         }
-        else
-            num_replicas += CreateFragment(succ_list.at(i), key,
-                                           block.fragments_.at(i));
+
+        std::vector<size_t> unstored;
+        for(size_t j = 0; j < frags.size(); j++) {
+            bool ok = false;
+            try {
+                ok = stored[j].get();
+            } catch(const std::exception &err) {
+                // The successor failed; the fragment simply goes unstored.
+            }
+            if(ok)
+                holders.insert(recipients[j].id_);
+            else
+                unstored.push_back(frags[j]);
+        }
+        return unstored;
+    };
+
+    std::vector<size_t> frags(block.fragments_.size());
+    for(size_t i = 0; i < frags.size(); i++)
+        frags[i] = i;
+    std::vector<size_t> unstored = store(succ_list, frags);
+
+    // If a cached successor list has gone stale, look the successors up
+    // afresh and send the unstored fragments, once, to those which do not
+    // already hold one. Those which do would only refuse a second.
+    if(holders.size() < 10 && cached) {
+        location_cache_.Invalidate(key);
+        std::vector<PeerRepr> recipients;
+        for(const PeerRepr &succ : LocateReplicas(key, cached))
+            if(recipients.size() < unstored.size() &&
+               holders.count(succ.id_) == 0)
+                recipients.push_back(succ);
+        unstored.resize(recipients.size());
+        store(recipients, unstored);
     }
 
     // If at least 10 peers succesfully stored fragments, then the block can
     // be reconstructed by messaging them.
-    return num_replicas >= 10;
+    return holders.size() >= 10;
 }
 
 DataBlock Peer::Read(const Key &key)
 {
-    std::vector<PeerRepr> succ_list = GetNSuccessors(key, NUM_REPLICAS);
+    bool cached;
+    std::vector<PeerRepr> succ_list = LocateReplicas(key, cached);
     std::set<DataFragment> fragments;
 
-    for(const auto &succ : succ_list) {
-        if(fragments.size() == 10)
-            break;
+    // Ask as many successors at once as there are fragments still needed.
+    // If the key is not stored on some of them (or they have failed),
+    // ReadFragment yields an error, and the next successors are asked in
+    // their place.
+    size_t next_succ = 0;
+    while(fragments.size() < 10 && next_succ < succ_list.size()) {
+        std::vector<std::future<DataFragment>> reads;
+        for(; next_succ < succ_list.size() &&
+              fragments.size() + reads.size() < 10; next_succ++) {
+            const PeerRepr &succ = succ_list.at(next_succ);
+            if(succ.id_ != id_)
+                reads.push_back(ReadFragment(succ, key));
+            else if(database_.Contains(key))
+                fragments.insert(database_.Lookup(key));
+        }
 
-        if(succ.id_ == id_ && database_.Contains(key))
-            fragments.insert(database_.Lookup(key));
-        else {
+        for(auto &read : reads) {
             try {
-                fragments.insert(ReadFragment(succ, key));
-            }
-                // If the key is not stored on the frag we message, ReadFrag
-                // will throw an error. The solution is simply to message the
-                // next frag.
-            catch(const std::exception &err) {
+                fragments.insert(read.get());
+            } catch(const std::exception &err) {
                 continue;
             }
         }
     }
 
+    // If a cached successor list has gone stale, look the successors up
+    // afresh and try again.
+    if(fragments.size() < 10 && cached) {
+        location_cache_.Invalidate(key);
+        return Read(key);
+    }
+
     // A minimum of ten fragments are needed to reconstruct a data block.
     if(fragments.size() < 10)
         throw std::runtime_error("Less than 10 distinct frags.");
@@ -675,19 +1594,26 @@ DataBlock Peer::Read(const Key &key)
                                                fragments.end()));
 }
 
-bool Peer::CreateFragment(const PeerRepr &recipient, const Key &key,
-                          const DataFragment& fragment)
+std::future<bool> Peer::CreateFragment(const PeerRepr &recipient,
+                                       const Key &key,
+                                       const DataFragment& fragment)
 {
-    if(recipient.id_ == current_client_id_ || recipient.id_ == id_)
-        return false;
+    if(recipient.id_ == CurrentClientId() || recipient.id_ == id_)
+        return std::async(std::launch::deferred, [] { return false; });
 
     Json::Value create_frag_req;
     create_frag_req["COMMAND"] = "CREATE_FRAG";
     create_frag_req["KEY"] = std::string(key);
-    create_frag_req["FRAGMENT"] = std::string(fragment);
-
-    Json::Value create_frag_resp = MakeRequest(create_frag_req, recipient);
-    return create_frag_resp["SUCCESS"].asBool();
+    create_frag_req["FRAGMENT"] = Json::Value(fragment);
+
+    // Deferred, so the response is interpreted by whoever waits on it
+    // rather than on a thread of its own.
+    return std::async(std::launch::deferred,
+                      [create_frag_resp = MakeRequestAsync(create_frag_req,
+                                                           recipient)]
+                      () mutable {
+        return create_frag_resp.get()["SUCCESS"].asBool();
+    });
 }
 
 Json::Value Peer::CreateFragmentHandler(const Json::Value &request)
@@ -701,22 +1627,28 @@ Json::Value Peer::CreateFragmentHandler(const Json::Value &request)
     if(database_.Contains(key))
         throw std::runtime_error("Key already in db.");
 
-    DataFragment frag(request["FRAGMENT"].asString());
+    DataFragment frag(request["FRAGMENT"]);
     database_.Insert({ key, frag });
-    current_client_id_.reset();
+    SetCurrentClientId(std::nullopt);
     return resp;
 }
 
-DataFragment Peer::ReadFragment(const PeerRepr &recipient, const Key &key)
+std::future<DataFragment> Peer::ReadFragment(const PeerRepr &recipient,
+                                             const Key &key)
 {
     Json::Value read_frag_req;
     read_frag_req["COMMAND"] = "READ_FRAG";
     read_frag_req["KEY"] = std::string(key);
 
-    Json::Value read_frag_resp = MakeRequest(read_frag_req, recipient);
-    if(read_frag_resp["SUCCESS"].asBool())
-        return DataFragment(read_frag_resp["FRAGMENT"].asString());
-    throw std::runtime_error(read_frag_resp["ERRORS"].asString());
+    return std::async(std::launch::deferred,
+                      [read_frag_resp = MakeRequestAsync(read_frag_req,
+                                                         recipient)]
+                      () mutable {
+        Json::Value resp = read_frag_resp.get();
+        if(resp["SUCCESS"].asBool())
+            return DataFragment(resp["FRAGMENT"]);
+        throw std::runtime_error(resp["ERRORS"].asString());
+    });
 }
 
 Json::Value Peer::ReadFragmentHandler(const Json::Value &request) {
@@ -724,10 +1656,10 @@ Json::Value Peer::ReadFragmentHandler(const Json::Value &request) {
     Key key(request["KEY"].asString(), true);
     Json::Value resp;
     if (database_.Contains(key)) {
-        resp["FRAGMENT"] = std::string(database_.Lookup(key));
-        current_client_id_.reset();
+        resp["FRAGMENT"] = Json::Value(database_.Lookup(key));
+        SetCurrentClientId(std::nullopt);
         return resp;
     }
-    current_client_id_.reset();
+    SetCurrentClientId(std::nullopt);
     throw std::runtime_error("Fragment not stored locally.");
 }
\ No newline at end of file
@@ -9,19 +9,83 @@
 #ifndef CHORD_FINAL_PEER_H
 #define CHORD_FINAL_PEER_H
 #define NUM_REPLICAS 14
+#define LOOKUP_FAN_OUT 8
+#define STABILIZE_PERIOD_MS 500
+#define STABILIZE_JITTER_MS 100
+#define LOCATION_CACHE_SIZE 1024
+#define LOCATION_CACHE_TTL_MS 5000
+#define MAX_LOOKUP_HOPS 64
+#define SERVER_THREADS 4
 
 #include <boost/uuid/uuid.hpp>
 #include <string>
 #include <json/json.h>
 #include <vector>
 #include <map>
+#include <set>
+#include <optional>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <future>
+#include <condition_variable>
 #include "peer_repr.h"
 #include "finger_table.h"
+#include "location_cache.h"
 #include "server.h"
 #include "client.h"
+#include "local_transport.h"
+#include "transport.h"
 #include "database.h"
 #include "data_block.h"
 
+/**
+ * How a peer resolves the successor of a key it does not own.
+ */
+enum class LookupMode {
+    /// Each hop forwards the request to the next and relays its answer back.
+    RECURSIVE,
+    /// The originator asks each hop for the next one and contacts it itself,
+    /// so intermediate peers answer from local state without blocking.
+    ITERATIVE
+};
+
+/**
+ * A consistent view of a peer's routing state. Snapshots are never modified
+ * once published: lookups and request handlers read whichever snapshot is
+ * current without taking a lock, while stabilization and notifications copy
+ * it, modify the copy and publish that in its place.
+ */
+struct RoutingState {
+    /// This peer, with min_key_ set to the lowest key it stores. The min_key_
+    /// a Peer inherits from PeerRepr is only the one it was constructed with;
+    /// this is the current one.
+    PeerRepr self_;
+
+    /// The peer directly preceding this one in the chord ring.
+    std::optional<PeerRepr> predecessor_;
+
+    /// The peers directly succeeding this one in the chord ring.
+    PeerList successors_;
+
+    /// Maps keys to their successors to aid lookups.
+    FingerTable finger_table_;
+};
+
+/**
+ * Counts of the iterative lookups a peer has resolved, and of the peers they
+ * asked along the way.
+ */
+struct LookupStats {
+    /// Lookups which found their key's successor.
+    uint64_t lookups_;
+    /// Requests for a next hop sent by those lookups.
+    uint64_t hops_;
+};
+
 /**
  * The class "Peer" represents a locally-run peer in a P2P system.
  * It refers specifically to a peer being run on this machine,
@@ -29,7 +93,10 @@
  * any peer in the chord.
  * An instance of "Peer" should run three threads:
  *    - A client thread, which makes requests to other peers.
- *    - A server thread, which responds to requests from other peers.
+ *    - Server threads (SERVER_THREADS of them, by default), which respond
+ *      to requests from other peers concurrently. Handlers which must ask
+ *      other peers in turn (i.e. lookups) are asynchronous, so they do not
+ *      hold a server thread while they wait.
  *    - A stabilization thread, which updates finger table entries.
  */
 class Peer : public PeerRepr {
@@ -40,13 +107,30 @@ public:
     /// Typedef denoting a member func which takes a JSON request and yields a JSON response.
     typedef std::_Mem_fn<Json::Value (Peer::*)(const Json::Value &)> RequestHandler;
 
+    /// Typedef denoting a member func which takes a JSON request and answers
+    /// it through a Responder, possibly after returning.
+    typedef std::_Mem_fn<void (Peer::*)(const Json::Value &, Responder)>
+            AsyncRequestHandler;
+
     /**
      * Construct peer at [IP_ADDR]:[PORT].
      *
      * @param ip_addr IP address of
      * @param port
+     * @param num_server_threads Number of threads on which to handle
+     *                           requests from other peers.
+     * @param transport Transport over which to send and receive requests
+     *                  instead of TCP (e.g. a SimulatedTransport), or null to
+     *                  listen on a TCP port. It must outlive the peer.
      */
-    Peer(const char *ip_addr, int port);
+    Peer(const char *ip_addr, int port, int num_server_threads = SERVER_THREADS,
+         Transport *transport = nullptr);
+
+    /**
+     * Stop the stabilizer, if it is running, and the server, so that no
+     * request is handled once the peer is gone.
+     */
+    ~Peer();
 
     /**
      * Simple destructor for peer to free ptrs.
@@ -93,31 +177,187 @@ public:
      */
     DataBlock Read(const Key &key);
 
+    /**
+     * Set the maximum number of lookups issued concurrently when populating
+     * the finger table.
+     *
+     * @param fan_out Maximum concurrent lookups (at least 1).
+     */
+    void SetLookupFanOut(int fan_out);
+
+    /**
+     * Set how this peer resolves successors of keys it does not own.
+     *
+     * @param mode Recursive or iterative lookups (recursive by default).
+     */
+    void SetLookupMode(LookupMode mode);
+
+    /**
+     * Start (or restart) the stabilizer with the given schedule. Each tick
+     * refreshes one finger and checks one successor, and consecutive ticks
+     * are separated by period +/- a uniformly random jitter, so that peers
+     * which joined together do not stabilize in lockstep.
+     *
+     * @param period Mean time between ticks.
+     * @param jitter Maximum deviation from period (less than period).
+     */
+    void StartStabilizer(std::chrono::milliseconds period,
+                         std::chrono::milliseconds jitter);
+
+    /**
+     * Stop the stabilizer and wait for any tick in progress to finish.
+     */
+    void StopStabilizer();
+
+    /**
+     * Get the cache of successor lists used by Create and Read, e.g. to
+     * inspect its hit and miss counters.
+     *
+     * @return Location cache.
+     */
+    const LocationCache &GetLocationCache() const;
+
+    /**
+     * Resolve the successor of a key, as Create and Read do.
+     *
+     * @param key The hashed key in question.
+     * @return A representation of the peer which directly succeeds it.
+     */
+    PeerRepr FindSuccessor(const Key &key);
+
+    /**
+     * Get the current routing snapshot, e.g. to check that the ring has
+     * converged.
+     *
+     * @return Current routing state.
+     */
+    std::shared_ptr<const RoutingState> GetRoutingState() const;
+
+    /**
+     * Get counts of the iterative lookups this peer has resolved.
+     *
+     * @return Lookup counters.
+     */
+    LookupStats GetLookupStats() const;
+
 private:
 	/// Mapping of keys to fragments.
     Database database_;
 
-    /// The peer directly preceding this one in the chord ring.
-    std::optional<PeerRepr> predecessor_;
+    /// Current routing snapshot. Always accessed through std::atomic_load
+    /// and std::atomic_store; see Routing() and UpdateRouting().
+    std::shared_ptr<const RoutingState> routing_;
 
-    /// The peers directly succeeding this one in the chord ring.
-    PeerList successors_;
+    /// Serializes updates to routing_ (reads take no lock).
+    std::mutex routing_mutex_;
 
-    /// Maps keys to their successors to aid lookups.
-    FingerTable *finger_table_;
+    /// Successor lists recently resolved by Create and Read.
+    LocationCache location_cache_;
+
+    /// Latencies measured to the peers this one has asked, from which each
+    /// routing snapshot's finger table chooses faster routes.
+    LatencyTable latencies_;
 
     /// Server to be run locally.
-    Server<RequestHandler, Peer> *server_;
+    std::unique_ptr<Server<RequestHandler, Peer>> server_;
 
     /// Makes requests to servers of other peers.
-    Client *client_;
+    std::unique_ptr<Client> client_;
 
-	/// ID of the peer currently connected to our server.
-	std::optional<Key> current_client_id_;
+    /// Transport on which server_ answers requests without TCP.
+    Transport *transport_;
 
-	/// Thread that runs maintenance in the background.
+    /// Counters behind GetLookupStats().
+    std::atomic<uint64_t> lookups_resolved_;
+    std::atomic<uint64_t> lookup_hops_;
+
+	/// ID of the peer whose request each server thread is handling. Requests
+	/// are handled on several threads at once, so each has its own entry;
+	/// see CurrentClientId() and SetCurrentClientId().
+	std::map<std::thread::id, Key> current_client_ids_;
+	mutable std::mutex current_client_ids_mutex_;
+
+	/// Thread that runs maintenance in the background, whether started by
+	/// StartChord or by a MAINTENANCE request; see StartMaintenance().
     std::thread maintenance_thread_;
 
+	/// Guards maintenance_thread_ and the flags below, and wakes maintenance
+	/// waiting to begin when the peer is torn down.
+	std::mutex maintenance_mutex_;
+	std::condition_variable maintenance_cv_;
+
+	/// Whether maintenance_thread_ has yet to finish.
+	bool maintenance_running_;
+
+	/// Whether maintenance was asked for again while a run was under way.
+	bool maintenance_requested_;
+
+	/// Set once the peer is torn down; no maintenance starts after.
+	bool maintenance_stopped_;
+
+	/// Maximum number of concurrent lookups when populating finger table.
+	/// Atomic, since it may be changed while handlers are running.
+	std::atomic<int> lookup_fan_out_;
+
+	/// Whether successor lookups are resolved recursively or iteratively.
+	/// Atomic, since it may be changed while handlers are running.
+	std::atomic<LookupMode> lookup_mode_;
+
+	/// Thread that runs the stabilizer, one tick at a time.
+	std::thread stabilizer_thread_;
+
+	/// Guards stabilizer_running_ and wakes the stabilizer when stopped.
+	std::mutex stabilizer_mutex_;
+	std::condition_variable stabilizer_cv_;
+	bool stabilizer_running_;
+
+	/// Index of the next finger to refresh and successor to check.
+	int next_finger_;
+	int next_successor_;
+
+	/**
+	 * Get the current routing snapshot. Callers should fetch it once and use
+	 * it throughout, so that they see a single consistent view.
+	 *
+	 * @return Current routing state.
+	 */
+	std::shared_ptr<const RoutingState> Routing() const;
+
+	/**
+	 * Apply a change to the routing state: copy the current snapshot, let
+	 * update modify the copy, choose its finger table's proximate peers from
+	 * the latest latencies, and publish it. Updates are serialized, so
+	 * update always sees every earlier change; it should not block (e.g. on
+	 * a request to another peer).
+	 *
+	 * @param update Function modifying the new snapshot.
+	 */
+	void UpdateRouting(const std::function<void(RoutingState &)> &update);
+
+	/**
+	 * Stop routing through a peer which failed to answer: drop it from the
+	 * location cache and the latency measurements, and publish a snapshot
+	 * which no longer prefers it.
+	 *
+	 * @param id ID of the peer.
+	 */
+	void ForgetPeer(const Key &id);
+
+	/**
+	 * Get the ID of the peer whose request the calling thread is handling.
+	 *
+	 * @return ID of peer, or nothing if not handling a request.
+	 */
+	std::optional<Key> CurrentClientId() const;
+
+	/**
+	 * Record the ID of the peer whose request the calling thread is
+	 * handling, or clear it.
+	 *
+	 * @param id ID of peer, or nothing once the request has been handled.
+	 */
+	void SetCurrentClientId(const std::optional<Key> &id);
+
 	/**
 	 * Output formatted text to terminal.
 	 * @param str String to format.
@@ -133,6 +373,27 @@ private:
 	 */
 	Json::Value MakeRequest(Json::Value request, const PeerRepr &peer);
 
+	/**
+	 * Send request to the given peer without waiting for the response.
+	 *
+	 * @param request Request to send.
+	 * @param peer Peer to send it to.
+	 * @return Future holding the response from peer.
+	 */
+	std::future<Json::Value> MakeRequestAsync(Json::Value request,
+	                                          const PeerRepr &peer);
+
+	/**
+	 * Send request to the given peer, calling handler with the response.
+	 *
+	 * @param request Request to send.
+	 * @param peer Peer to send it to.
+	 * @param handler Called with the response from peer. It should not
+	 *                block (see Client::ResponseHandler).
+	 */
+	void MakeRequestAsync(Json::Value request, const PeerRepr &peer,
+	                      Client::ResponseHandler handler);
+
 	/**
 	 * Log certain peer as our current client, make sure that peer is who
 	 * they claim to be before answering request and that we are intended
@@ -171,15 +432,32 @@ private:
      */
     Json::Value ForwardRequest(const Json::Value &request, const Key &key);
 
+	/**
+	 * Forward a request as ForwardRequest does, calling handler with the
+	 * response rather than waiting for it.
+	 *
+	 * @param request Request to forward.
+	 * @param key The key to which the request corresponds.
+	 * @param client_id ID of the peer on whose behalf the request is
+	 *                  forwarded, if any.
+	 * @param handler Called with the response given by the relevant peer.
+	 */
+	void ForwardRequestAsync(const Json::Value &request, const Key &key,
+	                         const std::optional<Key> &client_id,
+	                         Client::ResponseHandler handler);
+
     /// Under ideal conditions, the nth fragment of a given key is stored on
     /// the nth successor of that key. The immediate successor of that key
     /// will receive requests to CRUD keys and will do so by put/get-ing fragments
     /// stored on its successors. These functions issue and handle these
-    /// requests for each CRUD op.
-    bool CreateFragment(const PeerRepr &recipient, const Key &key,
-                        const DataFragment &fragment);
+    /// requests for each CRUD op. Requests are sent immediately and their
+    /// results collected from the returned futures, so that a block's
+    /// fragments can be put/got from all of its successors at once.
+    std::future<bool> CreateFragment(const PeerRepr &recipient, const Key &key,
+                                     const DataFragment &fragment);
     Json::Value CreateFragmentHandler(const Json::Value &request);
-	DataFragment ReadFragment(const PeerRepr &recipient, const Key &key);
+	std::future<DataFragment> ReadFragment(const PeerRepr &recipient,
+	                                       const Key &key);
     Json::Value ReadFragmentHandler(const Json::Value &request);
 
     /**
@@ -191,14 +469,133 @@ private:
     PeerRepr GetSuccessor(const Key &key);
 
 	/**
-	 * Retrieve the n peers succeeding a given key.
+	 * Resolve the successor of a key iteratively: ask each hop in turn for
+	 * the next, starting from our own routing state. If a hop fails to
+	 * respond, the last responsive hop is asked again, this time to route
+	 * around the failed peer.
+	 *
+	 * @param key The hashed key in question.
+	 * @return A representation of the peer which directly succeeds it.
+	 */
+	PeerRepr GetSuccessorIteratively(const Key &key);
+
+	/**
+	 * Get the successor of a key as GetSuccessor does, without blocking.
+	 *
+	 * @param key The hashed key in question.
+	 * @param client_id ID of the peer on whose behalf the lookup is made, if
+	 *                  any.
+	 * @param respond Called with the JSON representation of the successor.
+	 * @param hops Times a recursive lookup has been forwarded so far. One
+	 *             forwarded MAX_LOOKUP_HOPS times fails, since it is most
+	 *             likely going round in circles while the ring is in flux.
+	 */
+	void GetSuccessorAsync(const Key &key, const std::optional<Key> &client_id,
+	                       Responder respond, int hops = 0);
+
+	/**
+	 * Progress of an iterative lookup, carried from one hop to the next.
+	 */
+	struct IterativeLookup;
+
+	/**
+	 * Resolve the successor of a key iteratively (see GetSuccessorIteratively)
+	 * without blocking.
+	 *
+	 * @param key The hashed key in question.
+	 * @param respond Called with the JSON representation of the successor.
+	 */
+	void GetSuccessorIterativelyAsync(const Key &key, Responder respond);
+
+	/**
+	 * Act on the answer of the latest hop of an iterative lookup: finish if it
+	 * named the successor, otherwise ask the hop it named.
+	 *
+	 * @param lookup Lookup in progress.
+	 * @param next_hop Answer of the latest hop, as given by NextHop.
+	 */
+	void ContinueLookup(const std::shared_ptr<IterativeLookup> &lookup,
+	                    const Json::Value &next_hop);
+
+	/**
+	 * Ask the last responsive hop of an iterative lookup for another route,
+	 * backing up further along the path while hops fail.
+	 *
+	 * @param lookup Lookup in progress.
+	 */
+	void BacktrackLookup(const std::shared_ptr<IterativeLookup> &lookup);
+
+	/**
+	 * Ask a single hop of an iterative lookup for the next one.
+	 *
+	 * @param lookup Lookup in progress.
+	 * @param hop Peer to ask (possibly us).
+	 * @param on_answer Called with its answer, as given by NextHop.
+	 */
+	void AskNextHop(const std::shared_ptr<IterativeLookup> &lookup,
+	                const PeerRepr &hop, Responder on_answer);
+
+	/**
+	 * Determine, from local state alone, the next hop towards the successor
+	 * of a key. If we or our first live successor own the key, that peer is
+	 * its successor; otherwise the finger table picks a peer preceding it.
+	 *
+	 * @param key The hashed key in question.
+	 * @param avoid IDs of peers known to have failed, which are not chosen.
+	 * @return JSON object with "PEER", the next hop, and "DONE", whether
+	 *         that peer is the successor of key.
+	 */
+	Json::Value NextHop(const Key &key, const std::set<Key> &avoid);
+
+	/**
+	 * Handle a request for the next hop towards a key's successor. Unlike
+	 * GetSuccHandler, this never contacts another peer.
+	 *
+	 * @param request A request specifying a key and peers to avoid.
+	 * @return A response as given by NextHop.
+	 */
+	Json::Value GetNextHopHandler(const Json::Value &request);
+
+	/**
+	 * Retrieve the n peers succeeding a given key. Only the first is looked
+	 * up; the rest are taken from its successor list, fetched in a single
+	 * request, and looked up one by one only if that list falls short.
 	 *
 	 * @param key The key whose successors should be listed.
 	 * @param n The number of successors in the vector.
-	 * @return A vector of size n containing the n successors of key.
+	 * @return A vector of (at most, in rings of fewer than n peers) size n
+	 *         containing the n successors of key.
 	 */
 	std::vector<PeerRepr> GetNSuccessors(const Key &key, int n);
 
+	/**
+	 * Fetch a peer's successor list in one request (or from our own routing
+	 * state, if the peer is us).
+	 *
+	 * @param peer Peer whose successors should be listed.
+	 * @return Successors of peer, nearest first.
+	 */
+	std::vector<PeerRepr> GetSuccessorList(const PeerRepr &peer);
+
+	/**
+	 * Handle a request for this peer's successor list.
+	 *
+	 * @param request A request for our successors.
+	 * @return A response whose "SUCCESSORS" field lists them, nearest first.
+	 */
+	Json::Value GetSuccListHandler(const Json::Value &request);
+
+	/**
+	 * Retrieve the NUM_REPLICAS peers succeeding a key, from the location
+	 * cache if a live entry covers it, else through GetNSuccessors (caching
+	 * the result).
+	 *
+	 * @param key The key whose successors should be listed.
+	 * @param cached Set to whether the list came from the cache.
+	 * @return The successors of key.
+	 */
+	std::vector<PeerRepr> LocateReplicas(const Key &key, bool &cached);
+
     /**
      * Return a representation of the peer which precedes [key].
      * Key may refer to either a key or the id of a peer.
@@ -208,6 +605,20 @@ private:
      */
     PeerRepr GetPredecessor(const Key &key);
 
+	/**
+	 * Get the predecessor of a key as GetPredecessor does, without blocking.
+	 *
+	 * @param key The hashed key in question.
+	 * @param client_id ID of the peer on whose behalf the lookup is made, if
+	 *                  any.
+	 * @param respond Called with the JSON representation of the predecessor.
+	 * @param hops Times the request has been forwarded so far; see
+	 *             GetSuccessorAsync.
+	 */
+	void GetPredecessorAsync(const Key &key,
+	                         const std::optional<Key> &client_id,
+	                         Responder respond, int hops = 0);
+
 	/**
 	 * Get N predecessors of key.
 	 * @param key Key whose predecessors will be found.
@@ -220,9 +631,9 @@ private:
      * Interpret a peer's request to join.
      *
      * @param request JSON request sent by peer requesting to join.
-     * @return Response to be sent to requesting peer.
+     * @param respond Called with the response to be sent to requesting peer.
      */
-    Json::Value JoinHandler(const Json::Value &request);
+    void JoinHandler(const Json::Value &request, Responder respond);
 
     /**
      * Given a JSON request asking to heave, handle this leave.
@@ -243,28 +654,61 @@ private:
      * Handle a request to identify a key's successor.
      *
      * @param request A request specifying a key.
-     * @return A response indicating its successor.
+     * @param respond Called with a response indicating its successor.
      */
-    Json::Value GetSuccHandler(const Json::Value &request);
+    void GetSuccHandler(const Json::Value &request, Responder respond);
 
     /**
      * Handle a request to identify a key's predecessor.
      *
      * @param request A request specifying a key.
-     * @return A response indicating its predecessor.
+     * @param respond Called with a response indicating its predecessor.
      */
-    Json::Value GetPredHandler(const Json::Value &request);
+    void GetPredHandler(const Json::Value &request, Responder respond);
 
-    /**
-     * Assess validity of finger table entries and successor list.
-     */
-    void Stabilize();
+	/**
+	 * Run a single stabilizer tick: refresh the next finger in turn, then
+	 * check the next successor in turn.
+	 */
+	void StabilizeTick();
+
+	/**
+	 * Refresh the next finger in turn by asking its successor for its
+	 * predecessor, which replaces the successor if it is closer to the
+	 * finger's lower bound. Falls back to a full lookup if the successor
+	 * has failed.
+	 */
+	void FixNextFinger();
+
+	/**
+	 * Check the next successor in turn. The immediate successor is asked for
+	 * its predecessor, which we adopt if it lies between us, and is notified
+	 * of our presence. Any other successor is pinged; a dead one is dropped
+	 * and the list is refilled from the end.
+	 */
+	void CheckNextSuccessor();
 
 	/**
-	 * Stabilize, run local maintenance, run global maintenance.
+	 * Run local maintenance and global maintenance, then pass the request on
+	 * to our successor. Routing state is kept by the stabilizer instead.
 	 */
 	void RunGeneralMaintenance();
 
+	/**
+	 * Run general maintenance on maintenance_thread_. If a run is already
+	 * under way, another follows it instead. Nothing starts once the peer
+	 * has been torn down.
+	 *
+	 * @param delay Time to wait before starting, cut short if the peer is
+	 *              torn down meanwhile.
+	 */
+	void StartMaintenance(std::chrono::milliseconds delay);
+
+	/**
+	 * Keep maintenance from starting again, and wait for any run under way.
+	 */
+	void StopMaintenance();
+
 	/**
 	 * If another peer tells us that we need to run maintenance (could happen
 	 * in a variety of circumstances), do so.
@@ -334,7 +778,9 @@ private:
 	Json::Value NotifyHandler(const Json::Value &request);
 
 	/**
-	 * Get successors of all appropriate finger table ranges.
+	 * Get successors of all appropriate finger table ranges. Fingers known
+	 * to share a successor are settled by a single lookup, and the remaining
+	 * lookups are issued concurrently, up to lookup_fan_out_ at a time.
 	 *
 	 * @param initialize Are we updating or creating table entries?
 	 */
@@ -1,6 +1,7 @@
 #include "peer_repr.h"
 
 #include <utility>
+#include <algorithm>
 
 PeerRepr::PeerRepr(Key id, Key min_key, Key max_key, std::string ip_addr,
                    int port)
@@ -105,19 +106,30 @@ bool PeerList::Insert(const PeerRepr &new_peer)
 	return false;
 }
 
-PeerRepr PeerList::GetNthEntry(int n)
+bool PeerList::Remove(const Key &id)
+{
+    auto it = std::find_if(peers_.begin(), peers_.end(),
+                           [&id](const PeerRepr &peer) { return peer.id_ == id; });
+    if(it == peers_.end())
+        return false;
+
+    peers_.erase(it);
+    return true;
+}
+
+PeerRepr PeerList::GetNthEntry(int n) const
 {
     auto it = peers_.begin();
     std::advance(it, n);
     return *it;
 }
 
-unsigned long PeerList::Size()
+unsigned long PeerList::Size() const
 {
     return peers_.size();
 }
 
-std::vector<PeerRepr> PeerList::SortByLatency()
+std::vector<PeerRepr> PeerList::SortByLatency() const
 {
     std::vector<PeerRepr> peers_by_latency = peers_;
     std::sort(peers_by_latency.begin(), peers_by_latency.end(),
@@ -7,8 +7,7 @@
  *     with their positioning in the chord.
  * It should also implement a method to sort PeerReprs by a field "latency"
  * which represents the average time the peer takes to respond to requests.
- * TO DO:
- *   - Edit relevant client code to favor less latent peers.
+ * (FingerTable uses this field to favor less latent peers when routing.)
  */
 
 #ifndef CHORD_FINAL_PEER_REPR_H
@@ -106,11 +105,18 @@ public:
 	 */
     bool Insert(const PeerRepr &new_peer);
 
-    PeerRepr GetNthEntry(int n);
+	/**
+	 * Remove the peer with the given ID from the set, if present.
+	 * @param id ID of the peer to remove.
+	 * @return Was a peer removed?
+	 */
+	bool Remove(const Key &id);
+
+    PeerRepr GetNthEntry(int n) const;
 
-    unsigned long Size();
+    unsigned long Size() const;
 
-	std::vector<PeerRepr> SortByLatency();
+	std::vector<PeerRepr> SortByLatency() const;
 
 private:
     int max_entries_;
@@ -1,5 +1,7 @@
 #ifndef SERVER_H_CHORD_FINAL
 #define SERVER_H_CHORD_FINAL
+#define SESSION_MAX_IN_FLIGHT 64
+#define SESSION_POOLED_BODY_BYTES 65536
 /**
  * server.h
  *
@@ -25,35 +27,345 @@
  *      - Server  : To accept multiple connections with multiple clients and
  *                  create/run new sessions for each of them.
  *
+ * A server may run its io_context on several threads. Each session reads and
+ * writes on a strand of its own, but hands requests off to be handled on any
+ * of the server's threads, so requests are handled in parallel even when a
+ * client multiplexes them over a single connection. Handlers must therefore be
+ * safe to call concurrently.
+ *
+ * A server may also answer requests made from within the same process
+ * directly, without a connection (see Server::Dispatch and local_transport.h).
+ *
  * Due to undefined behavior of the berkeley sockets API (sys/sockets.h),
  * I have chosen to implement network IO through the boost::asio library.
  */
 
+#include "message_frame.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <optional>
+#include <string_view>
 #include <utility>
 #include <boost/asio.hpp>
 #include <boost/system/error_code.hpp>
 #include <json/json.h>
 #include <chrono>
 #include <deque>
+#include <thread>
+#include <vector>
 
 using boost::asio::ip::tcp;
 using boost::system::error_code;
 
+/**
+ * Continuation through which an asynchronous handler answers a request: with
+ * an error, or with a response (err being null). Only the first call counts.
+ */
+typedef std::function<void(std::exception_ptr err, Json::Value response)>
+        Responder;
+
+/**
+ * Build the response sent to a client from a handler's result: its response
+ * marked successful, or its error.
+ *
+ * @param err Error raised by the handler, if any.
+ * @param response Response from the handler, if there was no error.
+ * @return Response to send.
+ */
+inline Json::Value MakeResponse(std::exception_ptr err, Json::Value response)
+{
+    if (!err) {
+        response["SUCCESS"] = true;
+        return response;
+    }
+
+    Json::Value error_resp;
+    error_resp["SUCCESS"] = false;
+    try {
+        std::rethrow_exception(err);
+    } catch (const std::exception &ex) {
+        error_resp["ERRORS"] = std::string(ex.what());
+    } catch (...) {
+        error_resp["ERRORS"] = "Unknown error.";
+    }
+    return error_resp;
+}
+
+/**
+ * Answers a request handed to Server::Dispatch exactly once: with the
+ * handler's response if it runs, or, should the work posted for it be
+ * destroyed unrun (as it is when a killed server's io_context goes), with an
+ * error, so that the client is not left waiting.
+ */
+class DispatchGuard {
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param respond Called with the response, or with an error.
+	 */
+    explicit DispatchGuard(Responder respond)
+        : respond_(std::move(respond))
+        , responded_(false)
+    {}
+
+    DispatchGuard(const DispatchGuard &) = delete;
+    DispatchGuard &operator=(const DispatchGuard &) = delete;
+
+	/**
+	 * Destructor. Answer the request with an error if it was never answered.
+	 */
+    ~DispatchGuard()
+    {
+        Respond(std::make_exception_ptr(
+                std::runtime_error("Server killed.")), Json::Value());
+    }
+
+	/**
+	 * Answer the request, unless it has been answered already.
+	 *
+	 * @param err Error, if any.
+	 * @param response Response, if there was no error.
+	 */
+    void Respond(std::exception_ptr err, Json::Value response)
+    {
+        if (!responded_.exchange(true))
+            respond_(err, std::move(response));
+    }
+
+private:
+	/// Called with the response, or with an error.
+    Responder respond_;
+	/// Whether respond_ has been called.
+    std::atomic<bool> responded_;
+};
+
+/**
+ * The "CommandTable" class maps command names to handlers. A server builds
+ * its table once and shares it, read-only, between all of its sessions.
+ *
+ * Each command is given a compact opcode (its index in the table), and names
+ * are resolved to opcodes through a perfect hash built at construction: names
+ * are split into buckets by one hash, and each bucket is given a seed under
+ * which a second hash places its names in slots no other name occupies. A
+ * lookup then costs two hashes and one string comparison however many
+ * commands are registered.
+ *
+ * A command's handler is either synchronous, returning its response, or
+ * asynchronous, taking a Responder to call once the response is ready. An
+ * asynchronous handler may thus wait on a request of its own (e.g. to forward
+ * a lookup) without tying up one of the server's threads.
+ *
+ * @tparam RequestHandler The type of the handlers to respond to requests.
+ * @tparam RequestClass The type on which handlers will be called.
+ */
+template<class RequestHandler, class RequestClass>
+class CommandTable {
+public:
+    typedef std::map<std::string, RequestHandler> CommandMap;
+    typedef std::function<void(RequestClass &, const Json::Value &,
+                               Responder)> AsyncRequestHandler;
+    typedef std::map<std::string, AsyncRequestHandler> AsyncCommandMap;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param commands Map of command names to synchronous handlers.
+	 * @param async_commands Map of command names to asynchronous handlers.
+	 *                       These take precedence over synchronous handlers
+	 *                       of the same name.
+	 */
+    explicit CommandTable(const CommandMap &commands,
+                          const AsyncCommandMap &async_commands = {})
+    {
+        // Synchronous commands take the lower opcodes.
+        for (const auto &[name, handler] : commands) {
+            if (async_commands.count(name))
+                continue;
+            names_.push_back(name);
+            handlers_.push_back(handler);
+        }
+        for (const auto &[name, handler] : async_commands) {
+            names_.push_back(name);
+            async_handlers_.push_back(handler);
+        }
+
+        // Twice as many slots as commands keeps the seed search short.
+        size_t num_slots = 1;
+        while (num_slots < 2 * names_.size())
+            num_slots <<= 1;
+        mask_ = num_slots - 1;
+        slots_.assign(num_slots, NO_OPCODE);
+        seeds_.assign(std::max<size_t>(names_.size() / 2, 1), 0);
+
+        std::vector<std::vector<uint16_t>> buckets(seeds_.size());
+        for (size_t opcode = 0; opcode < names_.size(); opcode++)
+            buckets[Hash(names_[opcode], 0) % seeds_.size()].push_back(
+                    uint16_t(opcode));
+
+        // Place the largest buckets first, while the table is emptiest.
+        std::vector<size_t> order(buckets.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        std::vector<size_t> placed;
+        for (size_t bucket : order) {
+            for (uint32_t seed = 1;; seed++) {
+                placed.clear();
+                for (uint16_t opcode : buckets[bucket]) {
+                    size_t slot = Hash(names_[opcode], seed) & mask_;
+                    if (slots_[slot] != NO_OPCODE)
+                        break;
+                    slots_[slot] = opcode;
+                    placed.push_back(slot);
+                }
+                if (placed.size() == buckets[bucket].size()) {
+                    seeds_[bucket] = seed;
+                    break;
+                }
+                for (size_t slot : placed)
+                    slots_[slot] = NO_OPCODE;
+            }
+        }
+    }
+
+	/**
+	 * Resolve a command name to its opcode.
+	 *
+	 * @param name Name of command.
+	 * @return Opcode of command, or nullopt if there is no such command.
+	 */
+    std::optional<uint16_t> Opcode(std::string_view name) const
+    {
+        uint32_t seed = seeds_[Hash(name, 0) % seeds_.size()];
+        uint16_t opcode = slots_[Hash(name, seed) & mask_];
+        if (opcode == NO_OPCODE || names_[opcode] != name)
+            return std::nullopt;
+        return opcode;
+    }
+
+	/**
+	 * Call the handler for a command. A synchronous handler is answered before
+	 * Call returns; an asynchronous one whenever it calls respond.
+	 *
+	 * @param opcode Opcode of command, as returned by Opcode.
+	 * @param request_class_inst Instance on which to call the handler.
+	 * @param request Request to pass to the handler.
+	 * @param respond Called with the handler's response or error.
+	 */
+    void Call(uint16_t opcode, RequestClass &request_class_inst,
+              const Json::Value &request, Responder respond) const
+    {
+        if (opcode >= handlers_.size()) {
+            try {
+                async_handlers_[opcode - handlers_.size()](
+                        request_class_inst, request, respond);
+            } catch (...) {
+                respond(std::current_exception(), Json::Value());
+            }
+            return;
+        }
+
+        Json::Value response;
+        try {
+            response = handlers_[opcode](request_class_inst, request);
+        } catch (...) {
+            return respond(std::current_exception(), Json::Value());
+        }
+        respond(nullptr, std::move(response));
+    }
+
+	/**
+	 * Lookup command specified in request, and call it to answer the request.
+	 *
+	 * @param request_class_inst Instance on which to call the handler.
+	 * @param request Request issued by client.
+	 * @param respond Called with the handler's response or error.
+	 */
+    void Process(RequestClass &request_class_inst, const Json::Value &request,
+                 Responder respond) const
+    {
+        const char *begin = nullptr, *end = nullptr;
+        const Json::Value &command = request["COMMAND"];
+        std::optional<uint16_t> opcode;
+        if (command.isString() && command.getString(&begin, &end))
+            opcode = Opcode(std::string_view(begin, end - begin));
+
+        // If command is not valid, give a response with an error.
+        if (!opcode)
+            return respond(std::make_exception_ptr(
+                    std::runtime_error("Invalid command.")), Json::Value());
+
+        // Otherwise, run the relevant handler.
+        Call(*opcode, request_class_inst, request, std::move(respond));
+    }
+
+	/// Number of commands in the table.
+    size_t Size() const
+    {
+        return names_.size();
+    }
+
+private:
+    static constexpr uint16_t NO_OPCODE = UINT16_MAX;
+
+	/// Names and handlers of commands, indexed by opcode (asynchronous
+	/// handlers following synchronous ones).
+    std::vector<std::string> names_;
+    std::vector<RequestHandler> handlers_;
+    std::vector<AsyncRequestHandler> async_handlers_;
+	/// Opcodes indexed by the seeded hash of their names.
+    std::vector<uint16_t> slots_;
+    size_t mask_;
+	/// Seed of each bucket of names.
+    std::vector<uint32_t> seeds_;
+
+	/**
+	 * Seeded FNV-1a hash of a command name.
+	 */
+    static uint32_t Hash(std::string_view name, uint32_t seed)
+    {
+        uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+        for (char c : name) {
+            hash ^= (unsigned char) c;
+            hash *= 16777619u;
+        }
+        return hash ^ (hash >> 15);
+    }
+};
 
 /**
  * The "Session" class is intended to handle a single connection to a server.
  * Upon receiving a connection, it should:
- *      - Read from a data buffer;
- *      - Parse that info as JSON;
+ *      - Read length-prefixed requests (see message_frame.h) one after
+ *        another, without waiting for earlier ones to be answered;
+ *      - Parse each as JSON or, if the client asked for it, as the
+ *        compact binary encoding (see wire_format.h);
  *      - Identify the "COMMAND" field from that JSON request and the corresp-
- *        onding lambda in the "commands_" map;
+ *        onding lambda in the server's shared CommandTable;
  *      - Call the lambda, a function of type Request Handler and a member
  *        function of class RequestClass, which will produce a JSON response or
  *        throw an error;
  *      - Return to the client either the JSON response from the handler
- *        or a JSON response indicating error.
+ *        or a JSON response indicating error, in the request's encoding and
+ *        tagged with the request's ID.
+ *
+ * Reading and writing happen on the session's strand, but handlers run on the
+ * server's io_context, so several requests on one connection may be handled
+ * at once and answered in whichever order they finish. An asynchronous
+ * handler may answer from any thread.
+ *
+ * At most SESSION_MAX_IN_FLIGHT requests per session are read and not yet
+ * answered; beyond that, the session stops reading until one is answered.
+ * Each holds a body buffer which is then kept for the next request.
  *
  * @tparam RequestHandler The type of the handlers to respond to requests.
  * @tparam RequestClass The type that will run the server and on which
@@ -65,132 +377,253 @@ class Session :
                 RequestClass>>
 {
 public:
-    typedef std::map<std::string, RequestHandler> CommandMap;
+    typedef CommandTable<RequestHandler, RequestClass> Commands;
 
 	/**
 	 * Constructor.
 	 *
 	 * @param socket Socket from which to read and write data.
-	 * @param commands Map of string to commands of type
-	 *                 RequestClass::RequestHandler.
+	 * @param commands Table of commands of type RequestClass::RequestHandler,
+	 *                 shared with the server's other sessions.
 	 * @param request_class_inst The instance of RequestClass on which commands
 	 *                           will be called.
+	 * @param handler_executor Executor on which commands will be called.
 	 */
-    Session(tcp::socket socket, CommandMap commands,
-            RequestClass *request_class_inst)
+    Session(tcp::socket socket, std::shared_ptr<const Commands> commands,
+            RequestClass *request_class_inst,
+            boost::asio::any_io_executor handler_executor)
         : socket_(std::move(socket))
-        , commands_(std::move(commands))
         , request_class_inst_(std::move(request_class_inst))
-        , reader_((new Json::CharReaderBuilder)->newCharReader())
+        , commands_(std::move(commands))
+        , handler_executor_(std::move(handler_executor))
+        , in_flight_(0)
+        , read_paused_(false)
     {}
 
 	/**
-	 * Run a session - i.e. read from the socket, generate a response, and write
-	 * said response to the socket.
+	 * Run a session - i.e. read requests from the socket, and write responses
+	 * to the socket as they are generated.
 	 */
     void Run()
     {
         DoRead();
     }
 
+	/**
+	 * Close the connection, cancelling any read or write in progress. May be
+	 * called from any thread.
+	 */
+    void Close()
+    {
+        auto self(this->shared_from_this());
+        boost::asio::post(socket_.get_executor(), [this, self] {
+          error_code ec;
+          socket_.close(ec);
+        });
+    }
+
 private:
+	typedef struct {
+		FrameHeader header_;
+		std::string body_;
+	} OutgoingFrame;
+
 	/// Socket from which to read/write data.
     tcp::socket socket_;
 	/// Instance on which commands will be called.
     RequestClass *request_class_inst_;
-	/// Map of strings to commands.
-    CommandMap commands_;
-    /// Reads JSON.
-    const std::unique_ptr<Json::CharReader> reader_;
-    /// Writes JSON.
-	Json::StreamWriterBuilder writer_;
-	/// Buffer into which session will read socket info.
-	char data_[2048];
-	/// String to store server response (must be data member so it
-	/// can outlast the duration of DoWrite, since async_write returns immed-
-	/// iately).
-    std::string resp_;
+	/// Table of commands.
+    std::shared_ptr<const Commands> commands_;
+	/// Executor on which commands are called.
+    boost::asio::any_io_executor handler_executor_;
+	/// Length prefix of the request currently being read.
+	FrameHeader req_header_;
+	/// Responses waiting to be written, the first of them being written now
+	/// (must be data members so they can outlast the duration of DoWrite,
+	/// since async_write returns immediately). Only accessed on the strand.
+	std::deque<OutgoingFrame> write_queue_;
+	/// Body buffers of answered requests, kept for reuse. Only accessed on
+	/// the strand.
+	std::vector<std::shared_ptr<std::string>> free_bodies_;
+	/// Requests read but not yet answered. Only accessed on the strand.
+	int in_flight_;
+	/// Whether reading has stopped until in_flight_ falls. Only accessed on
+	/// the strand.
+	bool read_paused_;
 
 	/**
-	 * Read a single request from the socket.
-	 * If there are no errors, write the appropriate response.
+	 * Read the length prefix of a single request from the socket.
+	 * If there are no errors, read the request body that follows.
 	 */
     void DoRead()
     {
         auto self(this->shared_from_this());
-        socket_.async_read_some(boost::asio::buffer(data_),
-                                [this, self](error_code ec, std::size_t length)
+        boost::asio::async_read(socket_, boost::asio::buffer(req_header_),
+                                [this, self](error_code ec, std::size_t)
                                 {
                                   if (!ec)
-                                      DoWrite(length);
+                                      DoReadBody();
                                 });
     }
 
 	/**
-	 * After request has been read from socket_ into data_, read data_, generate
-	 * response, and write it to the socket.
-	 * @param length Length of data read from socket.
+	 * Read a request body of the size announced in req_header_, into a
+	 * buffer from free_bodies_ if there is one. If there are no errors, hand
+	 * the request off to be answered and read the next one, unless
+	 * SESSION_MAX_IN_FLIGHT requests are now awaiting answers.
 	 */
-    void DoWrite(std::size_t length)
+    void DoReadBody()
     {
-        JSONCPP_STRING parse_err;
-        Json::Value json_req, json_resp;
-        std::string client_req_str(data_);
-
-        if (reader_->parse(client_req_str.c_str(),
-                           client_req_str.c_str() +
-                           client_req_str.length(),
-                           &json_req, &parse_err))
-        {
-            try {
-                // Get JSON response.
-                json_resp = ProcessRequest(json_req);
-                json_resp["SUCCESS"] = true;
-            } catch (const std::exception &ex) {
-                // If json parsing failed.
-                json_resp["SUCCESS"] = false;
-                json_resp["ERRORS"] = std::string(ex.what());
-            }
-        } else {
-            // If json parsing failed.
-            json_resp["SUCCESS"] = false;
-            json_resp["ERRORS"] = std::string(parse_err);
+        size_t body_size;
+        try {
+            body_size = DecodeFrameHeader(req_header_);
+        } catch (const std::exception &) {
+            // A bogus length means we can no longer find message boundaries
+            // on this connection, so drop it.
+            return;
         }
 
-        resp_ = Json::writeString(writer_, json_resp);
+        std::shared_ptr<std::string> body;
+        if (free_bodies_.empty()) {
+            body = std::make_shared<std::string>();
+        } else {
+            body = std::move(free_bodies_.back());
+            free_bodies_.pop_back();
+        }
+        body->resize(body_size);
+        in_flight_++;
 
         auto self(this->shared_from_this());
-        boost::asio::async_write(socket_,
-                                 boost::asio::buffer(resp_),
-                                 [this, self]
-                                         (boost::system::error_code ec,
-                                          std::size_t bytes_xfered) {
-                                   if (!ec)     DoRead();
-                                 });
+        FrameHeader header = req_header_;
+        boost::asio::async_read(socket_, boost::asio::buffer(*body),
+                                [this, self, header, body]
+                                        (error_code ec, std::size_t)
+                                {
+                                  if (ec)
+                                      return;
+                                  boost::asio::post(handler_executor_,
+                                                    [this, self, header, body] {
+                                    HandleRequest(header, body);
+                                  });
+                                  if (in_flight_ < SESSION_MAX_IN_FLIGHT)
+                                      DoRead();
+                                  else
+                                      read_paused_ = true;
+                                });
     }
 
 	/**
-	 * Lookup command specified in request in commands map. Call it,
-	 * and return its response.
+	 * Return the body buffer of an answered request for reuse, and resume
+	 * reading if it had stopped for want of one. Runs on the strand.
 	 *
-	 * @param request Request issued by client.
-	 * @return Response to request.
+	 * @param body Buffer to return.
 	 */
-    Json::Value ProcessRequest(Json::Value request)
+    void ReleaseBody(std::shared_ptr<std::string> body)
     {
-        Json::Value response;
-        std::string command = request["COMMAND"].asString();
+        // A buffer grown by an unusually large request is not worth keeping.
+        if (body->capacity() <= SESSION_POOLED_BODY_BYTES)
+            free_bodies_.push_back(std::move(body));
+        in_flight_--;
+        if (read_paused_) {
+            read_paused_ = false;
+            DoRead();
+        }
+    }
 
-        // If command is not valid, give a response with an error.
-        if(commands_.find(command) == commands_.end())
-			throw std::runtime_error("Invalid command.");
+	/**
+	 * Parse a request and pass it to its handler. Runs off the session's
+	 * strand.
+	 *
+	 * @param header Length prefix of the request.
+	 * @param body Body of the request, held until it is answered.
+	 */
+    void HandleRequest(const FrameHeader &header,
+                       const std::shared_ptr<std::string> &body)
+    {
+        auto self(this->shared_from_this());
+        auto responded = std::make_shared<std::atomic<bool>>(false);
+        Responder respond = [this, self, header, body, responded]
+                (std::exception_ptr err, Json::Value response) {
+          if (!responded->exchange(true))
+              Respond(header, body, err, std::move(response));
+        };
 
-        // Otherwise, run the relevant handler.
-        else {
-            RequestHandler handler = commands_.at(command);
-            response = handler(*request_class_inst_, request);
+        Json::Value json_req;
+        try {
+            json_req = Deserialize(body->data(), body->data() + body->size(),
+                                   FrameFormat(header));
+        } catch (...) {
+            // If parsing failed.
+            return respond(std::current_exception(), Json::Value());
         }
-        return response;
+
+        commands_->Process(*request_class_inst_, json_req, std::move(respond));
+    }
+
+	/**
+	 * Serialize the response to a request and queue it to be written to the
+	 * socket. May be called from any thread.
+	 *
+	 * @param header Length prefix of the request.
+	 * @param body Body buffer of the request, released once this is queued.
+	 * @param err Error raised by the handler, if any.
+	 * @param json_resp Response from the handler, if there was no error.
+	 */
+    void Respond(const FrameHeader &header, std::shared_ptr<std::string> body,
+                 std::exception_ptr err, Json::Value json_resp)
+    {
+        WireFormat format = FrameFormat(header);
+        json_resp = MakeResponse(err, std::move(json_resp));
+
+        OutgoingFrame frame;
+        frame.body_ = Serialize(json_resp, format);
+        try {
+            frame.header_ = EncodeFrameHeader(frame.body_.size(), format,
+                                              FrameRequestId(header));
+        } catch (const std::exception &ex) {
+            // The client is still waiting on this ID, so tell it why.
+            json_resp = Json::Value();
+            json_resp["SUCCESS"] = false;
+            json_resp["ERRORS"] = std::string(ex.what());
+            frame.body_ = Serialize(json_resp, format);
+            frame.header_ = EncodeFrameHeader(frame.body_.size(), format,
+                                              FrameRequestId(header));
+        }
+
+        auto self(this->shared_from_this());
+        boost::asio::post(socket_.get_executor(),
+                          [this, self, frame = std::move(frame),
+                           body = std::move(body)]() mutable {
+          write_queue_.push_back(std::move(frame));
+          if (write_queue_.size() == 1)
+              DoWrite();
+          ReleaseBody(std::move(body));
+        });
+    }
+
+	/**
+	 * Write the response at the front of write_queue_, then any queued
+	 * behind it.
+	 */
+    void DoWrite()
+    {
+        auto self(this->shared_from_this());
+        const OutgoingFrame &frame = write_queue_.front();
+        std::array<boost::asio::const_buffer, 2> buffers {
+            boost::asio::buffer(frame.header_), boost::asio::buffer(frame.body_)
+        };
+        boost::asio::async_write(socket_, buffers,
+                                 [this, self]
+                                         (boost::system::error_code ec,
+                                          std::size_t bytes_xfered) {
+                                   if (ec) {
+                                       write_queue_.clear();
+                                       return;
+                                   }
+                                   write_queue_.pop_front();
+                                   if (!write_queue_.empty())
+                                       DoWrite();
+                                 });
     }
 
 };
@@ -206,21 +639,47 @@ private:
 template <class RequestHandler, class RequestClass> class Server {
 public:
     using CommandMap = std::map<std::string, RequestHandler>;
+    using AsyncCommandMap = typename CommandTable<RequestHandler,
+                                                  RequestClass>::AsyncCommandMap;
 
 	/**
 	 * Constructor.
 	 *
 	 * @param port Port on which server will be run.
-	 * @param commands Map of strings to lambdas (will be passed to Session
-	 *                 constructor).
+	 * @param commands Map of strings to lambdas (built into a table shared
+	 *                 by every Session).
 	 * @param request_class_inst Instance on which command methods will be
 	 *                           called (also passed to Session constructor).
+	 * @param num_threads Number of threads on which RunInBackground will run
+	 *                    the server.
+	 * @param async_commands Map of strings to asynchronous handlers (see
+	 *                       CommandTable).
+	 * @param accept_connections Whether to listen for TCP connections on
+	 *                           port. If not, the server only answers
+	 *                           requests passed to Dispatch (e.g. by a
+	 *                           SimulatedTransport).
 	 */
-    Server(uint16_t port, CommandMap commands, RequestClass *request_class_inst)
-        : acceptor_(io_context_, tcp::endpoint(tcp::v4(), port))
-        , commands_(std::move(commands))
+    Server(uint16_t port, CommandMap commands, RequestClass *request_class_inst,
+           int num_threads = 1, AsyncCommandMap async_commands = {},
+           bool accept_connections = true)
+        : work_(boost::asio::make_work_guard(io_context_))
+        , acceptor_(boost::asio::make_strand(io_context_))
+        , commands_(std::make_shared<const CommandTable<RequestHandler,
+                                                        RequestClass>>(
+                commands, async_commands))
         , request_class_inst_(std::move(request_class_inst))
+        , num_threads_(std::max(num_threads, 1))
+        , killed_(false)
     {
+        if (!accept_connections)
+            return;
+
+        tcp::endpoint endpoint(tcp::v4(), port);
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(tcp::acceptor::reuse_address(true));
+        acceptor_.bind(endpoint);
+        acceptor_.listen();
+
 		// NOTE: This won't start running until we run the io_context.
         DoAccept();
     }
@@ -230,9 +689,18 @@ public:
 	 */
     ~Server()
     {
-        if (t_.joinable())
-            t_.join();
-        assert(not t_.joinable());
+        Join();
+    }
+
+	/**
+	 * Wait for the threads running the server to exit, as they do once it
+	 * has been killed and the handlers already posted have run.
+	 */
+    void Join()
+    {
+        for (std::thread &t : threads_)
+            if (t.joinable())
+                t.join();
     }
 
 	/**
@@ -244,15 +712,18 @@ public:
     }
 
 	/**
-	 * Run the server as a thread.
-	 * NOTE: We can't detach this thread. It screws up synchronization of
+	 * Run the server on num_threads threads.
+	 * NOTE: We can't detach these threads. It screws up synchronization of
 	 *       the io_context between threads, which causes race conditions and,
 	 *       ultimately, segfaults.
 	 */
     void RunInBackground()
     {
-        if (!t_.joinable()) {
-            t_ = std::thread([this] {
+        if (!threads_.empty())
+            return;
+
+        for (int i = 0; i < num_threads_; i++) {
+            threads_.emplace_back([this] {
               Run();
               std::cout << "THREAD EXIT" << std::endl;
             });
@@ -260,44 +731,102 @@ public:
     }
 
 	/**
-	 * Kill the server by closing acceptor_.
+	 * Kill the server by closing acceptor_ and every open connection.
 	 */
     void Kill()
     {
+        killed_ = true;
+
 		// tcp::acceptor::close is not thread-safe, so we must instead tell the
-		// io_context to close the acceptor as soon as it's able to do so.
-        post(io_context_, [this] {
+		// acceptor's strand to close it as soon as it's able to do so.
+        post(acceptor_.get_executor(), [this] {
           std::cout << "CLOSING" << std::endl;
           acceptor_.close(); // causes .cancel() as well
+          work_.reset();
+
+          // Clients keep connections open between requests, so these must
+          // be closed too, or the server would go on answering them.
+          for (auto &session : sessions_)
+              if (auto open_session = session.lock())
+                  open_session->Close();
+          sessions_.clear();
+        });
+    }
+
+	/**
+	 * Answer a request made from within this process (see local_transport.h),
+	 * as if it had arrived over a connection: on the server's threads, and
+	 * not at all once the server has been killed. Does not block.
+	 *
+	 * @param request Request to answer.
+	 * @param respond Called with the response to send to the client, or
+	 *                with an error if the server has been killed, whether
+	 *                before the request arrived or before it was handled.
+	 */
+    void Dispatch(Json::Value request, Responder respond)
+    {
+        if (killed_)
+            return respond(std::make_exception_ptr(
+                    std::runtime_error("Server killed.")), Json::Value());
+
+        auto guard = std::make_shared<DispatchGuard>(std::move(respond));
+        post(io_context_, [this, request = std::move(request), guard] {
+          commands_->Process(*request_class_inst_, request,
+                             [guard](std::exception_ptr err,
+                                     Json::Value response) {
+            guard->Respond(nullptr, MakeResponse(err, std::move(response)));
+          });
         });
     }
 
 private:
 	/// The server starts on io_context_.run().
     boost::asio::io_context io_context_;
+	/// Keeps io_context_ running until Kill, even with no connection to
+	/// accept.
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+            work_;
 	/// Acceptor accepts new connections from clients.
     tcp::acceptor acceptor_;
-	/// Maps strings of commands to associated member funcs of RequestClass.
-    CommandMap commands_;
+	/// Maps commands to associated member funcs of RequestClass. Shared by
+	/// every session rather than copied into each.
+    std::shared_ptr<const CommandTable<RequestHandler, RequestClass>> commands_;
 	/// The instance of RequestClass on which member funcs will be called.
     RequestClass *request_class_inst_;
-	/// The thread on which we will run the server.
-    std::thread t_;
+	/// Number of threads on which to run the server.
+    int num_threads_;
+	/// The threads on which we will run the server.
+    std::vector<std::thread> threads_;
+	/// Sessions which may still be open, so that Kill can close them. Only
+	/// accessed on the acceptor's strand.
+    std::vector<std::weak_ptr<Session<RequestHandler, RequestClass>>> sessions_;
+	/// Has Kill been called?
+    std::atomic<bool> killed_;
 
 	/**
 	 * Accept a single connection, setup a connection, and run said connection.
+	 * Each connection is given a strand of its own.
 	 */
     void DoAccept()
     {
         acceptor_.async_accept(
+                boost::asio::make_strand(io_context_),
                 [this](boost::system::error_code ec, tcp::socket socket) {
                   if (ec) {
                       std::cout << "Accept loop: " << ec.message() << std::endl;
                   } else {
 					  tcp::endpoint client_ept = socket.remote_endpoint();
-                      std::make_shared<Session<RequestHandler, RequestClass>>(
-                              std::move(socket), commands_, request_class_inst_)
-                              ->Run();
+                      auto session = std::make_shared<Session<RequestHandler,
+                                                              RequestClass>>(
+                              std::move(socket), commands_, request_class_inst_,
+                              io_context_.get_executor());
+                      session->Run();
+
+                      sessions_.erase(std::remove_if(
+                              sessions_.begin(), sessions_.end(),
+                              [](const auto &s) { return s.expired(); }),
+                                      sessions_.end());
+                      sessions_.push_back(session);
                       DoAccept();
                   }
                 });
@@ -0,0 +1,183 @@
+#include "simulated_transport.h"
+#include "message_frame.h"
+#include "wire_format.h"
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+SimulatedTransport::SimulatedTransport(LinkProfile profile, int num_threads)
+    : default_profile_(profile)
+    , stats_{ 0, 0, 0, {} }
+    , gen_(std::random_device{}())
+    , work_(boost::asio::make_work_guard(io_context_))
+{
+    for(int i = 0; i < std::max(num_threads, 1); i++)
+        threads_.emplace_back([this] { io_context_.run(); });
+}
+
+SimulatedTransport::~SimulatedTransport()
+{
+    work_.reset();
+    io_context_.stop();
+    for(std::thread &t : threads_)
+        t.join();
+}
+
+void SimulatedTransport::SetLinkProfile(const std::string &ip_addr,
+                                        unsigned short port,
+                                        LinkProfile profile)
+{
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    links_[Endpoint(ip_addr, port)].profile_ = profile;
+}
+
+void SimulatedTransport::Listen(const std::string &ip_addr,
+                                unsigned short port, RequestHandler handler)
+{
+    std::unique_lock<std::shared_mutex> lock(handlers_mutex_);
+    handlers_.insert_or_assign(Endpoint(ip_addr, port), std::move(handler));
+}
+
+void SimulatedTransport::Unlisten(const std::string &ip_addr,
+                                  unsigned short port)
+{
+    std::unique_lock<std::shared_mutex> lock(handlers_mutex_);
+    handlers_.erase(Endpoint(ip_addr, port));
+}
+
+bool SimulatedTransport::Send(const std::string &ip_addr, unsigned short port,
+                              const Json::Value &request,
+                              ResponseHandler &handler)
+{
+    Endpoint endpoint(ip_addr, port);
+    std::string command = request["COMMAND"].asString();
+    auto sent = std::chrono::steady_clock::now();
+    auto timeout = sent + std::chrono::milliseconds(SIM_LOSS_TIMEOUT_MS);
+
+    auto [arrival, lost] = Transmit(endpoint, true, command,
+                                    WireSize(request));
+    if(lost) {
+        At(timeout, [handler = std::move(handler)] {
+            handler(std::make_exception_ptr(
+                            std::runtime_error("Request timed out.")),
+                    Json::Value());
+        });
+        return true;
+    }
+
+    At(arrival, [this, endpoint, command, request, timeout,
+                 one_way = arrival - sent,
+                 handler = std::move(handler)]() mutable {
+        std::shared_lock<std::shared_mutex> lock(handlers_mutex_);
+        auto it = handlers_.find(endpoint);
+        if(it == handlers_.end()) {
+            // The refusal takes as long to come back as the request took to
+            // get here.
+            At(std::chrono::steady_clock::now() + one_way,
+               [handler = std::move(handler)] {
+                handler(std::make_exception_ptr(
+                                std::runtime_error("Connection refused.")),
+                        Json::Value());
+            });
+            return;
+        }
+
+        it->second(std::move(request),
+                   [this, endpoint, command, timeout,
+                    handler = std::move(handler)](std::exception_ptr err,
+                                                  Json::Value resp) mutable {
+            auto [arrival, lost] = Transmit(endpoint, false, command,
+                                            WireSize(resp));
+            if(lost)
+                return At(timeout, [handler = std::move(handler)] {
+                    handler(std::make_exception_ptr(
+                                    std::runtime_error("Request timed out.")),
+                            Json::Value());
+                });
+
+            At(arrival, [err, resp = std::move(resp),
+                         handler = std::move(handler)]() mutable {
+                handler(err, std::move(resp));
+            });
+        });
+    });
+    return true;
+}
+
+std::optional<bool> SimulatedTransport::IsAlive(const std::string &ip_addr,
+                                                unsigned short port)
+{
+    std::shared_lock<std::shared_mutex> lock(handlers_mutex_);
+    return handlers_.count(Endpoint(ip_addr, port)) > 0;
+}
+
+TransportStats SimulatedTransport::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    return stats_;
+}
+
+void SimulatedTransport::ResetStats()
+{
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    stats_ = { 0, 0, 0, {} };
+}
+
+std::pair<std::chrono::steady_clock::time_point, bool>
+SimulatedTransport::Transmit(const Endpoint &endpoint, bool inbound,
+                             const std::string &command, size_t size)
+{
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    auto [it, created] = links_.try_emplace(endpoint);
+    Link &link = it->second;
+    if(created)
+        link.profile_ = default_profile_;
+    const LinkProfile &profile = link.profile_;
+
+    // The message waits for those queued ahead of it to leave the link, then
+    // takes its own turn.
+    auto &link_free = inbound ? link.inbound_free_ : link.outbound_free_;
+    link_free = std::max(now, link_free);
+    if(profile.bandwidth_ > 0)
+        link_free += std::chrono::duration_cast<
+                std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(
+                        double(size) / double(profile.bandwidth_)));
+
+    std::chrono::microseconds latency = profile.latency_;
+    if(profile.jitter_.count() > 0) {
+        std::uniform_int_distribution<long> offset(-profile.jitter_.count(),
+                                                   profile.jitter_.count());
+        latency = std::max(latency + std::chrono::microseconds(offset(gen_)),
+                           std::chrono::microseconds(0));
+    }
+
+    bool lost = profile.loss_ > 0 &&
+                std::bernoulli_distribution(profile.loss_)(gen_);
+
+    stats_.messages_++;
+    stats_.bytes_ += size;
+    stats_.bytes_by_command_[command] += size;
+    if(lost)
+        stats_.lost_++;
+
+    return { link_free + latency, lost };
+}
+
+void SimulatedTransport::At(std::chrono::steady_clock::time_point when,
+                            std::function<void()> fn)
+{
+    auto timer = std::make_shared<boost::asio::steady_timer>(io_context_,
+                                                             when);
+    timer->async_wait([timer, fn = std::move(fn)](
+            const boost::system::error_code &ec) {
+        if(! ec)
+            fn();
+    });
+}
+
+size_t SimulatedTransport::WireSize(const Json::Value &message)
+{
+    return Serialize(message, WireFormat::BINARY).size() + FRAME_HEADER_SIZE;
+}
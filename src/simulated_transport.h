@@ -0,0 +1,189 @@
+/**
+ * simulated_transport.h
+ *
+ * This file implements an in-memory network on which many peers can run in a
+ * single process, without binding a port each. Requests and responses are
+ * handed between clients and servers as Json::Value, but only after the delay
+ * a real network would impose.
+ *
+ * Every endpoint sits behind an access link with its own latency, jitter,
+ * loss rate and bandwidth (the network's default, unless set otherwise). A
+ * request crosses the server's link inbound and its response crosses it
+ * outbound, so a round trip costs twice the link's latency, plus the time to
+ * push each message through the link's bandwidth behind whatever was queued
+ * on it already. Messages are sized as they would be framed over TCP in the
+ * binary wire format.
+ *
+ * A lost request or response is never answered, so the client sees the
+ * request time out, as it would when a TCP connection stalls. Requests to an
+ * endpoint on which nothing is listening are refused after one round trip.
+ *
+ * The transport counts the messages and bytes it carries, in total and by
+ * command, so that the cost of maintenance traffic can be measured.
+ */
+
+#ifndef CHORD_FINAL_SIMULATED_TRANSPORT_H
+#define CHORD_FINAL_SIMULATED_TRANSPORT_H
+#define SIM_TRANSPORT_THREADS 4
+#define SIM_LOSS_TIMEOUT_MS 1000
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include "transport.h"
+
+/// Behaviour of the access link in front of an endpoint.
+struct LinkProfile {
+	/// One-way delay of each message.
+	std::chrono::microseconds latency_;
+	/// Maximum deviation from latency_, drawn uniformly per message.
+	std::chrono::microseconds jitter_;
+	/// Probability with which each message is dropped.
+	double loss_;
+	/// Bytes per second the link carries in each direction (0 = unlimited).
+	uint64_t bandwidth_;
+};
+
+/// Traffic carried by a SimulatedTransport.
+struct TransportStats {
+	/// Requests and responses sent, including those lost.
+	uint64_t messages_;
+	/// Bytes of those messages, framing included.
+	uint64_t bytes_;
+	/// Messages dropped.
+	uint64_t lost_;
+	/// Bytes of requests and their responses, by command.
+	std::map<std::string, uint64_t> bytes_by_command_;
+};
+
+class SimulatedTransport : public Transport {
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param profile Link profile of every endpoint not given its own.
+	 * @param num_threads Number of threads on which to deliver messages.
+	 */
+	explicit SimulatedTransport(LinkProfile profile,
+	                            int num_threads = SIM_TRANSPORT_THREADS);
+
+	/**
+	 * Destructor. Messages still in flight are dropped without their
+	 * handlers being called, so every peer using the transport should be
+	 * destroyed first.
+	 */
+	~SimulatedTransport() override;
+
+	/**
+	 * Give the endpoint ip_addr:port an access link of its own.
+	 *
+	 * @param ip_addr IP address of endpoint.
+	 * @param port Port of endpoint.
+	 * @param profile Profile of its link.
+	 */
+	void SetLinkProfile(const std::string &ip_addr, unsigned short port,
+	                    LinkProfile profile);
+
+	void Listen(const std::string &ip_addr, unsigned short port,
+	            RequestHandler handler) override;
+
+	void Unlisten(const std::string &ip_addr, unsigned short port) override;
+
+	/**
+	 * Deliver a request to ip_addr:port over the simulated network. Every
+	 * request is taken, since no endpoint on the network is reachable by
+	 * TCP; the handler is called on one of the transport's threads.
+	 */
+	bool Send(const std::string &ip_addr, unsigned short port,
+	          const Json::Value &request, ResponseHandler &handler) override;
+
+	/**
+	 * An endpoint is alive exactly when something is listening on it.
+	 */
+	std::optional<bool> IsAlive(const std::string &ip_addr,
+	                            unsigned short port) override;
+
+	/// Traffic carried since construction or the last ResetStats().
+	TransportStats GetStats() const;
+
+	/**
+	 * Zero the traffic counters.
+	 */
+	void ResetStats();
+
+private:
+	typedef std::pair<std::string, unsigned short> Endpoint;
+
+	/// State of an endpoint's access link.
+	typedef struct {
+		LinkProfile profile_;
+		/// Times at which the link will have finished sending what is queued
+		/// on it towards, and away from, the endpoint.
+		std::chrono::steady_clock::time_point inbound_free_;
+		std::chrono::steady_clock::time_point outbound_free_;
+	} Link;
+
+	/// Profile of links not given one of their own.
+	LinkProfile default_profile_;
+
+	/// Endpoints being listened on. Messages are delivered holding this
+	/// (shared), so that Unlisten can wait them out.
+	std::map<Endpoint, RequestHandler> handlers_;
+	mutable std::shared_mutex handlers_mutex_;
+
+	/// Links in use, created on first use.
+	std::map<Endpoint, Link> links_;
+	/// Traffic counters.
+	TransportStats stats_;
+	/// Draws jitter and losses.
+	std::mt19937 gen_;
+	/// Guards links_, stats_ and gen_.
+	mutable std::mutex state_mutex_;
+
+	/// Runs the timers which deliver messages.
+	boost::asio::io_context io_context_;
+	boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+			work_;
+	std::vector<std::thread> threads_;
+
+	/**
+	 * Work out when a message will arrive, and whether it is lost, recording
+	 * it in the traffic counters.
+	 *
+	 * @param endpoint Endpoint at the far end of the link.
+	 * @param inbound Is the message headed to the endpoint (a request),
+	 *                rather than from it (a response)?
+	 * @param command Command the message belongs to.
+	 * @param size Size of the message in bytes.
+	 * @return Time of arrival and whether the message is lost.
+	 */
+	std::pair<std::chrono::steady_clock::time_point, bool>
+	Transmit(const Endpoint &endpoint, bool inbound,
+	         const std::string &command, size_t size);
+
+	/**
+	 * Run a function on one of the transport's threads at a given time.
+	 *
+	 * @param when Time at which to run it.
+	 * @param fn Function to run.
+	 */
+	void At(std::chrono::steady_clock::time_point when,
+	        std::function<void()> fn);
+
+	/**
+	 * Size of a message as framed over TCP.
+	 *
+	 * @param message Message to size.
+	 * @return Size in bytes.
+	 */
+	static size_t WireSize(const Json::Value &message);
+};
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * transport.h
+ *
+ * This file defines the interface beneath Client and Server through which
+ * requests travel when they do not go over TCP. A transport carries requests
+ * as Json::Value, so the same handlers answer them whichever way they come.
+ *
+ * Two implementations exist:
+ *      - LocalTransport     : Hands requests straight to servers running in
+ *                             this process, and leaves the rest to TCP.
+ *      - SimulatedTransport : An in-memory network with configurable latency,
+ *                             loss and bandwidth, for standing up large rings
+ *                             of peers in one process.
+ */
+
+#ifndef CHORD_FINAL_TRANSPORT_H
+#define CHORD_FINAL_TRANSPORT_H
+
+#include <exception>
+#include <functional>
+#include <optional>
+#include <string>
+#include <json/json.h>
+
+class Transport {
+public:
+	/// Called with either an error or the response to a request.
+	typedef std::function<void(std::exception_ptr, Json::Value)>
+			ResponseHandler;
+
+	/// Hands a request to a server. It must not block.
+	typedef std::function<void(Json::Value request, ResponseHandler handler)>
+			RequestHandler;
+
+	virtual ~Transport() = default;
+
+	/**
+	 * Route requests to ip_addr:port to a handler.
+	 *
+	 * @param ip_addr IP address under which the server is known.
+	 * @param port Port of the server.
+	 * @param handler Handler to which requests are passed.
+	 */
+	virtual void Listen(const std::string &ip_addr, unsigned short port,
+	                    RequestHandler handler) = 0;
+
+	/**
+	 * Stop routing requests to ip_addr:port. Once this returns, the handler
+	 * registered for it is no longer being called.
+	 *
+	 * @param ip_addr IP address under which the server is known.
+	 * @param port Port of the server.
+	 */
+	virtual void Unlisten(const std::string &ip_addr, unsigned short port) = 0;
+
+	/**
+	 * Send a request to ip_addr:port, unless it is not this transport's to
+	 * carry.
+	 *
+	 * @param ip_addr IP address of server.
+	 * @param port Port of server.
+	 * @param request Request to send.
+	 * @param handler Called with the response. Only moved from if the
+	 *                request was taken.
+	 * @return Did this transport take the request (rather than leave it to
+	 *         be sent over TCP)?
+	 */
+	virtual bool Send(const std::string &ip_addr, unsigned short port,
+	                  const Json::Value &request, ResponseHandler &handler) = 0;
+
+	/**
+	 * Is a server listening on ip_addr:port?
+	 *
+	 * @param ip_addr IP address of server.
+	 * @param port Port of server.
+	 * @return Whether a server is listening, or nullopt if this transport
+	 *         cannot tell and TCP should be asked.
+	 */
+	virtual std::optional<bool> IsAlive(const std::string &ip_addr,
+	                                    unsigned short port) = 0;
+};
+
+#endif
@@ -0,0 +1,355 @@
+#include "wire_format.h"
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// Type tags which prefix every value in the binary encoding.
+enum Tag : unsigned char {
+    TAG_NULL,
+    TAG_FALSE,
+    TAG_TRUE,
+    TAG_INT,        // Zigzag varint.
+    TAG_UINT,       // Varint.
+    TAG_REAL,       // 8 bytes, little-endian IEEE 754.
+    TAG_STRING,     // Varint length, then bytes.
+    TAG_TOKEN,      // 1 byte index into kTokens.
+    TAG_HEX,        // 1 byte digit count, then digits packed 2 per byte.
+    TAG_ARRAY,      // Varint count, then values.
+    TAG_REAL_ARRAY, // Varint count, then 8 bytes per value.
+    TAG_OBJECT,     // Varint count, then (name, value) pairs.
+    TAG_LONG_HEX    // Varint digit count, then digits packed 2 per byte.
+};
+
+/// Strings common enough in the peer protocol to be sent as one byte. Only
+/// ever append to this list; both ends of a connection must agree on it.
+static const std::vector<std::string> kTokens {
+    "COMMAND", "SUCCESS", "ERRORS", "KEY", "KEYS", "FRAGMENT", "INDEX",
+    "VALUES", "PEER", "NEW_PEER", "ID", "MIN_KEY", "MAX_KEY", "IP_ADDR", "PORT",
+    "PREDECESSOR", "SUCCESSORS", "NEW_SUCC", "NEW_PRED", "NEW_MIN", "SENDER_ID",
+    "RECIP_ID", "RECIPIENT_ID", "AVOID", "DONE", "HASH", "LEFT", "RIGHT",
+    "NONE", "JOIN", "LEAVE", "NOTIFY", "MAINTENANCE", "SYNCHRONIZE",
+    "GET_SUCC", "GET_PRED", "GET_NEXT_HOP", "GET_SUCC_LIST", "CREATE_FRAG",
+    "READ_FRAG", "SIZE", "DATA"
+};
+
+/// Messages nested deeper than this are rejected rather than risk
+/// exhausting the stack on hostile input.
+static constexpr int kMaxDepth = 64;
+
+/**
+ * Find the index of a string in kTokens.
+ *
+ * @param begin Start of string.
+ * @param end End of string.
+ * @return Index of string, or -1 if it is not a token.
+ */
+static int TokenIndex(const char *begin, const char *end)
+{
+    static const std::unordered_map<std::string_view, int> indices = [] {
+        std::unordered_map<std::string_view, int> res;
+        for(int i = 0; i < int(kTokens.size()); i++)
+            res.emplace(kTokens[i], i);
+        return res;
+    }();
+
+    auto it = indices.find(std::string_view(begin, end - begin));
+    return it == indices.end() ? -1 : it->second;
+}
+
+/**
+ * Is string made up entirely of lowercase hex digits, and long enough that
+ * packing it saves space?
+ *
+ * @param begin Start of string.
+ * @param end End of string.
+ * @return Can and should string be sent as TAG_HEX or TAG_LONG_HEX?
+ */
+static bool IsPackableHex(const char *begin, const char *end)
+{
+    if(end - begin < 4)
+        return false;
+
+    for(const char *c = begin; c != end; c++)
+        if(!((*c >= '0' && *c <= '9') || (*c >= 'a' && *c <= 'f')))
+            return false;
+    return true;
+}
+
+static void PutVarint(std::string &out, uint64_t value)
+{
+    while(value >= 0x80) {
+        out.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+static void PutReal(std::string &out, double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for(int i = 0; i < 8; i++)
+        out.push_back(char(bits >> (8 * i)));
+}
+
+static void PutString(std::string &out, const char *begin, const char *end)
+{
+    int token = TokenIndex(begin, end);
+    if(token >= 0) {
+        out.push_back(TAG_TOKEN);
+        out.push_back(char(token));
+    } else if(IsPackableHex(begin, end)) {
+        auto digit_value = [](char c) { return c <= '9' ? c - '0' : c - 'a' + 10; };
+        // Keys fit a one-byte digit count; fragments need a varint.
+        if(end - begin <= 255) {
+            out.push_back(TAG_HEX);
+            out.push_back(char(end - begin));
+        } else {
+            out.push_back(TAG_LONG_HEX);
+            PutVarint(out, end - begin);
+        }
+        for(const char *c = begin; c < end; c += 2) {
+            int high = digit_value(c[0]), low = c + 1 < end ? digit_value(c[1]) : 0;
+            out.push_back(char((high << 4) | low));
+        }
+    } else {
+        out.push_back(TAG_STRING);
+        PutVarint(out, end - begin);
+        out.append(begin, end);
+    }
+}
+
+static void PutValue(std::string &out, const Json::Value &value)
+{
+    switch(value.type()) {
+        case Json::nullValue:
+            out.push_back(TAG_NULL);
+            break;
+        case Json::booleanValue:
+            out.push_back(value.asBool() ? TAG_TRUE : TAG_FALSE);
+            break;
+        case Json::intValue: {
+            int64_t n = value.asInt64();
+            out.push_back(TAG_INT);
+            PutVarint(out, (uint64_t(n) << 1) ^ uint64_t(n >> 63));
+            break;
+        }
+        case Json::uintValue:
+            out.push_back(TAG_UINT);
+            PutVarint(out, value.asUInt64());
+            break;
+        case Json::realValue:
+            out.push_back(TAG_REAL);
+            PutReal(out, value.asDouble());
+            break;
+        case Json::stringValue: {
+            const char *begin, *end;
+            value.getString(&begin, &end);
+            PutString(out, begin, end);
+            break;
+        }
+        case Json::arrayValue: {
+            bool all_real = !value.empty();
+            for(const auto &element : value)
+                all_real = all_real && element.type() == Json::realValue;
+
+            out.push_back(all_real ? TAG_REAL_ARRAY : TAG_ARRAY);
+            PutVarint(out, value.size());
+            for(const auto &element : value) {
+                if(all_real)
+                    PutReal(out, element.asDouble());
+                else
+                    PutValue(out, element);
+            }
+            break;
+        }
+        case Json::objectValue:
+            out.push_back(TAG_OBJECT);
+            PutVarint(out, value.size());
+            for(auto it = value.begin(); it != value.end(); it++) {
+                const char *name_end;
+                const char *name = it.memberName(&name_end);
+                PutString(out, name, name_end);
+                PutValue(out, *it);
+            }
+            break;
+    }
+}
+
+/**
+ * Reads values back out of a binary-encoded message, throwing an error if
+ * the message ends early or is otherwise malformed.
+ */
+class BinaryReader {
+public:
+    BinaryReader(const char *begin, const char *end)
+        : pos_(reinterpret_cast<const unsigned char *>(begin))
+        , end_(reinterpret_cast<const unsigned char *>(end))
+    {}
+
+    Json::Value ReadMessage()
+    {
+        Json::Value message = ReadValue(0);
+        if(pos_ != end_)
+            throw std::runtime_error("Trailing bytes after binary message.");
+        return message;
+    }
+
+private:
+    const unsigned char *pos_, *end_;
+
+    void Need(size_t n)
+    {
+        if(size_t(end_ - pos_) < n)
+            throw std::runtime_error("Truncated binary message.");
+    }
+
+    unsigned char ReadByte()
+    {
+        Need(1);
+        return *pos_++;
+    }
+
+    uint64_t ReadVarint()
+    {
+        uint64_t value = 0;
+        for(int shift = 0; shift < 64; shift += 7) {
+            unsigned char byte = ReadByte();
+            value |= uint64_t(byte & 0x7f) << shift;
+            if(!(byte & 0x80))
+                return value;
+        }
+        throw std::runtime_error("Malformed varint in binary message.");
+    }
+
+    double ReadReal()
+    {
+        Need(8);
+        uint64_t bits = 0;
+        for(int i = 0; i < 8; i++)
+            bits |= uint64_t(*pos_++) << (8 * i);
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    uint64_t ReadCount()
+    {
+        // Every element takes at least one byte, so a larger count than there
+        // are bytes left cannot be genuine.
+        uint64_t count = ReadVarint();
+        Need(count);
+        return count;
+    }
+
+    std::string ReadString(unsigned char tag)
+    {
+        switch(tag) {
+            case TAG_TOKEN: {
+                unsigned char index = ReadByte();
+                if(index >= kTokens.size())
+                    throw std::runtime_error("Unknown token in binary message.");
+                return kTokens[index];
+            }
+            case TAG_HEX:
+            case TAG_LONG_HEX: {
+                static const char digits[] = "0123456789abcdef";
+                uint64_t num_digits = tag == TAG_HEX ? ReadByte() : ReadVarint();
+                Need(num_digits / 2 + num_digits % 2);
+                std::string hex(num_digits, '0');
+                for(size_t i = 0; i < num_digits; i++)
+                    hex[i] = digits[(pos_[i / 2] >> (i % 2 ? 0 : 4)) & 0xf];
+                pos_ += num_digits / 2 + num_digits % 2;
+                return hex;
+            }
+            case TAG_STRING: {
+                uint64_t length = ReadCount();
+                std::string str(reinterpret_cast<const char *>(pos_), length);
+                pos_ += length;
+                return str;
+            }
+            default:
+                throw std::runtime_error("Expected string in binary message.");
+        }
+    }
+
+    Json::Value ReadValue(int depth)
+    {
+        if(depth > kMaxDepth)
+            throw std::runtime_error("Binary message nested too deeply.");
+
+        unsigned char tag = ReadByte();
+        switch(tag) {
+            case TAG_NULL:
+                return Json::Value();
+            case TAG_FALSE:
+                return Json::Value(false);
+            case TAG_TRUE:
+                return Json::Value(true);
+            case TAG_INT: {
+                uint64_t zigzag = ReadVarint();
+                return Json::Value(Json::Int64(zigzag >> 1) ^ -Json::Int64(zigzag & 1));
+            }
+            case TAG_UINT:
+                return Json::Value(Json::UInt64(ReadVarint()));
+            case TAG_REAL:
+                return Json::Value(ReadReal());
+            case TAG_TOKEN:
+            case TAG_HEX:
+            case TAG_LONG_HEX:
+            case TAG_STRING:
+                return Json::Value(ReadString(tag));
+            case TAG_ARRAY:
+            case TAG_REAL_ARRAY: {
+                Json::Value array(Json::arrayValue);
+                uint64_t count = ReadCount();
+                array.resize(Json::ArrayIndex(count));
+                for(Json::ArrayIndex i = 0; i < count; i++)
+                    array[i] = tag == TAG_REAL_ARRAY ? Json::Value(ReadReal()) :
+                                                       ReadValue(depth + 1);
+                return array;
+            }
+            case TAG_OBJECT: {
+                Json::Value object(Json::objectValue);
+                uint64_t count = ReadCount();
+                for(uint64_t i = 0; i < count; i++) {
+                    std::string name = ReadString(ReadByte());
+                    object[name] = ReadValue(depth + 1);
+                }
+                return object;
+            }
+            default:
+                throw std::runtime_error("Unknown tag in binary message.");
+        }
+    }
+};
+
+std::string Serialize(const Json::Value &message, WireFormat format)
+{
+    if(format == WireFormat::JSON) {
+        static const Json::StreamWriterBuilder writer;
+        return Json::writeString(writer, message);
+    }
+
+    std::string out;
+    PutValue(out, message);
+    return out;
+}
+
+Json::Value Deserialize(const char *begin, const char *end, WireFormat format)
+{
+    if(format == WireFormat::BINARY)
+        return BinaryReader(begin, end).ReadMessage();
+
+    // CharReader keeps state while parsing, so each thread needs its own.
+    thread_local std::unique_ptr<Json::CharReader> reader(
+            Json::CharReaderBuilder().newCharReader());
+    Json::Value message;
+    JSONCPP_STRING parse_err;
+    if(!reader->parse(begin, end, &message, &parse_err))
+        throw std::runtime_error(parse_err);
+    return message;
+}
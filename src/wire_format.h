@@ -0,0 +1,51 @@
+/**
+ * wire_format.h
+ *
+ * This file implements the two encodings in which requests and responses can
+ * travel between Client and Server:
+ *      - JSON   : Human-readable, useful for debugging with ordinary tools.
+ *      - BINARY : A compact tagged encoding of the same Json::Value tree.
+ *
+ * Handlers only ever see Json::Value, so the binary encoding mirrors JSON's
+ * data model rather than defining a schema per command. It saves space where
+ * the peer protocol spends it:
+ *      - Field names and command names from a fixed table of well-known
+ *        tokens are sent as a single byte;
+ *      - Hex strings (i.e. keys and fragment data) are packed two digits
+ *        per byte;
+ *      - Arrays of doubles are sent as raw 8-byte values;
+ *      - Integers are sent as variable-length integers.
+ *
+ * The encoding of each message is announced in its frame header (see
+ * message_frame.h), and a server always answers in the encoding it was asked
+ * in.
+ */
+
+#ifndef CHORD_FINAL_WIRE_FORMAT_H
+#define CHORD_FINAL_WIRE_FORMAT_H
+
+#include <json/json.h>
+#include <string>
+
+enum class WireFormat { JSON, BINARY };
+
+/**
+ * Serialize a message in the given encoding.
+ *
+ * @param message Message to serialize.
+ * @param format Encoding to use.
+ * @return Serialized message.
+ */
+std::string Serialize(const Json::Value &message, WireFormat format);
+
+/**
+ * Parse a message in the given encoding, throwing an error if it is malformed.
+ *
+ * @param begin Start of serialized message.
+ * @param end End of serialized message.
+ * @param format Encoding in which message was serialized.
+ * @return Parsed message.
+ */
+Json::Value Deserialize(const char *begin, const char *end, WireFormat format);
+
+#endif
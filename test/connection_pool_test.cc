@@ -0,0 +1,196 @@
+#include "../src/connection_pool.h"
+#include <gtest/gtest.h>
+#include <future>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+/**
+ * Test set up: listen on 127.0.0.1:5100, accepting connections on demand, and
+ * run the pool's io_context in the background.
+ */
+class ConnectionPoolTest : public testing::Test {
+protected:
+	ConnectionPoolTest()
+		: acceptor_(server_context_, tcp::endpoint(tcp::v4(), 5100))
+		, work_(boost::asio::make_work_guard(io_context_))
+		, thread_([this] { io_context_.run(); })
+	{}
+
+	~ConnectionPoolTest() override
+	{
+		work_.reset();
+		io_context_.stop();
+		thread_.join();
+	}
+
+	/**
+	 * Accept the next pending connection.
+	 *
+	 * @return Server end of the connection.
+	 */
+	tcp::socket Accept()
+	{
+		return acceptor_.accept();
+	}
+
+	/**
+	 * Read a single request from the server end of a connection.
+	 *
+	 * @param socket Server end of connection.
+	 * @return ID and body of request.
+	 */
+	static std::pair<uint32_t, std::string> ReadFrame(tcp::socket &socket)
+	{
+		FrameHeader header;
+		boost::asio::read(socket, boost::asio::buffer(header));
+		std::string body(DecodeFrameHeader(header), '\0');
+		boost::asio::read(socket, boost::asio::buffer(body));
+		return { FrameRequestId(header), body };
+	}
+
+	/**
+	 * Answer a request from the server end of a connection.
+	 *
+	 * @param socket Server end of connection.
+	 * @param request_id ID of request being answered.
+	 * @param body Body of response.
+	 */
+	static void WriteFrame(tcp::socket &socket, uint32_t request_id,
+	                       const std::string &body)
+	{
+		FrameHeader header = EncodeFrameHeader(body.size(), WireFormat::JSON,
+		                                       request_id);
+		boost::asio::write(socket, boost::asio::buffer(header));
+		boost::asio::write(socket, boost::asio::buffer(body));
+	}
+
+	/**
+	 * Send a request, returning a future for the body of its response.
+	 */
+	static std::future<std::string> Send(Connection &conn,
+	                                     const std::string &body)
+	{
+		auto promise = std::make_shared<std::promise<std::string>>();
+		conn.Send(std::make_shared<const std::string>(body), WireFormat::JSON,
+		          [promise](std::exception_ptr err, WireFormat,
+		                    std::string resp, bool) {
+			if(err)
+				promise->set_exception(err);
+			else
+				promise->set_value(std::move(resp));
+		});
+		return promise->get_future();
+	}
+
+	boost::asio::io_context server_context_;
+	tcp::acceptor acceptor_;
+	boost::asio::io_context io_context_;
+	boost::asio::executor_work_guard<boost::asio::io_context::executor_type>
+			work_;
+	std::thread thread_;
+};
+
+/// Is a connection with nothing in flight handed out again?
+TEST_F(ConnectionPoolTest, ReusesConnection) {
+	ConnectionPool pool(io_context_, 4, 60s);
+	std::shared_ptr<Connection> conn = pool.Get("127.0.0.1", 5100);
+	tcp::socket server_end = Accept();
+
+	EXPECT_EQ(pool.Get("127.0.0.1", 5100), conn);
+	EXPECT_EQ(pool.Size(), 1);
+}
+
+/// Are connections idle for longer than the timeout closed, not reused?
+TEST_F(ConnectionPoolTest, EvictsIdleConnections) {
+	ConnectionPool pool(io_context_, 4, 20ms);
+	std::shared_ptr<Connection> conn = pool.Get("127.0.0.1", 5100);
+	tcp::socket server_end = Accept();
+	EXPECT_EQ(pool.Size(), 1);
+
+	std::this_thread::sleep_for(40ms);
+	pool.EvictIdle();
+	EXPECT_EQ(pool.Size(), 0);
+
+	std::this_thread::sleep_for(10ms);
+	EXPECT_TRUE(conn->IsClosed());
+	EXPECT_NE(pool.Get("127.0.0.1", 5100), conn);
+}
+
+/// Is a connection which the server has closed dropped, not reused?
+TEST_F(ConnectionPoolTest, DropsClosedConnections) {
+	ConnectionPool pool(io_context_, 4, 60s);
+	std::shared_ptr<Connection> conn = pool.Get("127.0.0.1", 5100);
+	Accept().close();
+	std::this_thread::sleep_for(10ms);
+
+	EXPECT_TRUE(conn->IsClosed());
+	std::shared_ptr<Connection> new_conn = pool.Get("127.0.0.1", 5100);
+	EXPECT_NE(new_conn, conn);
+	EXPECT_EQ(pool.Size(), 1);
+}
+
+/// Are no more connections than the maximum opened per endpoint, even when
+/// all of them are busy?
+TEST_F(ConnectionPoolTest, CapsConnectionsPerPeer) {
+	ConnectionPool pool(io_context_, 2, 60s);
+	std::vector<std::shared_ptr<Connection>> conns;
+	std::vector<tcp::socket> server_ends;
+	std::vector<std::future<std::string>> responses;
+	for(int i = 0; i < 4; i++) {
+		conns.push_back(pool.Get("127.0.0.1", 5100));
+		responses.push_back(Send(*conns.back(), "{}"));
+		if(i < 2)
+			server_ends.push_back(Accept());
+	}
+
+	EXPECT_EQ(pool.Size(), 2);
+	EXPECT_NE(conns[0], conns[1]);
+	EXPECT_EQ(conns[0]->InFlight() + conns[1]->InFlight(), 4);
+}
+
+/// May several requests be in flight on one connection, and be answered in
+/// any order?
+TEST_F(ConnectionPoolTest, MultiplexesRequests) {
+	ConnectionPool pool(io_context_, 1, 60s);
+	std::shared_ptr<Connection> conn = pool.Get("127.0.0.1", 5100);
+	tcp::socket server_end = Accept();
+
+	std::future<std::string> slow = Send(*conn, "\"slow\"");
+	std::future<std::string> fast = Send(*conn, "\"fast\"");
+	auto [slow_id, slow_req] = ReadFrame(server_end);
+	auto [fast_id, fast_req] = ReadFrame(server_end);
+	EXPECT_EQ(slow_req, "\"slow\"");
+	EXPECT_EQ(fast_req, "\"fast\"");
+	EXPECT_NE(slow_id, fast_id);
+	EXPECT_EQ(conn->InFlight(), 2);
+
+	WriteFrame(server_end, fast_id, "\"fast response\"");
+	EXPECT_EQ(fast.get(), "\"fast response\"");
+	EXPECT_EQ(slow.wait_for(10ms), std::future_status::timeout);
+
+	WriteFrame(server_end, slow_id, "\"slow response\"");
+	EXPECT_EQ(slow.get(), "\"slow response\"");
+	EXPECT_EQ(conn->InFlight(), 0);
+}
+
+/// Are requests in flight failed, as retryable, when the server closes the
+/// connection?
+TEST_F(ConnectionPoolTest, FailsRequestsOnClose) {
+	ConnectionPool pool(io_context_, 1, 60s);
+	std::shared_ptr<Connection> conn = pool.Get("127.0.0.1", 5100);
+	tcp::socket server_end = Accept();
+	std::this_thread::sleep_for(10ms);
+
+	std::promise<bool> retryable;
+	conn->Send(std::make_shared<const std::string>("{}"), WireFormat::JSON,
+	           [&retryable](std::exception_ptr err, WireFormat, std::string,
+	                        bool can_retry) {
+		retryable.set_value(err && can_retry);
+	});
+	ReadFrame(server_end);
+	server_end.close();
+
+	EXPECT_TRUE(retryable.get_future().get());
+	EXPECT_TRUE(conn->IsClosed());
+}
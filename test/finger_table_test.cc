@@ -0,0 +1,228 @@
+#include "../src/finger_table.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+
+/**
+ * Build a table for the peer with the given id in a ring of num_peers peers,
+ * pointing each finger at the true successor of its lower bound.
+ *
+ * @param id ID of the peer owning the table.
+ * @param num_peers Number of other peers in the ring.
+ * @return Fully-populated finger table.
+ */
+static FingerTable MakeTable(const Key &id, int num_peers)
+{
+	std::vector<PeerRepr> peers;
+	for(int i = 0; i < num_peers; i++) {
+		Key peer_id(std::to_string(i), false);
+		peers.emplace_back(peer_id, peer_id, peer_id, "127.0.0.1", 5000 + i);
+	}
+	std::sort(peers.begin(), peers.end());
+
+	FingerTable table(id);
+	for(int i = 0; i < table.num_entries_; i++) {
+		FingerRange range = table.GetNthRange(i);
+		// Successor is the first peer at or after the lower bound, wrapping
+		// around to the lowest peer.
+		PeerRepr succ = peers.front();
+		for(const PeerRepr &peer : peers) {
+			if(peer.id_ >= range.first) {
+				succ = peer;
+				break;
+			}
+		}
+		table.AddFinger(Finger { range.first, range.second, succ });
+	}
+	return table;
+}
+
+/// Does the direct index computation agree with a scan of the table?
+TEST(FingerTable, LookupMatchesLinearScan) {
+	FingerTable table = MakeTable(Key("peer", false), 32);
+	for(int i = 0; i < 1000; i++) {
+		Key key(std::to_string(i) + "key", false);
+		EXPECT_EQ(table.Lookup(key), table.LinearLookup(key));
+	}
+}
+
+/// Are the smallest and largest fingers resolved correctly?
+TEST(FingerTable, LookupRangeEdges) {
+	Key id("peer", false);
+	FingerTable table = MakeTable(id, 32);
+	EXPECT_EQ(table.Lookup(id + 1), table.GetNthEntry(0).successor_);
+	EXPECT_EQ(table.Lookup(id - 1), table.GetNthEntry(127).successor_);
+	EXPECT_THROW(table.Lookup(id), std::runtime_error);
+}
+
+/// Do the precomputed ranges match (start + 2^n) mod 2^m computed with
+/// multiprecision arithmetic, even for IDs with leading zero digits?
+TEST(FingerTable, PrecomputedRanges) {
+	mp::cpp_int keys_in_ring = mp::pow(mp::cpp_int(2), Key::kNumBits);
+	for(const Key &id : { Key("peer", false), Key("00ab", true), Key(0) }) {
+		FingerTable table(id);
+		ASSERT_EQ(table.GetRanges().size(), Key::kNumBits);
+		mp::cpp_int start = id;
+		for(int n = 0; n < table.num_entries_; n++) {
+			mp::cpp_int lower = (start + mp::pow(mp::cpp_int(2), n))
+			                    % keys_in_ring;
+			mp::cpp_int upper = (start + mp::pow(mp::cpp_int(2), n + 1) - 1)
+			                    % keys_in_ring;
+			EXPECT_EQ(table.GetNthRange(n).first, Key(mp::uint256_t(lower)));
+			EXPECT_EQ(table.GetNthRange(n).second, Key(mp::uint256_t(upper)));
+		}
+	}
+}
+
+/// Does the table store one successor per run rather than per finger?
+TEST(FingerTable, CompressedRuns) {
+	FingerTable table = MakeTable(Key("peer", false), 32);
+	EXPECT_EQ(table.Size(), 128);
+	EXPECT_LE(table.NumRuns(), 33);
+
+	// Splitting a run in the middle should create two new runs; reverting
+	// the edit should merge them back.
+	unsigned long num_runs = table.NumRuns();
+	PeerRepr old_succ = table.GetNthEntry(120).successor_;
+	PeerRepr other(Key("other", false), Key("other", false),
+	               Key("other", false), "127.0.0.1", 6000);
+	table.EditNthFinger(120, other);
+	EXPECT_EQ(table.GetNthEntry(120).successor_, other);
+	EXPECT_EQ(table.GetNthEntry(119).successor_, old_succ);
+	EXPECT_EQ(table.GetNthEntry(121).successor_, old_succ);
+	EXPECT_EQ(table.NumRuns(), num_runs + 2);
+	table.EditNthFinger(120, old_succ);
+	EXPECT_EQ(table.NumRuns(), num_runs);
+}
+
+/// Does AdjustFingers update exactly the fingers whose lower bound falls in
+/// the new peer's range?
+TEST(FingerTable, AdjustFingers) {
+	Key id("peer", false);
+	FingerTable table = MakeTable(id, 32);
+	std::vector<PeerRepr> before;
+	for(int n = 0; n < table.Size(); n++)
+		before.push_back(table.GetNthEntry(n).successor_);
+
+	// A range that wraps around the starting key touches both ends of the
+	// table.
+	Key min_key = table.GetNthRange(127).first;
+	PeerRepr new_peer(id + 16, min_key, id + 16, "127.0.0.1", 6000);
+	table.AdjustFingers(new_peer);
+	for(int n = 0; n < table.Size(); n++) {
+		Finger finger = table.GetNthEntry(n);
+		bool in_range = finger.lower_bound_.InBetween(new_peer.min_key_,
+		                                              new_peer.max_key_, true);
+		EXPECT_EQ(finger.successor_, in_range ? new_peer : before[n]);
+	}
+	EXPECT_EQ(table.Lookup(id + 1), new_peer);
+	EXPECT_EQ(table.Lookup(id - 1), new_peer);
+}
+
+/// Fingers must be added in range order.
+TEST(FingerTable, AddFingerOutOfOrder) {
+	Key id("peer", false);
+	FingerTable table(id);
+	FingerRange range = table.GetNthRange(1);
+	EXPECT_THROW(table.AddFinger(Finger { range.first, range.second,
+	                                      PeerRepr(id, id, id, "", 0) }),
+	             std::runtime_error);
+	EXPECT_TRUE(table.Empty());
+}
+
+/// Does Lookup favor a faster peer between the finger's lower bound and the
+/// key, without ever passing the key, once measurements are chosen from?
+TEST(FingerTable, ProximityNeighborSelection) {
+	Key id("peer", false);
+	FingerTable table(id);
+	FingerRange top = table.GetNthRange(127);
+	for(int n = 0; n < table.num_entries_; n++) {
+		FingerRange range = table.GetNthRange(n);
+		Key succ_id = n < 127 ? top.first : top.first + 10;
+		table.AddFinger(Finger { range.first, range.second,
+		                         PeerRepr(succ_id, succ_id, succ_id,
+		                                  "127.0.0.1", 5000) });
+	}
+	PeerRepr succ = table.GetNthEntry(127).successor_;
+	Key near_id = top.first + 100, far_id = top.first + 1000;
+	PeerRepr near(near_id, near_id, near_id, "127.0.0.1", 5001),
+	         far(far_id, far_id, far_id, "127.0.0.1", 5002);
+
+	// Without measurements, the finger's successor is used.
+	LatencyTable latencies;
+	table.ChooseProximatePeers(latencies);
+	EXPECT_EQ(table.Lookup(top.first + 500), succ);
+
+	// Measurements only count once chosen from.
+	latencies.Record(succ, 0.5f);
+	latencies.Record(near, 0.1f);
+	latencies.Record(far, 0.01f);
+	EXPECT_EQ(table.Lookup(top.first + 500), succ);
+	table.ChooseProximatePeers(latencies);
+	// "far" is faster, but lies past the key.
+	EXPECT_EQ(table.Lookup(top.first + 500).port_, near.port_);
+	EXPECT_EQ(table.Lookup(top.first + 5000).port_, far.port_);
+	// Keys before any faster peer still go to the successor.
+	EXPECT_EQ(table.Lookup(top.first + 50), succ);
+
+	// The moving average should take several slow samples to overtake.
+	latencies.Record(near, 1.0f);
+	table.ChooseProximatePeers(latencies);
+	EXPECT_EQ(table.Lookup(top.first + 500).port_, near.port_);
+
+	latencies.Forget(near.id_);
+	table.ChooseProximatePeers(latencies);
+	EXPECT_EQ(table.Lookup(top.first + 500), succ);
+
+	// Editing a finger drops its run's choices until they are next chosen.
+	table.EditNthFinger(127, far);
+	EXPECT_EQ(table.Lookup(top.first + 5000), far);
+}
+
+/// Are only the PNS_CANDIDATES fastest peers of a run kept?
+TEST(FingerTable, ProximateCandidatesBounded) {
+	Key id("peer", false);
+	FingerTable table = MakeTable(id, 32);
+	auto last_run = std::prev(table.GetRuns().end());
+	PeerRepr succ = last_run->successor_;
+
+	LatencyTable latencies;
+	latencies.Record(succ, 1.0f);
+	for(int i = 1; i <= 3 * PNS_CANDIDATES; i++) {
+		Key peer_id = id - i;
+		latencies.Record(PeerRepr(peer_id, peer_id, peer_id, "127.0.0.1",
+		                          6000 + i), 0.01f * i);
+	}
+	table.ChooseProximatePeers(latencies);
+
+	const std::vector<PeerRepr> &proximate =
+			std::prev(table.GetRuns().end())->proximate_;
+	ASSERT_EQ(proximate.size(), PNS_CANDIDATES);
+	for(int i = 0; i < PNS_CANDIDATES; i++)
+		EXPECT_EQ(proximate[i].port_, 6001 + i);
+	// The fastest peer not past the key is taken, even if not the fastest.
+	EXPECT_EQ(table.Lookup(id - 2).port_, 6002);
+	EXPECT_EQ(table.Lookup(id - 1).port_, 6001);
+}
+
+/// Routing snapshots are copies of a table, so editing a copy, or choosing
+/// its proximate peers, must leave the original untouched.
+TEST(FingerTable, CopiesAreIndependent) {
+	Key id("peer", false);
+	FingerTable table = MakeTable(id, 32);
+	FingerTable copy = table;
+	PeerRepr new_peer(id + 1, id + 1, id + 1, "127.0.0.1", 6000);
+
+	copy.EditNthFinger(0, new_peer);
+	EXPECT_EQ(copy.GetNthEntry(0).successor_, new_peer);
+	EXPECT_FALSE(table.GetNthEntry(0).successor_ == new_peer);
+	EXPECT_EQ(&copy.GetRanges(), &table.GetRanges());
+
+	PeerRepr succ = table.GetNthEntry(127).successor_;
+	PeerRepr faster(id - 2, id - 2, id - 2, "127.0.0.1", 6001);
+	LatencyTable latencies;
+	latencies.Record(succ, 0.5);
+	latencies.Record(faster, 0.1);
+	copy.ChooseProximatePeers(latencies);
+	EXPECT_EQ(copy.Lookup(id - 1), faster);
+	EXPECT_EQ(table.Lookup(id - 1), succ);
+}
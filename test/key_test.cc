@@ -34,4 +34,33 @@ TEST(KeyInBetweenTest, DifferingLengths) {
         ub("f4ee136cb4059b2883450e7e93698bd", true);
 
 	EXPECT_FALSE(key.InBetween(lb, ub, true));
-}
\ No newline at end of file
+}
+
+TEST(KeyArithmeticTest, WrapsAroundRing) {
+	// Keys live on a ring of 2^128 values, so arithmetic must wrap.
+	Key max_key("ffffffffffffffffffffffffffffffff", true);
+	EXPECT_EQ(max_key + 1, Key(0));
+	EXPECT_EQ(Key(0) - 1, max_key);
+	EXPECT_EQ(Key(5) - Key(7), max_key - 1);
+	// Carries and borrows must cross the word boundary.
+	Key word_boundary("10000000000000000", true);
+	EXPECT_EQ(word_boundary - 1, Key("ffffffffffffffff", true));
+	EXPECT_EQ(Key("ffffffffffffffff", true) + 1, word_boundary);
+}
+
+TEST(KeyArithmeticTest, HexRoundTrip) {
+	std::string hex = "633bd46b5c515992a5ce553d0680bec9";
+	EXPECT_EQ(std::string(Key(hex, true)), hex);
+	// Leading zeros are not written.
+	EXPECT_EQ(std::string(Key("000abc", true)), "abc");
+	EXPECT_EQ(std::string(Key(0)), "0");
+	EXPECT_EQ(Key("f4ee136cb4059b2883450e7e93698be", true).Size(), 31);
+}
+
+TEST(KeyArithmeticTest, Ordering) {
+	Key low("ffffffffffffffff", true), high("10000000000000000", true);
+	EXPECT_TRUE(low < high);
+	EXPECT_TRUE(high > low);
+	EXPECT_TRUE(low <= low);
+	EXPECT_FALSE(low >= high);
+}
@@ -0,0 +1,121 @@
+#include "../src/local_transport.h"
+#include "../src/client.h"
+#include "../src/server.h"
+#include <gtest/gtest.h>
+#include <functional>
+#include <future>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+/// Class on which the test server's commands are called.
+class LocalEchoClass {
+public:
+    /**
+     * Echo the value in a JSON request.
+     *
+     * @param request JSON request with field "VALUE".
+     * @return JSON response containing field "VALUE" = original value.
+     */
+    [[nodiscard]] Json::Value echo(const Json::Value &request) const
+    {
+        Json::Value resp;
+        resp["VALUE"] = request["VALUE"];
+        return resp;
+    }
+};
+
+typedef std::function<Json::Value(LocalEchoClass, const Json::Value &)>
+        LocalEchoMethod;
+
+/// A registered endpoint should be answered even with nothing listening on
+/// it, and no longer once unregistered.
+TEST(LocalTransport, BypassesNetwork) {
+    LocalTransport::Default().Listen("127.0.0.1", 5997,
+                                     [](Json::Value request,
+                                        Transport::ResponseHandler handler) {
+        request["SUCCESS"] = true;
+        handler(nullptr, request);
+    });
+    Client client;
+
+    Json::Value req;
+    req["VALUE"] = "local";
+    EXPECT_EQ("local", client.MakeRequest("127.0.0.1", 5997, req)["VALUE"]
+                               .asString());
+
+    // Only the exact endpoint registered is answered locally.
+    EXPECT_ANY_THROW(client.MakeRequest("127.0.0.1", 5998, req));
+
+    LocalTransport::Default().Unlisten("127.0.0.1", 5997);
+    EXPECT_ANY_THROW(client.MakeRequest("127.0.0.1", 5997, req));
+}
+
+/// A server answering local requests should do so just as it would over the
+/// network, and stop once killed.
+TEST(LocalTransport, ServerDispatch) {
+    LocalEchoClass request_inst;
+    std::map<std::string, LocalEchoMethod> commands {
+            {"ECHO", std::mem_fn(&LocalEchoClass::echo)}
+    };
+    Server<LocalEchoMethod, LocalEchoClass> server_inst(5105, commands,
+                                                        &request_inst);
+    server_inst.RunInBackground();
+    LocalTransport::Default().Listen("127.0.0.1", 5105,
+                                     [&server_inst](Json::Value request,
+                                                    Transport::ResponseHandler
+                                                            handler) {
+        server_inst.Dispatch(std::move(request), std::move(handler));
+    });
+    Client client;
+
+    Json::Value echo_req;
+    echo_req["COMMAND"] = "ECHO";
+    echo_req["VALUE"] = 7;
+    Json::Value resp = client.MakeRequest("127.0.0.1", 5105, echo_req);
+    EXPECT_TRUE(resp["SUCCESS"].asBool());
+    EXPECT_EQ(7, resp["VALUE"].asInt());
+
+    Json::Value invalid_req;
+    invalid_req["COMMAND"] = "NOT_A_COMMAND";
+    resp = client.MakeRequest("127.0.0.1", 5105, invalid_req);
+    EXPECT_FALSE(resp["SUCCESS"].asBool());
+    EXPECT_EQ("Invalid command.", resp["ERRORS"].asString());
+
+    server_inst.Kill();
+    EXPECT_ANY_THROW(client.MakeRequest("127.0.0.1", 5105, echo_req));
+    LocalTransport::Default().Unlisten("127.0.0.1", 5105);
+}
+
+/// A request dispatched to a server which never gets to handle it should
+/// still be answered, with an error, once the server is destroyed.
+TEST(LocalTransport, UnhandledDispatch) {
+    LocalEchoClass request_inst;
+    std::map<std::string, LocalEchoMethod> commands {
+            {"ECHO", std::mem_fn(&LocalEchoClass::echo)}
+    };
+    std::promise<std::string> error;
+    {
+        // Never run, so nothing posted to it is handled.
+        Server<LocalEchoMethod, LocalEchoClass> server_inst(5106, commands,
+                                                            &request_inst, 1,
+                                                            {}, false);
+        Json::Value echo_req;
+        echo_req["COMMAND"] = "ECHO";
+        server_inst.Dispatch(echo_req, [&error](std::exception_ptr err,
+                                                Json::Value resp) {
+            if(! err)
+                return error.set_value("");
+            try {
+                std::rethrow_exception(err);
+            } catch(const std::exception &ex) {
+                error.set_value(ex.what());
+            } catch(...) {
+                error.set_value("");
+            }
+        });
+    }
+    auto answer = error.get_future();
+    ASSERT_EQ(std::future_status::ready, answer.wait_for(0s));
+    EXPECT_EQ("Server killed.", answer.get());
+}
@@ -0,0 +1,97 @@
+#include "../src/location_cache.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+/**
+ * Build a successor list of peers with the given IDs.
+ *
+ * @param ids IDs of successors, in order.
+ * @return Successor list.
+ */
+static std::vector<PeerRepr> MakeSuccs(const std::vector<uint64_t> &ids)
+{
+	std::vector<PeerRepr> succs;
+	for(uint64_t id : ids)
+		succs.emplace_back(Key(id), Key(id), Key(id), "127.0.0.1", 5000 + id);
+	return succs;
+}
+
+/// Are keys within a cached range hits, and keys outside it misses?
+TEST(LocationCache, HitsWithinRange) {
+	LocationCache cache(16, 60s);
+	cache.Insert(Key(10), Key(20), MakeSuccs({ 20, 30, 40 }));
+
+	std::vector<PeerRepr> succs;
+	EXPECT_TRUE(cache.Lookup(Key(10), succs));
+	EXPECT_TRUE(cache.Lookup(Key(15), succs));
+	EXPECT_TRUE(cache.Lookup(Key(20), succs));
+	EXPECT_EQ(succs, MakeSuccs({ 20, 30, 40 }));
+	EXPECT_FALSE(cache.Lookup(Key(9), succs));
+	EXPECT_FALSE(cache.Lookup(Key(21), succs));
+
+	EXPECT_EQ(cache.Hits(), 3);
+	EXPECT_EQ(cache.Misses(), 2);
+}
+
+/// Is a range crossing zero found from either side of zero?
+TEST(LocationCache, WrappingRange) {
+	LocationCache cache(16, 60s);
+	cache.Insert(Key(100), Key(200), MakeSuccs({ 200 }));
+	cache.Insert(Key(0) - 5, Key(5), MakeSuccs({ 5, 100 }));
+
+	std::vector<PeerRepr> succs;
+	EXPECT_TRUE(cache.Lookup(Key(0) - 1, succs));
+	EXPECT_EQ(succs, MakeSuccs({ 5, 100 }));
+	EXPECT_TRUE(cache.Lookup(Key(3), succs));
+	EXPECT_EQ(succs, MakeSuccs({ 5, 100 }));
+	EXPECT_FALSE(cache.Lookup(Key(0) - 6, succs));
+}
+
+/// Are entries dropped once their TTL has passed?
+TEST(LocationCache, ExpiresAfterTtl) {
+	LocationCache cache(16, 20ms);
+	cache.Insert(Key(10), Key(20), MakeSuccs({ 20 }));
+
+	std::vector<PeerRepr> succs;
+	EXPECT_TRUE(cache.Lookup(Key(15), succs));
+	std::this_thread::sleep_for(40ms);
+	EXPECT_FALSE(cache.Lookup(Key(15), succs));
+	EXPECT_EQ(cache.Size(), 0);
+}
+
+/// Are entries which list or span a failed/joining peer dropped?
+TEST(LocationCache, InvalidatePeer) {
+	LocationCache cache(16, 60s);
+	cache.Insert(Key(10), Key(20), MakeSuccs({ 20, 30, 40 }));
+	cache.Insert(Key(41), Key(50), MakeSuccs({ 50, 60 }));
+
+	// A new peer at 35 belongs on the first list, but not the second.
+	cache.InvalidatePeer(Key(35));
+	std::vector<PeerRepr> succs;
+	EXPECT_FALSE(cache.Lookup(Key(15), succs));
+	EXPECT_TRUE(cache.Lookup(Key(45), succs));
+
+	cache.InvalidatePeer(Key(60));
+	EXPECT_FALSE(cache.Lookup(Key(45), succs));
+}
+
+/// Does a full cache evict its oldest entry, and does a new view of a range
+/// replace the old one?
+TEST(LocationCache, EvictionAndReplacement) {
+	LocationCache cache(2, 60s);
+	cache.Insert(Key(10), Key(20), MakeSuccs({ 20 }));
+	cache.Insert(Key(30), Key(40), MakeSuccs({ 40 }));
+	cache.Insert(Key(50), Key(60), MakeSuccs({ 60 }));
+	EXPECT_EQ(cache.Size(), 2);
+
+	std::vector<PeerRepr> succs;
+	EXPECT_FALSE(cache.Lookup(Key(15), succs));
+	EXPECT_TRUE(cache.Lookup(Key(35), succs));
+
+	// A peer at 35 has joined, splitting [30, 40].
+	cache.Insert(Key(30), Key(35), MakeSuccs({ 35, 40 }));
+	EXPECT_TRUE(cache.Lookup(Key(32), succs));
+	EXPECT_EQ(succs, MakeSuccs({ 35, 40 }));
+}
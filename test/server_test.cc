@@ -6,6 +6,7 @@
 #include <memory>
 #include <chrono>
 #include <deque>
+#include <future>
 
 using namespace std::chrono_literals;
 
@@ -58,6 +59,32 @@ public:
 			throw std::runtime_error("Invalid value.");
         return resp;
     }
+
+    /**
+     * Echo the value in a JSON request.
+     *
+     * @param request JSON request with field "VALUE".
+     * @return JSON response containing field "VALUE" = original value.
+     */
+    [[nodiscard]] Json::Value echo(const Json::Value &request) const
+    {
+        Json::Value resp;
+        resp["VALUE"] = request["VALUE"];
+        return resp;
+    }
+
+    /**
+     * Wait for some time, then echo the value in a JSON request.
+     *
+     * @param request JSON request with fields "VALUE" and "DELAY_MS".
+     * @return JSON response containing field "VALUE" = original value.
+     */
+    [[nodiscard]] Json::Value slow_echo(const Json::Value &request) const
+    {
+        std::this_thread::sleep_for(
+                std::chrono::milliseconds(request["DELAY_MS"].asInt()));
+        return echo(request);
+    }
 };
 
 typedef std::function<Json::Value(RequestClass, const Json::Value &)> RequestClassMethod;
@@ -70,7 +97,8 @@ public:
         auto *request_inst = new RequestClass(1);
         std::map<std::string, RequestClassMethod> commands {
 				{"ADD_1", std::mem_fn(&RequestClass::add_n)},
-                {"SUB_1", std::mem_fn(&RequestClass::sub_n)}
+                {"SUB_1", std::mem_fn(&RequestClass::sub_n)},
+                {"ECHO", std::mem_fn(&RequestClass::echo)}
 		};
         server_ = new Server<RequestClassMethod, RequestClass>(5000, commands,
 		                                                       request_inst);
@@ -83,6 +111,8 @@ public:
 
     static void TearDownTestSuite() {
         server_->Kill();
+        // Spin until server exits "accept" loop, freeing the port.
+        std::this_thread::sleep_for(10ms);
     }
 
     static Server<RequestClassMethod, RequestClass> *server_;
@@ -158,6 +188,80 @@ TEST_F(RequestTest, MissingValue) {
     EXPECT_EQ("Invalid value.", missing_val_resp["ERRORS"].asString());
 }
 
+/// Requests and responses far larger than any single socket read must arrive
+/// intact in both directions.
+TEST_F(RequestTest, LargeMessage) {
+    std::string big_value(1 << 20, 'x');
+    for(size_t i = 0; i < big_value.size(); i += 97)
+        big_value[i] = '}';
+
+    Json::Value echo_req;
+    echo_req["COMMAND"] = "ECHO";
+    echo_req["VALUE"] = big_value;
+
+    Json::Value echo_resp = request_maker_->MakeRequest("127.0.0.1", 5000,
+                                                        echo_req);
+    EXPECT_TRUE(echo_resp["SUCCESS"].asBool());
+    EXPECT_EQ(big_value, echo_resp["VALUE"].asString());
+}
+
+/// JSON remains available for debugging: the server must answer a JSON
+/// client in JSON.
+TEST_F(RequestTest, JsonClient) {
+    Client json_client(WireFormat::JSON);
+    Json::Value add_one_req;
+    add_one_req["COMMAND"] = "ADD_1";
+    add_one_req["VALUE"] = 41;
+
+    Json::Value add_one_resp = json_client.MakeRequest("127.0.0.1", 5000,
+                                                       add_one_req);
+    EXPECT_TRUE(add_one_resp["SUCCESS"].asBool());
+    EXPECT_EQ(42, add_one_resp["VALUE"].asInt());
+}
+
+/// Many asynchronous requests may be in flight at once, and each future
+/// should hold the response to its own request. There are more than a
+/// session reads before answering any, so it must resume reading as it
+/// answers them.
+TEST_F(RequestTest, AsyncRequests) {
+    const int num_requests = 4 * SESSION_MAX_IN_FLIGHT *
+                             POOL_CONNECTIONS_PER_PEER;
+    std::vector<std::future<Json::Value>> responses;
+    for(int i = 1; i <= num_requests; i++) {
+        Json::Value add_one_req;
+        add_one_req["COMMAND"] = "ADD_1";
+        add_one_req["VALUE"] = i;
+        responses.push_back(request_maker_->MakeRequestAsync("127.0.0.1", 5000,
+                                                             add_one_req));
+    }
+
+    for(int i = 1; i <= num_requests; i++) {
+        Json::Value add_one_resp = responses[i - 1].get();
+        EXPECT_TRUE(add_one_resp["SUCCESS"].asBool());
+        EXPECT_EQ(i + 1, add_one_resp["VALUE"].asInt());
+    }
+}
+
+/// Completion handlers should receive the response, or the error which
+/// prevented one (here, that no server is listening).
+TEST_F(RequestTest, AsyncHandler) {
+    Json::Value sub_one_req;
+    sub_one_req["COMMAND"] = "SUB_1";
+    sub_one_req["VALUE"] = 1;
+
+    std::promise<int> value;
+    request_maker_->MakeRequestAsync("127.0.0.1", 5000, sub_one_req,
+                                     [&value](std::exception_ptr err,
+                                              Json::Value resp) {
+        value.set_value(err ? -1 : resp["VALUE"].asInt());
+    });
+    EXPECT_EQ(0, value.get_future().get());
+
+    std::future<Json::Value> dead = request_maker_->MakeRequestAsync(
+            "127.0.0.1", 5999, sub_one_req);
+    EXPECT_ANY_THROW(dead.get());
+}
+
 /// The server should call handlers (methods of a template parameter
 /// "RequestClass") on an up-to-date version of "RequestClass".
 /// If we change the members of RequestClass, does the server's behavior
@@ -236,6 +340,148 @@ TEST(ServerMiscellaneous, Overflow) {
 	EXPECT_EQ(true, true);
 }
 
+/// Clients keep connections open between requests. Killing a server must
+/// close those as well, so that requests over them fail.
+TEST(Client, KillClosesOpenConnections) {
+    auto *request_inst = new RequestClass(1);
+    std::map<std::string, RequestClassMethod> commands {
+            {"ADD_1", std::mem_fn(&RequestClass::add_n)}
+    };
+    TestServer server_inst(5101, commands, request_inst);
+    server_inst.RunInBackground();
+    std::this_thread::sleep_for(10ms);
+    Client client;
+
+    Json::Value add_one_req;
+    add_one_req["COMMAND"] = "ADD_1";
+    add_one_req["VALUE"] = 1;
+    EXPECT_EQ(2, client.MakeRequest("127.0.0.1", 5101, add_one_req)["VALUE"]
+                         .asInt());
+    EXPECT_EQ(2, client.MakeRequest("127.0.0.1", 5101, add_one_req)["VALUE"]
+                         .asInt());
+
+    server_inst.Kill();
+    std::this_thread::sleep_for(10ms);
+    EXPECT_ANY_THROW(client.MakeRequest("127.0.0.1", 5101, add_one_req));
+}
+
+/// A server run on several threads should handle requests on different
+/// connections in parallel, so slow handlers do not hold each other up.
+TEST(ServerMiscellaneous, ConcurrentSessions) {
+    auto *request_inst = new RequestClass(1);
+    std::map<std::string, RequestClassMethod> commands {
+            {"SLOW_ECHO", std::mem_fn(&RequestClass::slow_echo)}
+    };
+    TestServer server_inst(5102, commands, request_inst, 4);
+    server_inst.RunInBackground();
+    std::this_thread::sleep_for(10ms);
+    Client client;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::future<Json::Value>> responses;
+    for(int i = 1; i <= 4; i++) {
+        Json::Value slow_echo_req;
+        slow_echo_req["COMMAND"] = "SLOW_ECHO";
+        slow_echo_req["VALUE"] = i;
+        slow_echo_req["DELAY_MS"] = 300;
+        responses.push_back(client.MakeRequestAsync("127.0.0.1", 5102,
+                                                    slow_echo_req));
+    }
+
+    for(int i = 1; i <= 4; i++)
+        EXPECT_EQ(i, responses[i - 1].get()["VALUE"].asInt());
+    EXPECT_LT(std::chrono::steady_clock::now() - start, 900ms);
+
+    server_inst.Kill();
+    std::this_thread::sleep_for(10ms);
+}
+
+/// Every registered command should resolve to its own handler, however many
+/// are registered, and unregistered names to none.
+TEST(ServerMiscellaneous, CommandTable) {
+    std::map<std::string, RequestClassMethod> commands;
+    for(int i = 0; i < 200; i++)
+        commands["COMMAND_" + std::to_string(i)] =
+                [i](RequestClass, const Json::Value &) {
+                  Json::Value resp;
+                  resp["VALUE"] = i;
+                  return resp;
+                };
+    CommandTable<RequestClassMethod, RequestClass> table(commands);
+    EXPECT_EQ(200, table.Size());
+
+    RequestClass request_inst(1);
+    for(int i = 0; i < 200; i++) {
+        auto opcode = table.Opcode("COMMAND_" + std::to_string(i));
+        ASSERT_TRUE(opcode.has_value());
+        Json::Value resp;
+        table.Call(*opcode, request_inst, Json::Value(),
+                   [&resp](std::exception_ptr, Json::Value value) {
+                     resp = std::move(value);
+                   });
+        EXPECT_EQ(i, resp["VALUE"].asInt());
+    }
+    EXPECT_FALSE(table.Opcode("COMMAND_200").has_value());
+    EXPECT_FALSE(table.Opcode("").has_value());
+
+    CommandTable<RequestClassMethod, RequestClass> empty_table({});
+    EXPECT_FALSE(empty_table.Opcode("ADD_1").has_value());
+}
+
+/// An asynchronous handler may answer after it returns, from another thread,
+/// without holding up requests behind it on a single-threaded server.
+TEST(ServerMiscellaneous, AsyncHandlers) {
+    auto *request_inst = new RequestClass(1);
+    std::map<std::string, RequestClassMethod> commands {
+            {"ECHO", std::mem_fn(&RequestClass::echo)}
+    };
+    TestServer::AsyncCommandMap async_commands {
+            {"DEFERRED_ECHO", [](RequestClass &inst, const Json::Value &request,
+                                 Responder respond) {
+              std::thread([inst, request, respond] {
+                std::this_thread::sleep_for(300ms);
+                respond(nullptr, inst.echo(request));
+              }).detach();
+            }},
+            {"DEFERRED_FAIL", [](RequestClass &, const Json::Value &,
+                                 Responder respond) {
+              respond(std::make_exception_ptr(std::runtime_error("Failed.")),
+                      Json::Value());
+            }}
+    };
+    TestServer server_inst(5103, commands, request_inst, 1, async_commands);
+    server_inst.RunInBackground();
+    std::this_thread::sleep_for(10ms);
+    Client client;
+
+    Json::Value deferred_req;
+    deferred_req["COMMAND"] = "DEFERRED_ECHO";
+    deferred_req["VALUE"] = 1;
+    auto deferred_resp = client.MakeRequestAsync("127.0.0.1", 5103,
+                                                 deferred_req);
+
+    Json::Value echo_req;
+    echo_req["COMMAND"] = "ECHO";
+    echo_req["VALUE"] = 2;
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(2, client.MakeRequest("127.0.0.1", 5103, echo_req)["VALUE"]
+                         .asInt());
+    EXPECT_LT(std::chrono::steady_clock::now() - start, 200ms);
+
+    Json::Value resp = deferred_resp.get();
+    EXPECT_TRUE(resp["SUCCESS"].asBool());
+    EXPECT_EQ(1, resp["VALUE"].asInt());
+
+    Json::Value fail_req;
+    fail_req["COMMAND"] = "DEFERRED_FAIL";
+    resp = client.MakeRequest("127.0.0.1", 5103, fail_req);
+    EXPECT_FALSE(resp["SUCCESS"].asBool());
+    EXPECT_EQ("Failed.", resp["ERRORS"].asString());
+
+    server_inst.Kill();
+    std::this_thread::sleep_for(10ms);
+}
+
 /// This test tests both the functionality of "Server::is_alive" and the
 /// "Server::Kill" method.
 TEST(Client, AliveAndDead) {
@@ -0,0 +1,180 @@
+#include "../src/simulated_transport.h"
+#include "../src/client.h"
+#include "../src/peer.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
+
+using namespace std::chrono_literals;
+
+/**
+ * Listen on ip_addr:port, echoing each request back as its response.
+ */
+static void ListenEcho(SimulatedTransport &transport,
+                       const std::string &ip_addr, unsigned short port)
+{
+    transport.Listen(ip_addr, port, [](Json::Value request,
+                                       Transport::ResponseHandler handler) {
+        request["SUCCESS"] = true;
+        handler(nullptr, request);
+    });
+}
+
+/**
+ * Time a request made over the transport.
+ *
+ * @return Time from sending the request to receiving its response.
+ */
+static std::chrono::milliseconds TimeRequest(Client &client,
+                                             const std::string &ip_addr,
+                                             unsigned short port,
+                                             const Json::Value &request)
+{
+    auto start = std::chrono::steady_clock::now();
+    client.MakeRequest(ip_addr, port, request);
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+}
+
+/// Does a round trip take twice the link's latency, and does a link set for
+/// one endpoint leave the others alone?
+TEST(SimulatedTransport, Latency) {
+    SimulatedTransport transport({ 20ms, 0ms, 0, 0 });
+    transport.SetLinkProfile("10.0.0.2", 1, { 100ms, 0ms, 0, 0 });
+    ListenEcho(transport, "10.0.0.1", 1);
+    ListenEcho(transport, "10.0.0.2", 1);
+    Client client(WireFormat::BINARY, &transport);
+
+    Json::Value req;
+    req["VALUE"] = "echo";
+    std::chrono::milliseconds fast = TimeRequest(client, "10.0.0.1", 1, req);
+    EXPECT_GE(fast, 40ms);
+    EXPECT_LT(fast, 150ms);
+    EXPECT_GE(TimeRequest(client, "10.0.0.2", 1, req), 200ms);
+    EXPECT_EQ("echo", client.MakeRequest("10.0.0.1", 1, req)["VALUE"]
+                              .asString());
+}
+
+/// Are messages queued behind one another on a link of limited bandwidth?
+TEST(SimulatedTransport, Bandwidth) {
+    // 100 KB/s each way.
+    SimulatedTransport transport({ 0ms, 0ms, 0, 100000 });
+    ListenEcho(transport, "10.0.0.1", 1);
+    Client client(WireFormat::BINARY, &transport);
+
+    // ~10 KB in each direction takes ~200ms.
+    Json::Value req;
+    req["VALUE"] = std::string(10000, 'x');
+    EXPECT_GE(TimeRequest(client, "10.0.0.1", 1, req), 190ms);
+
+    // Two sent together share the link: the second request queues behind
+    // the first on the way in, and so does its response on the way out.
+    auto start = std::chrono::steady_clock::now();
+    std::future<Json::Value> first = client.MakeRequestAsync("10.0.0.1", 1,
+                                                             req);
+    std::future<Json::Value> second = client.MakeRequestAsync("10.0.0.1", 1,
+                                                              req);
+    first.get();
+    second.get();
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 290ms);
+}
+
+/// Does a lost message leave the client to time out?
+TEST(SimulatedTransport, Loss) {
+    SimulatedTransport transport({ 1ms, 0ms, 1, 0 });
+    ListenEcho(transport, "10.0.0.1", 1);
+    Client client(WireFormat::BINARY, &transport);
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_ANY_THROW(client.MakeRequest("10.0.0.1", 1, Json::Value()));
+    EXPECT_GE(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(SIM_LOSS_TIMEOUT_MS));
+    EXPECT_EQ(transport.GetStats().lost_, 1);
+}
+
+/// Is an endpoint with nothing listening refused, and seen as dead?
+TEST(SimulatedTransport, UnknownEndpoint) {
+    SimulatedTransport transport({ 1ms, 0ms, 0, 0 });
+    ListenEcho(transport, "10.0.0.1", 1);
+    Client client(WireFormat::BINARY, &transport);
+
+    EXPECT_TRUE(client.IsAlive("10.0.0.1", 1));
+    EXPECT_FALSE(client.IsAlive("10.0.0.1", 2));
+    EXPECT_ANY_THROW(client.MakeRequest("10.0.0.1", 2, Json::Value()));
+
+    transport.Unlisten("10.0.0.1", 1);
+    EXPECT_FALSE(client.IsAlive("10.0.0.1", 1));
+    EXPECT_ANY_THROW(client.MakeRequest("10.0.0.1", 1, Json::Value()));
+}
+
+/// Is traffic counted, by command, as it would be framed over TCP?
+TEST(SimulatedTransport, Stats) {
+    SimulatedTransport transport({ 0ms, 0ms, 0, 0 });
+    ListenEcho(transport, "10.0.0.1", 1);
+    Client client(WireFormat::BINARY, &transport);
+
+    Json::Value req;
+    req["COMMAND"] = "ECHO";
+    client.MakeRequest("10.0.0.1", 1, req);
+    TransportStats stats = transport.GetStats();
+    EXPECT_EQ(stats.messages_, 2);
+    EXPECT_EQ(stats.lost_, 0);
+    EXPECT_GT(stats.bytes_, 2 * FRAME_HEADER_SIZE);
+    EXPECT_EQ(stats.bytes_by_command_["ECHO"], stats.bytes_);
+
+    transport.ResetStats();
+    EXPECT_EQ(transport.GetStats().messages_, 0);
+}
+
+/// Can a ring of peers form on the simulated network, without binding any
+/// ports, and resolve lookups correctly once stabilized, whether they are
+/// resolved recursively or iteratively?
+TEST(SimulatedTransport, Ring) {
+    const int num_peers = 16;
+    SimulatedTransport transport({ 1ms, 500us, 0, 0 });
+    std::vector<std::unique_ptr<Peer>> peers;
+    for(int i = 0; i < num_peers; i++)
+        peers.push_back(std::make_unique<Peer>("10.0.0.1", 6000 + i, 2,
+                                               &transport));
+
+    peers[0]->StartChord();
+    for(int i = 1; i < num_peers; i++)
+        EXPECT_TRUE(peers[i]->Join("10.0.0.1", 6000));
+
+    std::vector<Key> ids;
+    for(const auto &peer : peers)
+        ids.push_back(peer->GetRoutingState()->self_.id_);
+    std::sort(ids.begin(), ids.end());
+    auto true_successor = [&ids](const Key &key) {
+        auto it = std::lower_bound(ids.begin(), ids.end(), key);
+        return it == ids.end() ? ids.front() : *it;
+    };
+
+    // Wait for every peer's successor to be the right one, stabilizing far
+    // more often than usual so as not to wait long.
+    for(const auto &peer : peers)
+        peer->StartStabilizer(20ms, 5ms);
+    auto converged = [&] {
+        return std::all_of(peers.begin(), peers.end(), [&](const auto &peer) {
+            auto routing = peer->GetRoutingState();
+            return routing->successors_.Size() > 0 &&
+                   routing->successors_.GetNthEntry(0).id_ ==
+                   true_successor(routing->self_.id_ + 1);
+        });
+    };
+    auto deadline = std::chrono::steady_clock::now() + 20s;
+    while(! converged() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(50ms);
+    ASSERT_TRUE(converged());
+
+    for(LookupMode mode : { LookupMode::RECURSIVE, LookupMode::ITERATIVE }) {
+        for(const auto &peer : peers)
+            peer->SetLookupMode(mode);
+        for(int i = 0; i < 64; i++) {
+            Key key("key" + std::to_string(i), false);
+            EXPECT_EQ(peers[i % num_peers]->FindSuccessor(key).id_,
+                      true_successor(key));
+        }
+    }
+    EXPECT_GT(transport.GetStats().messages_, 0);
+}
@@ -0,0 +1,99 @@
+#include "../src/wire_format.h"
+#include "../src/data_block.h"
+#include "../src/key.h"
+#include <gtest/gtest.h>
+
+/**
+ * Serialize a message in the binary encoding and parse it back.
+ *
+ * @param message Message to round-trip.
+ * @return Parsed message.
+ */
+static Json::Value BinaryRoundTrip(const Json::Value &message)
+{
+	std::string serialized = Serialize(message, WireFormat::BINARY);
+	return Deserialize(serialized.data(), serialized.data() + serialized.size(),
+	                   WireFormat::BINARY);
+}
+
+/// Does every kind of JSON value survive the binary encoding unchanged?
+TEST(WireFormat, RoundTripsEveryType) {
+	Json::Value message;
+	message["COMMAND"] = "GET_SUCC";
+	message["KEY"] = std::string(Key("some key", false));
+	message["NOT_A_TOKEN"] = "127.0.0.1";
+	message["EMPTY"] = "";
+	message["INT"] = -12345;
+	message["UINT"] = Json::UInt64(1) << 40;
+	message["REAL"] = 3.25;
+	message["TRUE"] = true;
+	message["FALSE"] = false;
+	message["NULL"] = Json::Value();
+	message["EMPTY_ARRAY"] = Json::Value(Json::arrayValue);
+	message["EMPTY_OBJECT"] = Json::Value(Json::objectValue);
+	message["MIXED"].append(1);
+	message["MIXED"].append("two");
+	message["MIXED"].append(3.5);
+	message["REALS"].append(0.1);
+	message["REALS"].append(-2e300);
+	message["NESTED"]["PEER"]["PORT"] = 5000;
+
+	EXPECT_EQ(message, BinaryRoundTrip(message));
+}
+
+/// Hex strings are packed, but leading zeros and odd lengths must survive.
+TEST(WireFormat, PreservesHexStrings) {
+	for(const std::string &hex : { std::string("0"), std::string("abc"),
+	                               std::string("0000"), std::string("0abcdef"),
+	                               std::string("deadbeef"),
+	                               std::string(32, 'f'), std::string(255, 'a'),
+	                               std::string(256, 'b'),
+	                               std::string(4097, '7') }) {
+		Json::Value message(hex);
+		EXPECT_EQ(message, BinaryRoundTrip(message));
+	}
+}
+
+/// Fragments must arrive bit-for-bit, and take a byte per byte of data.
+TEST(WireFormat, FragmentsAreExact) {
+	ByteArr data(1000);
+	for(size_t i = 0; i < data.size(); i++)
+		data[i] = uint8_t(i * 7);
+	DataFragment frag(data, 7, 10000);
+	Json::Value parsed = BinaryRoundTrip(Json::Value(frag));
+	EXPECT_EQ(frag, DataFragment(parsed));
+	EXPECT_LT(Serialize(Json::Value(frag), WireFormat::BINARY).size(),
+	          data.size() + 32);
+}
+
+/// A typical CREATE_FRAG request should be far smaller than its JSON.
+TEST(WireFormat, SmallerThanJson) {
+	ByteArr values;
+	for(int i = 0; i < 40; i++)
+		values.push_back(uint8_t(i * 31));
+
+	Json::Value request;
+	request["COMMAND"] = "CREATE_FRAG";
+	request["KEY"] = std::string(Key("some key", false));
+	request["FRAGMENT"] = Json::Value(DataFragment(values, 3, 400));
+
+	size_t json_size = Serialize(request, WireFormat::JSON).size(),
+	       binary_size = Serialize(request, WireFormat::BINARY).size();
+	EXPECT_LT(binary_size * 2, json_size);
+}
+
+/// Malformed binary messages must be rejected rather than misread.
+TEST(WireFormat, RejectsMalformedMessages) {
+	Json::Value message;
+	message["KEYS"].append("0123456789abcdef");
+	message["KEYS"].append("fedcba9876543210");
+	std::string serialized = Serialize(message, WireFormat::BINARY);
+
+	for(size_t len = 0; len < serialized.size(); len++)
+		EXPECT_THROW(Deserialize(serialized.data(), serialized.data() + len,
+		                         WireFormat::BINARY), std::runtime_error);
+
+	std::string trailing = serialized + '\0';
+	EXPECT_THROW(Deserialize(trailing.data(), trailing.data() + trailing.size(),
+	                         WireFormat::BINARY), std::runtime_error);
+}